@@ -28,12 +28,13 @@
 #include "panic.h"
 #include "debug.h"
 #include "file.h"
+#include "pathfuncs.h"
 #include "appevents.h"
 #include "metadata.h"
 #include "bmp.h"
 #ifdef HAVE_ALBUMART
 #include "albumart.h"
-#include "jpeg_load.h"
+#include "albumart_cache.h"
 #include "playback.h"
 #endif
 #include "buffering.h"
@@ -45,6 +46,12 @@
 
 #define BUF_MAX_HANDLES 384
 
+/* Hosted applications map audio files instead of copying them into the
+   buffer, which then only holds the handle structs for them */
+#if defined(APPLICATION) && defined(HAVE_OS_MMAP_FILE)
+#define BUFFERING_MMAP
+#endif
+
 /* macros to enable logf for queues
    logging on SYS_TIMEOUT can be disabled */
 #ifdef SIMULATOR
@@ -78,6 +85,7 @@ enum handle_flags
     H_CANWRAP   = 0x1,   /* Handle data may wrap in buffer */
     H_ALLOCALL  = 0x2,   /* All data must be allocated up front */
     H_FIXEDDATA = 0x4,   /* Data is fixed in position */
+    H_MAPPED    = 0x8,   /* Data is read from a file mapping, not the buffer */
 };
 
 struct memory_handle {
@@ -97,6 +105,10 @@ struct memory_handle {
     off_t   start;          /* Offset at which we started reading the file */
     off_t   pos;            /* Read position in file */
     off_t volatile end;     /* Offset at which we stopped reading the file */
+#ifdef BUFFERING_MMAP
+    char   *map;            /* Mapping of the whole file if H_MAPPED */
+    size_t  mapsize;        /* Size of the mapping */
+#endif
     char    path[];         /* Path if data originated in a file */
 };
 
@@ -145,6 +157,16 @@ static struct mutex llist_mutex SHAREDBSS_ATTR;
 #define MRU_HANDLE(m) \
     container_of((m), struct memory_handle, mrunode)
 
+/* Read-ahead: while the user expects to open more handles soon, completing
+   the fill doesn't put the disk to sleep right away so the next handles can
+   be filled in the same spin-up */
+#define BUF_READAHEAD_WAIT  (HZ*2)  /* Max time to wait for new handles */
+
+static int readahead_tracks;        /* Tracks expected to be opened next */
+static bool readahead_wait;         /* Holding off storage_sleep() */
+static long readahead_tick;         /* Tick at which to give up waiting */
+static unsigned int spinups_avoided;
+
 static struct data_counters
 {
     size_t remaining;   /* Amount of data needing to be buffered */
@@ -365,6 +387,9 @@ add_handle(unsigned int flags, size_t data_size, const char *path,
         ridx = ringbuf_offset(first);
         widx = last->data;
         cur_total = last->filesize - last->start;
+
+        if (last->flags & H_MAPPED)
+            cur_total = 0; /* Needs no space for its data */
     }
 
     if (cur_total > 0) {
@@ -638,6 +663,13 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
         return true;
     }
 
+    if (h->flags & H_MAPPED) {
+        /* all data is available through the mapping */
+        h->end = h->filesize;
+        send_event(BUFFER_EVENT_FINISHED, &handle_id);
+        return true;
+    }
+
     if (h->fd < 0) { /* file closed, reopen */
         if (h->path[0] != '\0')
             h->fd = open(h->path, O_RDONLY);
@@ -745,6 +777,10 @@ static bool close_handle(int handle_id)
     /* If the handle is not found, it is closed */
     if (h) {
         close_fd(&h->fd);
+#ifdef BUFFERING_MMAP
+        if (h->flags & H_MAPPED)
+            os_munmap_file(h->map, h->mapsize);
+#endif
         unlink_handle(h);
     }
 
@@ -759,6 +795,11 @@ static struct memory_handle * shrink_handle(struct memory_handle *h)
     if (!h)
         return NULL;
 
+    if (h->flags & H_MAPPED) {
+        /* nothing but the struct is in the buffer and nothing after it */
+        return h;
+    }
+
     if (h->type == TYPE_PACKET_AUDIO) {
         /* only move the handle struct */
         /* data is pinned by default - if we start moving packet audio,
@@ -837,6 +878,12 @@ static bool fill_buffer(void)
 
     if (m) {
         return true;
+    } else if (readahead_tracks > 0) {
+        /* more handles are on their way; give them a chance to arrive
+           while the disk is still spinning */
+        readahead_wait = true;
+        readahead_tick = current_tick + BUF_READAHEAD_WAIT;
+        return false;
     } else {
         /* only spin the disk down if the filling wasn't interrupted by an
            event arriving in the queue. */
@@ -857,34 +904,23 @@ static int load_image(int fd, const char *path,
     struct bitmap *bmp = ringbuf_ptr(bufidx);
     struct dim *dim = data->dim;
     struct mp3_albumart *aa = data->embedded_albumart;
+    off_t offset = aa ? aa->pos : -1;
+    off_t length = aa ? aa->size : filesize(fd);
 
     /* get the desired image size */
     bmp->width = dim->width, bmp->height = dim->height;
     /* FIXME: alignment may be needed for the data buffer. */
     bmp->data = ringbuf_ptr(bufidx + sizeof(struct bitmap));
 
-#if (LCD_DEPTH > 1) || defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1)
-    bmp->maskdata = NULL;
-#endif
     int free = (int)MIN(buffer_len - bytes_used(), buffer_len - bufidx)
                         - sizeof(struct bitmap);
 
-#ifdef HAVE_JPEG
-    if (aa != NULL) {
-        lseek(fd, aa->pos, SEEK_SET);
-        rc = clip_jpeg_fd(fd, aa->size, bmp, free, FORMAT_NATIVE|FORMAT_DITHER|
-                         FORMAT_RESIZE|FORMAT_KEEP_ASPECT, NULL);
-    }
-    else if (strcmp(path + strlen(path) - 4, ".bmp"))
-        rc = read_jpeg_fd(fd, bmp, free, FORMAT_NATIVE|FORMAT_DITHER|
-                          FORMAT_RESIZE|FORMAT_KEEP_ASPECT, NULL);
-    else
-#endif
-        rc = read_bmp_fd(fd, bmp, free, FORMAT_NATIVE|FORMAT_DITHER|
-                         FORMAT_RESIZE|FORMAT_KEEP_ASPECT, NULL);
+    /* already scaled in the album art cache? */
+    rc = albumart_cache_read(path, offset, length, bmp, free);
+    if (rc <= 0)
+        rc = albumart_decode_fd(fd, path, offset, length, bmp, free);
 
     return rc + (rc > 0 ? sizeof(struct bitmap) : 0);
-    (void)path;
 }
 #endif /* HAVE_ALBUMART */
 
@@ -907,6 +943,54 @@ management functions for all the actual handle management work.
 */
 
 
+#ifdef BUFFERING_MMAP
+/* Should the file be mapped instead of copied? A file on removable storage
+   may be truncated or go away under the mapping, which raises SIGBUS where
+   copying would just see a read error. */
+static bool can_map_file(const char *path)
+{
+#ifdef HAVE_HOTSWAP
+#ifdef HAVE_MULTIVOLUME
+    int volume = path_strip_volume(path, NULL, false);
+#else
+    int volume = 0;
+#endif
+    if (volume_removable(volume))
+        return false;
+#endif /* HAVE_HOTSWAP */
+
+    return true;
+    (void)path;
+}
+
+/* Mapped data from the playing handle on that is still to be used. A mapped
+   handle takes no space in the buffer, so this is what limits reading ahead
+   to what copying could have buffered. */
+static size_t mapped_data_ahead(void)
+{
+    size_t ahead = 0;
+
+    mutex_lock(&llist_mutex);
+
+    struct memory_handle *m = find_handle(base_handle_id);
+    bool is_useful = m == NULL;
+
+    for (m = HLIST_FIRST; m; m = HLIST_NEXT(m))
+    {
+        if (m->id == base_handle_id)
+            is_useful = true;
+
+        if (is_useful && (m->flags & H_MAPPED))
+            ahead += m->filesize - m->pos;
+    }
+
+    mutex_unlock(&llist_mutex);
+
+    return ahead;
+}
+#endif /* BUFFERING_MMAP */
+
+
 /* Reserve space in the buffer for a file.
    filename: name of the file to open
    offset: offset at which to start buffering the file, useful when the first
@@ -992,12 +1076,36 @@ int bufopen(const char *file, off_t offset, enum data_type type,
     /* Reserve extra space because alignment can move data forward */
     size_t padded_size = STORAGE_PAD(size - adjusted_offset);
 
+#ifdef BUFFERING_MMAP
+    char *map = NULL;
+    if ((type == TYPE_PACKET_AUDIO || type == TYPE_ATOMIC_AUDIO) && size > 0 &&
+        can_map_file(file)) {
+        if (mapped_data_ahead() >= buffer_len) {
+            /* As far ahead as the buffer would reach: the caller retries
+               when the buffer runs low */
+            close(fd);
+            return ERR_BUFFER_FULL;
+        }
+
+        map = os_mmap_file(fd, size);
+    }
+
+    if (map) {
+        hflags = H_MAPPED;
+        padded_size = 0;
+    }
+#endif
+
     mutex_lock(&llist_mutex);
 
     h = add_handle(hflags, padded_size, file, &data);
     if (!h) {
         DEBUGF("%s(): failed to add handle\n", __func__);
         mutex_unlock(&llist_mutex);
+#ifdef BUFFERING_MMAP
+        if (map)
+            os_munmap_file(map, size);
+#endif
         close(fd);
         return ERR_BUFFER_FULL;
     }
@@ -1007,6 +1115,11 @@ int bufopen(const char *file, off_t offset, enum data_type type,
     h->type = type;
     h->fd   = -1;
 
+#ifdef BUFFERING_MMAP
+    h->map     = map;
+    h->mapsize = size;
+#endif
+
 #ifdef STORAGE_WANTS_ALIGN
     /* Don't bother to storage align bitmaps because they are not
      * loaded directly into the buffer.
@@ -1155,6 +1268,14 @@ static void rebuffer_handle(int handle_id, off_t newpos)
         return;
     }
 
+    if (h->flags & H_MAPPED) {
+        /* Just make it all available */
+        h->pos = newpos;
+        queue_reply(&buffering_queue, 0);
+        buffer_handle(handle_id, 0);
+        return;
+    }
+
     /* When seeking foward off of the buffer, if it is a short seek attempt to
        avoid rebuffering the whole track, just read enough to satisfy */
     off_t amount = newpos - h->pos;
@@ -1226,6 +1347,12 @@ static void rebuffer_handle(int handle_id, off_t newpos)
 /* Backend to bufseek and bufadvance */
 static int seek_handle(struct memory_handle *h, off_t newpos)
 {
+    if ((h->flags & H_MAPPED) && h->end >= h->filesize) {
+        /* all of the file is available */
+        h->pos = newpos;
+        return 0;
+    }
+
     if ((newpos < h->start || newpos >= h->end) &&
         (newpos < h->filesize || h->end < h->filesize)) {
         /* access before or after buffered data and not to end of file or file
@@ -1315,7 +1442,8 @@ static struct memory_handle *prep_bufdata(int handle_id, size_t *size,
     if (realsize <= 0 || realsize > filerem)
         realsize = filerem; /* clip to eof */
 
-    if (guardbuf_limit && realsize > GUARD_BUFSIZE) {
+    if (guardbuf_limit && realsize > GUARD_BUFSIZE &&
+        !(h->flags & H_MAPPED)) {
         logf("data request > guardbuf");
         /* If more than the size of the guardbuf is requested and this is a
          * bufgetdata, limit to guard_bufsize over the end of the buffer */
@@ -1382,6 +1510,13 @@ ssize_t bufread(int handle_id, size_t size, void *dest)
     if (!h)
         return ERR_HANDLE_NOT_FOUND;
 
+#ifdef BUFFERING_MMAP
+    if (h->flags & H_MAPPED) {
+        memcpy(dest, h->map + h->pos, size);
+        return size;
+    }
+#endif
+
     if (h->ridx + size > buffer_len) {
         /* the data wraps around the end of the buffer */
         size_t read = buffer_len - h->ridx;
@@ -1410,6 +1545,16 @@ ssize_t bufgetdata(int handle_id, size_t size, void **data)
     if (!h)
         return ERR_HANDLE_NOT_FOUND;
 
+#ifdef BUFFERING_MMAP
+    if (h->flags & H_MAPPED) {
+        /* no copy: point straight into the mapping */
+        if (data)
+            *data = h->map + h->pos;
+
+        return size;
+    }
+#endif
+
     if (h->ridx + size > buffer_len) {
         /* the data wraps around the end of the buffer :
            use the guard buffer to provide the requested amount of data. */
@@ -1439,6 +1584,13 @@ ssize_t bufgettail(int handle_id, size_t size, void **data)
     if (!h)
         return ERR_HANDLE_NOT_FOUND;
 
+#ifdef BUFFERING_MMAP
+    if ((h->flags & H_MAPPED) && h->end >= h->filesize) {
+        *data = h->map + h->end - size;
+        return size;
+    }
+#endif
+
     if (h->end >= h->filesize) {
         size_t tidx = ringbuf_sub_empty(h->widx, size);
 
@@ -1471,7 +1623,8 @@ ssize_t bufcuttail(int handle_id, size_t size)
         if (available < size)
             size = available;
 
-        h->widx = ringbuf_sub_empty(h->widx, size);
+        if (!(h->flags & H_MAPPED))
+            h->widx = ringbuf_sub_empty(h->widx, size);
         h->filesize -= size;
         h->end -= size;
     } else {
@@ -1596,6 +1749,13 @@ size_t buf_get_watermark(void)
     return BUF_WATERMARK;
 }
 
+/* Set the number of tracks the user predicts it will open next, which
+   keeps the disk spinning for them after the current handles are filled */
+void buf_set_readahead(int tracks)
+{
+    readahead_tracks = tracks;
+}
+
 /** -- buffer thread helpers -- **/
 static void shrink_buffer(void)
 {
@@ -1624,6 +1784,10 @@ static void NORETURN_ATTR buffering_thread(void)
             queue_wait_w_tmo(&buffering_queue, &ev, filling ? 1 : HZ/2);
         } else {
             filling = false;
+            if (readahead_wait) {
+                readahead_wait = false;
+                storage_sleep();
+            }
             cancel_cpu_boost();
             queue_wait(&buffering_queue, &ev);
         }
@@ -1670,6 +1834,12 @@ static void NORETURN_ATTR buffering_thread(void)
                 LOGFQUEUE("buffering < Q_HANDLE_ADDED %d", (int)ev.data);
                 /* A handle was added: the disk is spinning, so we can fill */
                 filling = true;
+                if (readahead_wait) {
+                    /* the disk would have been put to sleep and spun up
+                       again for this one */
+                    readahead_wait = false;
+                    spinups_avoided++;
+                }
                 break;
 
             case SYS_TIMEOUT:
@@ -1677,6 +1847,13 @@ static void NORETURN_ATTR buffering_thread(void)
                 break;
         }
 
+        if (readahead_wait && (readahead_tracks <= 0 ||
+                               TIME_AFTER(current_tick, readahead_tick))) {
+            /* nothing more came */
+            readahead_wait = false;
+            storage_sleep();
+        }
+
         if (num_handles == 0 || !queue_empty(&buffering_queue))
             continue;
 
@@ -1758,6 +1935,7 @@ bool buffering_reset(char *buf, size_t buflen)
 
     num_handles = 0;
     base_handle_id = -1;
+    readahead_tracks = 0;
 
     /* Set the high watermark as 75% full...or 25% empty :)
        This is the greatest fullness that will trigger low-buffer events
@@ -1780,4 +1958,5 @@ void buffering_get_debugdata(struct buffering_debug *dbgdata)
     dbgdata->buffered_data = dc.buffered;
     dbgdata->useful_data = dc.useful;
     dbgdata->watermark = BUF_WATERMARK;
+    dbgdata->spinups_avoided = spinups_avoided;
 }
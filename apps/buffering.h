@@ -116,6 +116,7 @@ size_t buf_used(void);
 void buf_set_base_handle(int handle_id);
 void buf_set_watermark(size_t bytes);
 size_t buf_get_watermark(void);
+void buf_set_readahead(int tracks);
 
 /* Debugging */
 struct buffering_debug {
@@ -124,6 +125,7 @@ struct buffering_debug {
     size_t data_rem;
     size_t useful_data;
     size_t watermark;
+    unsigned int spinups_avoided;
 };
 void buffering_get_debugdata(struct buffering_debug *dbgdata);
 
@@ -63,6 +63,7 @@
 #include "rtc.h"
 #include "storage.h"
 #include "fs_defines.h"
+#include "disk_cache.h"
 #include "eeprom_24cxx.h"
 #if (CONFIG_STORAGE & STORAGE_MMC) || (CONFIG_STORAGE & STORAGE_SD)
 #include "sdmmc.h"
@@ -80,6 +81,10 @@
 #include "radio.h"
 #endif
 
+#ifdef HAVE_PCM_ALSA
+#include "pcm-alsa.h"
+#endif
+
 #include "scrollbar.h"
 #include "peakmeter.h"
 #include "skin_engine/skin_engine.h"
@@ -88,6 +93,7 @@
 #include "pcmbuf.h"
 #include "buffering.h"
 #include "playback.h"
+#include "dsp_core.h"
 #if defined(HAVE_SPDIF_OUT) || defined(HAVE_SPDIF_IN)
 #include "spdif.h"
 #endif
@@ -298,6 +304,77 @@ static bool dbg_cpuinfo(void)
 
 #endif
 
+#ifdef HAVE_PCM_ALSA
+/* period size (frames), period count; 0 is the default sizing */
+static const unsigned short alsa_latencies[][2] =
+{
+    { 0, 0 }, { 1024, 4 }, { 512, 4 }, { 256, 4 },
+};
+static int alsa_latency = 0;
+
+static const char* get_alsa_info(int selected_item, void *data,
+                                 char *buffer, size_t buffer_len)
+{
+    (void)data;
+    struct pcm_alsa_debug d;
+    pcm_alsa_get_debug(&d);
+
+    switch (selected_item)
+    {
+        case 0:
+            snprintf(buffer, buffer_len, "rate: %d Hz", pcm_alsa_get_rate());
+            break;
+        case 1:
+            snprintf(buffer, buffer_len, "period: %ld frames", d.period_size);
+            break;
+        case 2:
+            snprintf(buffer, buffer_len, "buffer: %ld frames (%ld ms)",
+                     d.buffer_size, d.latency_ms);
+            break;
+        case 3:
+            snprintf(buffer, buffer_len, "underruns: %u", d.underruns);
+            break;
+        case 4:
+            snprintf(buffer, buffer_len, "write errors: %u", d.write_errors);
+            break;
+        case 5:
+            snprintf(buffer, buffer_len, "feeder: %s",
+                     d.realtime ? "realtime" : "normal");
+            break;
+        default:
+            return "SELECT: cycle latency";
+    }
+    return buffer;
+}
+
+static int alsa_info_cb(int action, struct gui_synclist *lists)
+{
+    (void)lists;
+    if (action == ACTION_STD_OK)
+    {
+        alsa_latency = (alsa_latency + 1) % ARRAYLEN(alsa_latencies);
+        pcm_alsa_set_latency(alsa_latencies[alsa_latency][0],
+                             alsa_latencies[alsa_latency][1]);
+        action = ACTION_REDRAW;
+    }
+    else if (action == ACTION_NONE)
+        action = ACTION_REDRAW;
+    return action;
+}
+
+static bool dbg_alsa_info(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "PCM info:", 7, NULL);
+    info.get_name = get_alsa_info;
+    info.action_callback = alsa_info_cb;
+    info.timeout = HZ;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    return simplelist_show_list(&info);
+}
+#endif /* HAVE_PCM_ALSA */
+
 static unsigned int ticks, freq_sum;
 #ifndef CPU_MULTI_FREQUENCY
 static unsigned int boost_ticks;
@@ -405,6 +482,8 @@ static bool dbg_buffering_thread(void)
 
             screens[i].putsf(0, line++, "handle count: %d", (int)d.num_handles);
 
+            screens[i].putsf(0, line++, "spinups saved: %u", d.spinups_avoided);
+
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
             screens[i].putsf(0, line++, "cpu freq: %3dMHz",
                              (int)((FREQ + 500000) / 1000000));
@@ -440,6 +519,68 @@ static bool dbg_buffering_thread(void)
     return false;
 }
 
+#ifdef DSP_PROFILE_TIMER
+static int dsp_profile_callback(int btn, struct gui_synclist *lists)
+{
+    struct dsp_config *dsp = dsp_get_config(CODEC_IDX_AUDIO);
+    unsigned long elapsed = dsp_profile_elapsed(dsp);
+    unsigned long total = 0;
+    struct dsp_proc_stats stats;
+    const char *name;
+    unsigned int load;
+
+    if (btn == ACTION_STD_OK)
+    {
+        dsp_profile_enable(dsp, true);
+        btn = ACTION_NONE;
+    }
+
+    simplelist_set_line_count(0);
+
+    for (unsigned int i = 0; (name = dsp_profile_get_stats(dsp, i, &stats));
+         i++)
+    {
+        if (!stats.calls)
+            continue;
+
+        /* CPU load in 0.1 % and time per input sample */
+        load = elapsed ? 1000ull*stats.time / elapsed : 0;
+        unsigned long ns = stats.samples ?
+            1000000000ull / DSP_PROFILE_TIMER_HZ * stats.time / stats.samples : 0;
+        simplelist_addline("%s: %u.%u%% %lu ns/smp", name,
+                           load / 10, load % 10, ns);
+        total += stats.time;
+    }
+
+    load = elapsed ? 1000ull*total / elapsed : 0;
+    simplelist_addline("All stages: %u.%u%%", load / 10, load % 10);
+
+    if (btn == ACTION_NONE)
+        btn = ACTION_REDRAW;
+
+    return btn;
+    (void)lists;
+}
+
+static bool dbg_dsp_profile(void)
+{
+    struct dsp_config *dsp = dsp_get_config(CODEC_IDX_AUDIO);
+    struct simplelist_info info;
+    bool ret;
+
+    simplelist_info_init(&info, "DSP stages [OK to reset]", 1, NULL);
+    info.action_callback = dsp_profile_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    info.timeout = HZ;
+
+    dsp_profile_enable(dsp, true);
+    ret = simplelist_show_list(&info);
+    dsp_profile_enable(dsp, false);
+    return ret;
+}
+#endif /* DSP_PROFILE_TIMER */
+
 static const char* bf_getname(int selected_item, void *data,
                                    char *buffer, size_t buffer_len)
 {
@@ -1697,6 +1838,44 @@ static bool dbg_disk_info(void)
     info.scroll_all = true;
     return simplelist_show_list(&info);
 }
+
+static int disk_cache_callback(int btn, struct gui_synclist *lists)
+{
+    struct dc_stats stats;
+    dc_get_stats(&stats);
+
+    simplelist_set_line_count(0);
+
+    unsigned long probes = stats.hits + stats.misses;
+    unsigned int hitrate = probes ? 1000ull*stats.hits / probes : 0;
+    simplelist_addline("Entries: %d x %d B", DC_NUM_ENTRIES, DC_CACHE_BUFSIZE);
+    simplelist_addline("Hits: %lu (%u.%u%%)", stats.hits,
+                       hitrate / 10, hitrate % 10);
+    simplelist_addline("Misses: %lu", stats.misses);
+#ifdef DC_READAHEAD
+    simplelist_addline("Read-ahead max: %d sectors", DC_READAHEAD_MAX);
+    simplelist_addline("Read-aheads: %lu", stats.readaheads);
+    simplelist_addline("Prefetched: %lu", stats.prefetched);
+    simplelist_addline("Prefetch used: %lu", stats.prefetch_hits);
+    simplelist_addline("Prefetch wasted: %lu", stats.prefetch_unused);
+#endif
+
+    if (btn == ACTION_NONE)
+        btn = ACTION_REDRAW;
+
+    return btn;
+    (void)lists;
+}
+
+static bool dbg_disk_cache_info(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Disk Cache Info", 1, NULL);
+    info.action_callback = disk_cache_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    return simplelist_show_list(&info);
+}
 #endif /* PLATFORM_NATIVE */
 
 #ifdef HAVE_DIRCACHE
@@ -1747,6 +1926,13 @@ static int dircache_callback(int btn, struct gui_synclist *lists)
     simplelist_addline("Scanning took: %ld.%ld s",
                        ticks / HZ, (ticks*10 / HZ) % 10);
     simplelist_addline("Entry count: %u", info.entry_count);
+#ifdef DIRCACHE_NAME_INDEX
+    simplelist_addline("Index: %lu B%s", info.index_size,
+                       info.index_valid ? "" : " (off)");
+    simplelist_addline("Index entries: %u", info.index_count);
+    simplelist_addline("Index hit/absent/scan: %lu/%lu/%lu",
+                       info.index_hits, info.index_absent, info.index_passed);
+#endif
 
     if (btn == ACTION_NONE)
         btn = ACTION_REDRAW;
@@ -1797,6 +1983,36 @@ static int database_callback(int btn, struct gui_synclist *lists)
     simplelist_addline("Queue length: %d",
              stat->queue_length);
 
+#ifdef TAGCACHE_PARALLEL_SCAN
+    if (stat->scan.threads > 0)
+    {
+        simplelist_addline("Scan: %d threads, %ld ms",
+                 stat->scan.threads, (long)(stat->scan.total_us / 1000));
+        simplelist_addline("Read: %ld files, %ld ms",
+                 stat->scan.read, (long)(stat->scan.read_us / 1000));
+        simplelist_addline("Write: %ld entries, %ld KB, %ld ms",
+                 stat->scan.written, stat->scan.written_bytes / 1024,
+                 (long)(stat->scan.write_us / 1000));
+        simplelist_addline("Stall: %ld ms",
+                 (long)(stat->scan.stall_us / 1000));
+    }
+#endif
+
+#ifdef HAVE_METADATA_PROBE
+    struct metadata_probe_stat probe;
+    metadata_probe_get_stat(&probe);
+    if (probe.probes > 0)
+    {
+        simplelist_addline("Metadata: %lu files, %lu syscalls",
+                 probe.probes, probe.syscalls);
+        simplelist_addline("Per file: %lu calls, %lu syscalls",
+                 probe.calls / probe.probes, probe.syscalls / probe.probes);
+        simplelist_addline("Last file: %lu calls, %lu syscalls",
+                 probe.last_calls, probe.last_syscalls);
+        simplelist_addline("Outside window: %lu", probe.fallbacks);
+    }
+#endif
+
     if (synced)
     {
         synced = false;
@@ -2392,6 +2608,35 @@ static bool dbg_pic(void)
 }
 #endif
 
+static bool dbg_font_cache(void)
+{
+    struct simplelist_info info;
+    struct font_cache_stats stats;
+
+    simplelist_info_init(&info, "Font glyph caches", 0, NULL);
+    simplelist_set_line_count(0);
+    info.hide_selection = true;
+    info.scroll_all = true;
+    for (int i = FONT_FIRSTUSERFONT; i < MAXFONTS; i++)
+    {
+        if (!font_get_cache_stats(i, &stats))
+            continue;
+        unsigned long lookups = stats.hits + stats.misses;
+        simplelist_addline("%d: %s", i, font_filename(i));
+        simplelist_addline("\tglyphs: %d/%d (%lu bytes)",
+                           stats.glyphs, stats.capacity,
+                           (unsigned long)stats.bytes);
+        unsigned long percent = lookups ?
+                (unsigned long)(stats.hits * 100ULL / lookups) : 0;
+        simplelist_addline("\thits: %lu misses: %lu (%lu%%)",
+                           stats.hits, stats.misses, percent);
+        simplelist_addline("\tevictions: %lu", stats.evictions);
+    }
+    if (simplelist_get_line_count() == 0)
+        simplelist_addline("No cached fonts");
+    return simplelist_show_list(&info);
+}
+
 static bool dbg_skin_engine(void)
 {
     struct simplelist_info info;
@@ -2406,10 +2651,14 @@ static bool dbg_skin_engine(void)
     simplelist_set_line_count(0);
     info.hide_selection = true;
     FOR_NB_SCREENS(j) {
+        struct skin_lcd_stats lcd_stats;
 #if NB_SCREENS > 1
         simplelist_addline("%s display:",
                            j == 0 ? "Main" : "Remote");
 #endif
+        skin_get_lcd_stats(j, &lcd_stats);
+        simplelist_addline("LCD updates: %lu B/s (full: %lu B/s)",
+                lcd_stats.bytes_per_sec, lcd_stats.full_bytes_per_sec);
         for (i = 0; i < skin_get_num_skins(); i++) {
             struct skin_stats *stats = skin_get_stats(i, j);
             if (stats->buflib_handles)
@@ -2521,6 +2770,9 @@ static const struct {
 #ifdef __linux__
         { "View CPU stats", dbg_cpuinfo },
 #endif
+#ifdef HAVE_PCM_ALSA
+        { "View PCM info", dbg_alsa_info },
+#endif
 #if (CONFIG_BATTERY_MEASURE != 0) && !defined(SIMULATOR)
         { "View battery", view_battery },
 #endif
@@ -2528,6 +2780,7 @@ static const struct {
         { "Screendump", dbg_screendump },
 #endif
         { "Skin Engine RAM usage", dbg_skin_engine },
+        { "View font cache", dbg_font_cache },
 #if ((CONFIG_PLATFORM & PLATFORM_NATIVE) || defined(SONY_NWZ_LINUX) || defined(HIBY_LINUX) || defined(FIIO_M3K)) && !defined(SIMULATOR)
         { "View HW info", dbg_hw_info },
 #endif
@@ -2536,6 +2789,7 @@ static const struct {
 #endif
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
         { "View disk info", dbg_disk_info },
+        { "View disk cache info", dbg_disk_cache_info },
 #if (CONFIG_STORAGE & STORAGE_ATA)
         { "Dump ATA identify info", dbg_identify_info},
 #ifdef HAVE_ATA_SMART
@@ -2551,6 +2805,9 @@ static const struct {
         { "View database info", dbg_tagcache_info },
 #endif
         { "View buffering thread", dbg_buffering_thread },
+#ifdef DSP_PROFILE_TIMER
+        { "View DSP stage timing", dbg_dsp_profile },
+#endif
 #ifdef PM_DEBUG
         { "pm histogram", peak_meter_histogram},
 #endif /* PM_DEBUG */
@@ -178,6 +178,7 @@ void draw_progressbar(struct gui_wps *gwps, int line, struct progressbar *pb)
         /* if Y was not set calculate by font height,Y is -line_number-1 */
         y = line*line_height + (0 > center ? 0 : center);
     }
+    skin_damage_add(vp, x, y, width, height);
 
     if (pb->type == SKIN_TOKEN_VOLUMEBAR)
     {
@@ -394,12 +395,18 @@ void wps_display_images(struct gui_wps *gwps, struct viewport* vp)
         if (img->using_preloaded_icons && img->display >= 0)
         {
             screen_put_icon(display, img->x, img->y, img->display);
+            skin_damage_viewport(vp);
         }
         else if (img->loaded)
         {
             if (img->display >= 0)
             {
                 wps_draw_image(gwps, img, img->display, vp);
+                if (img->is_9_segment)
+                    skin_damage_viewport(vp);
+                else
+                    skin_damage_add(vp, img->x, img->y,
+                                    img->bm.width, img->subimage_height);
             }
         }
         list = SKINOFFSETTOPTR(get_skin_buffer(data), list->next);
@@ -411,6 +418,7 @@ void wps_display_images(struct gui_wps *gwps, struct viewport* vp)
         && aa->draw_handle >= 0)
     {
         draw_album_art(gwps, aa->draw_handle, false);
+        skin_damage_albumart(gwps, aa);
         aa->draw_handle = -1;
     }
 #endif
@@ -39,6 +39,14 @@ void wps_display_images(struct gui_wps *gwps, struct viewport* vp);
 void skin_render_viewport(struct skin_element* viewport, struct gui_wps *gwps,
                         struct skin_viewport* skin_viewport, unsigned long refresh_type);
 
+/* Report an area drawn to during skin_render() so it gets sent to the LCD.
+   Coordinates are relative to vp. Does nothing outside of skin_render(). */
+void skin_damage_add(struct viewport *vp, int x, int y, int width, int height);
+void skin_damage_viewport(struct viewport *vp);
+#ifdef HAVE_ALBUMART
+void skin_damage_albumart(struct gui_wps *gwps, struct skin_albumart *aa);
+#endif
+
 
 /* Evaluate the conditional that is at *token_index and return whether a skip
    has ocurred. *token_index is updated with the new position.
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <limits.h>
 #include "strlcat.h"
 
 #include "config.h"
@@ -84,6 +85,176 @@ static void skin_render_playlistviewer(struct playlistviewer* viewer,
 
 static char* skin_buffer;
 
+/* Damage tracking. Everything drawn while rendering a frame reports the
+ * area it touched (in screen coordinates); at the end of skin_render()
+ * only the merged areas are pushed to the LCD instead of the whole frame.
+ */
+#define SKIN_DAMAGE_RECTS   8
+
+struct skin_damage_rect {
+    int x1, y1, x2, y2; /* x2/y2 are exclusive */
+};
+
+struct skin_damage {
+    struct screen *display;
+    bool full;
+    int count;
+    struct skin_damage_rect rect[SKIN_DAMAGE_RECTS];
+};
+
+static struct skin_damage *damage; /* NULL when not inside skin_render() */
+
+static struct lcd_update_stats {
+    long window_start;
+    unsigned long bytes, full_bytes;
+    struct skin_lcd_stats last;
+} lcd_update_stats[NB_SCREENS];
+
+static inline int damage_area(const struct skin_damage_rect *r)
+{
+    return (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static void damage_union(struct skin_damage_rect *dst,
+                         const struct skin_damage_rect *src)
+{
+    dst->x1 = MIN(dst->x1, src->x1);
+    dst->y1 = MIN(dst->y1, src->y1);
+    dst->x2 = MAX(dst->x2, src->x2);
+    dst->y2 = MAX(dst->y2, src->y2);
+}
+
+/* mark the area x,y,width,height of vp as needing to go to the LCD */
+void skin_damage_add(struct viewport *vp, int x, int y, int width, int height)
+{
+    if (!damage || damage->full || !vp)
+        return;
+
+    /* clip to the viewport, then to the screen */
+    struct skin_damage_rect r = {
+        .x1 = vp->x + MAX(x, 0),
+        .y1 = vp->y + MAX(y, 0),
+        .x2 = vp->x + MIN(x + width, vp->width),
+        .y2 = vp->y + MIN(y + height, vp->height),
+    };
+    r.x1 = MAX(r.x1, 0);
+    r.y1 = MAX(r.y1, 0);
+    r.x2 = MIN(r.x2, damage->display->lcdwidth);
+    r.y2 = MIN(r.y2, damage->display->lcdheight);
+    if (r.x1 >= r.x2 || r.y1 >= r.y2)
+        return;
+
+    /* fold in every rect that overlaps or touches the new one; the union
+       may now reach others so restart the scan whenever one is taken */
+    for (int i = 0; i < damage->count; )
+    {
+        struct skin_damage_rect *d = &damage->rect[i];
+        if (d->x1 <= r.x2 && r.x1 <= d->x2 && d->y1 <= r.y2 && r.y1 <= d->y2)
+        {
+            damage_union(&r, d);
+            *d = damage->rect[--damage->count];
+            i = 0;
+        }
+        else
+            i++;
+    }
+
+    if (damage->count < SKIN_DAMAGE_RECTS)
+    {
+        damage->rect[damage->count++] = r;
+        return;
+    }
+
+    /* list is full, merge into the rect that grows the least */
+    int best = 0, best_growth = INT_MAX;
+    for (int i = 0; i < damage->count; i++)
+    {
+        struct skin_damage_rect u = damage->rect[i];
+        damage_union(&u, &r);
+        int growth = damage_area(&u) - damage_area(&damage->rect[i]);
+        if (growth < best_growth)
+        {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    damage_union(&damage->rect[best], &r);
+}
+
+/* as with set_viewport(), a NULL vp means the whole screen */
+void skin_damage_viewport(struct viewport *vp)
+{
+    if (vp)
+        skin_damage_add(vp, 0, 0, vp->width, vp->height);
+    else if (damage)
+        damage->full = true;
+}
+
+#ifdef HAVE_ALBUMART
+void skin_damage_albumart(struct gui_wps *gwps, struct skin_albumart *aa)
+{
+    if (!aa)
+        return;
+    struct viewport *vp = SKINOFFSETTOPTR(get_skin_buffer(gwps->data), aa->vp);
+    if (vp && aa->width > 0 && aa->height > 0)
+        skin_damage_add(vp, aa->x, aa->y, aa->width, aa->height);
+    else
+        skin_damage_viewport(vp);
+}
+#endif
+
+static inline unsigned long damage_bytes(struct screen *display,
+                                         int width, int height)
+{
+    return ((unsigned long)width * height * display->depth + 7) / 8;
+}
+
+/* push the collected damage to the LCD and account for the traffic */
+static void damage_flush(struct skin_damage *d)
+{
+    struct screen *display = d->display;
+    struct lcd_update_stats *stats = &lcd_update_stats[display->screen_type];
+    int screen_area = display->lcdwidth * display->lcdheight;
+    int area = 0;
+
+    for (int i = 0; i < d->count; i++)
+        area += damage_area(&d->rect[i]);
+
+    /* past this point the setup cost of several transfers outweighs the
+       pixels saved */
+    if (d->full || area >= screen_area / 4 * 3)
+    {
+        display->update();
+        stats->bytes += damage_bytes(display, display->lcdwidth,
+                                     display->lcdheight);
+    }
+    else
+    {
+        for (int i = 0; i < d->count; i++)
+        {
+            struct skin_damage_rect *r = &d->rect[i];
+            display->update_rect(r->x1, r->y1, r->x2 - r->x1, r->y2 - r->y1);
+            stats->bytes += damage_bytes(display, r->x2 - r->x1, r->y2 - r->y1);
+        }
+    }
+    stats->full_bytes += damage_bytes(display, display->lcdwidth,
+                                      display->lcdheight);
+
+    if (TIME_AFTER(current_tick, stats->window_start + HZ))
+    {
+        long elapsed = current_tick - stats->window_start;
+        stats->last.bytes_per_sec = stats->bytes / elapsed * HZ;
+        stats->last.full_bytes_per_sec = stats->full_bytes / elapsed * HZ;
+        stats->bytes = stats->full_bytes = 0;
+        stats->window_start = current_tick;
+    }
+}
+
+void skin_get_lcd_stats(int screen, struct skin_lcd_stats *stats)
+{
+    *stats = lcd_update_stats[screen].last;
+}
+
 static inline struct skin_element*
 get_child(OFFSETTYPE(struct skin_element**) children, int child)
 {
@@ -188,7 +359,11 @@ static bool do_non_text_tags(struct gui_wps *gwps, struct skin_draw_info *info,
         case SKIN_TOKEN_PEAKMETER:
             data->peak_meter_enabled = true;
             if (do_refresh)
+            {
+                int h = gwps->display->getcharheight();
                 draw_peakmeters(gwps, info->line_number, vp);
+                skin_damage_add(vp, 0, info->line_number * h, vp->width, h);
+            }
             break;
         case SKIN_TOKEN_DRAWRECTANGLE:
             if (do_refresh)
@@ -215,6 +390,7 @@ static bool do_non_text_tags(struct gui_wps *gwps, struct skin_draw_info *info,
                     vp->fg_pattern = backup;
 #endif
                 }
+                skin_damage_add(vp, rect->x, rect->y, rect->width, rect->height);
             }
             break;
         case SKIN_TOKEN_PEAKMETER_LEFTBAR:
@@ -272,6 +448,8 @@ static bool do_non_text_tags(struct gui_wps *gwps, struct skin_draw_info *info,
 
                     /* Clear the image, as in conditionals */
                     clear_image_pos(gwps, img);
+                    skin_damage_add(vp, img->x, img->y,
+                                    img->bm.width, img->subimage_height);
 
                     /* If the token returned a value which is higher than
                      * the amount of subimages, don't draw it. */
@@ -304,9 +482,12 @@ static bool do_non_text_tags(struct gui_wps *gwps, struct skin_draw_info *info,
         }
 #endif
         case SKIN_TOKEN_DRAW_INBUILTBAR:
+        {
+            struct viewport *bar_vp = SKINOFFSETTOPTR(skin_buffer, token->value.data);
             gui_statusbar_draw(&(statusbars.statusbars[gwps->display->screen_type]),
-                               info->refresh_type == SKIN_REFRESH_ALL,
-                               SKINOFFSETTOPTR(skin_buffer, token->value.data));
+                               info->refresh_type == SKIN_REFRESH_ALL, bar_vp);
+            skin_damage_viewport(bar_vp);
+        }
             break;
         case SKIN_TOKEN_VIEWPORT_CUSTOMLIST:
             if (do_refresh)
@@ -388,6 +569,9 @@ static void do_tags_in_hidden_conditional(struct skin_element* branch,
                 struct gui_img *img = skin_find_item(SKINOFFSETTOPTR(skin_buffer, id->label), 
                                                      SKIN_FIND_IMAGE, data);
                 clear_image_pos(gwps, img);
+                if (img)
+                    skin_damage_add(&info->skin_vp->vp, img->x, img->y,
+                                    img->bm.width, img->subimage_height);
             }
             else if (token->type == SKIN_TOKEN_PEAKMETER)
             {
@@ -428,6 +612,7 @@ static void do_tags_in_hidden_conditional(struct skin_element* branch,
                             gwps->display->set_viewport(&skin_viewport->vp);
                             gwps->display->clear_viewport();
                             gwps->display->set_viewport(&info->skin_vp->vp);
+                            skin_damage_viewport(&skin_viewport->vp);
                             skin_viewport->hidden_flags |= VP_DRAW_HIDDEN;
 
 #if (LCD_DEPTH > 1) || (defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1))
@@ -444,8 +629,11 @@ static void do_tags_in_hidden_conditional(struct skin_element* branch,
 #ifdef HAVE_ALBUMART
             else if (data->albumart && token->type == SKIN_TOKEN_ALBUMART_DISPLAY)
             {
+                struct skin_albumart *aa =
+                        SKINOFFSETTOPTR(skin_buffer, data->albumart);
                 draw_album_art(gwps,
                         playback_current_aa_hid(data->playback_aa_slot), true);
+                skin_damage_albumart(gwps, aa);
             }
 #endif
             child = SKINOFFSETTOPTR(skin_buffer, child->next);
@@ -782,6 +970,9 @@ void skin_render_viewport(struct skin_element* viewport, struct gui_wps *gwps,
                     skin_viewport->vp.width, display->getcharheight());
             write_line(display, align, info.line_number,
                     info.line_scrolls, &info.line_desc);
+            skin_damage_add(&skin_viewport->vp,
+                    0, info.line_number*display->getcharheight(),
+                    skin_viewport->vp.width, display->getcharheight());
         }
         if (!info.no_line_break)
             info.line_number++;
@@ -800,6 +991,14 @@ void skin_render(struct gui_wps *gwps, unsigned refresh_mode)
     char *label;
     
     int old_refresh_mode = refresh_mode;
+    /* a full refresh is usually preceded by a clear of the whole screen
+       so push everything, only incremental updates are worth tracking */
+    struct skin_damage frame_damage = {
+        .display = display,
+        .full = (refresh_mode&SKIN_REFRESH_ALL) == SKIN_REFRESH_ALL,
+    };
+    struct skin_damage *old_damage = damage;
+    damage = &frame_damage;
     skin_buffer = get_skin_buffer(gwps->data);
     
 
@@ -854,6 +1053,7 @@ void skin_render(struct gui_wps *gwps, unsigned refresh_mode)
         if ((vp_refresh_mode&SKIN_REFRESH_ALL) == SKIN_REFRESH_ALL)
         {
             display->clear_viewport();
+            skin_damage_viewport(&skin_viewport->vp);
         }
         /* render */
         if (viewport->children_count)
@@ -874,7 +1074,8 @@ void skin_render(struct gui_wps *gwps, unsigned refresh_mode)
     }
     /* Restore the default viewport */
     display->set_viewport(NULL);
-    display->update();
+    damage_flush(&frame_damage);
+    damage = old_damage;
 }
 
 static __attribute__((noinline))
@@ -956,6 +1157,8 @@ void skin_render_playlistviewer(struct playlistviewer* viewer,
                     vp->width, display->getcharheight());
             write_line(display, align, info.line_number,
                     info.line_scrolls, &info.line_desc);
+            skin_damage_add(vp, 0, info.line_number*display->getcharheight(),
+                            vp->width, display->getcharheight());
         }
         info.line_number++;
         info.offset++;
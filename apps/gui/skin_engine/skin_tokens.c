@@ -556,7 +556,7 @@ static struct mp3entry* get_mp3entry_from_offset(int offset, char **filename)
         *filename = (char*)fname;
         static struct mp3entry tempid3;
         if (
-#if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
+#ifdef HAVE_TC_RAMCACHE
             tagcache_fill_tags(&tempid3, fname) ||
 #endif
             audio_peek_track(&tempid3, offset)
@@ -40,6 +40,12 @@ struct skin_stats {
 int skin_get_num_skins(void);
 struct skin_stats *skin_get_stats(int number, int screen);
 #define skin_clear_stats(stats) memset(stats, 0, sizeof(struct skin_stats))
+/* LCD traffic generated by skin_render() over the last second */
+struct skin_lcd_stats {
+    unsigned long bytes_per_sec;
+    unsigned long full_bytes_per_sec; /* if every frame was a full update */
+};
+void skin_get_lcd_stats(int screen, struct skin_lcd_stats *stats);
 bool skin_backdrop_get_debug(int index, char **path, int *ref_count, size_t *size);
 
 /* Timeout unit expressed in HZ. In WPS, all timeouts are given in seconds
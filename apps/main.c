@@ -211,17 +211,19 @@ static int INIT_ATTR init_dircache(bool preinit)
 
     int result = -1;
 
-#ifdef HAVE_EEPROM_SETTINGS
-    if (firmware_settings.initialized &&
-        firmware_settings.disk_clean &&
-        preinit)
+#ifdef DIRCACHE_SNAPSHOT
+    if (preinit)
     {
+        /* start from the snapshot saved at the last shutdown, if any; it is
+           compared with the storage in the background */
         result = dircache_load();
+#ifdef HAVE_EEPROM_SETTINGS
         if (result < 0)
             firmware_settings.disk_clean = false;
+#endif
     }
     else
-#endif /* HAVE_EEPROM_SETTINGS */
+#endif /* DIRCACHE_SNAPSHOT */
     if (!preinit)
     {
         result = dircache_enable();
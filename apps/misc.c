@@ -362,6 +362,12 @@ static bool clean_shutdown(void (*callback)(void *), void *parameter)
 #endif
             scrobbler_shutdown(true);
 
+#if defined(HAVE_DIRCACHE) && defined(DIRCACHE_SNAPSHOT)
+            /* only a normal shutdown leaves a snapshot for the next boot;
+               it must be taken while the cache is still up */
+            if (global_settings.dircache && msg_id == -1)
+                dircache_save();
+#endif
             system_flush();
 #ifdef HAVE_EEPROM_SETTINGS
             if (firmware_settings.initialized)
@@ -585,6 +591,10 @@ long default_event_handler_ex(long event, void (*callback)(void *), void *parame
             if (callback != NULL)
                 callback(parameter);
             {
+#if defined(HAVE_DIRCACHE) && defined(DIRCACHE_SNAPSHOT)
+                /* the host may change anything */
+                dircache_drop_snapshot();
+#endif
                 system_flush();
 #ifdef BOOTFILE
 #if !defined(USB_NONE) && !defined(USB_HANDLED_BY_OF)
@@ -630,6 +640,9 @@ long default_event_handler_ex(long event, void (*callback)(void *), void *parame
                 if (storage_removable(i) && !storage_present(i))
                     return SYS_FS_CHANGED;
             }
+#if defined(HAVE_DIRCACHE) && defined(DIRCACHE_SNAPSHOT)
+            dircache_drop_snapshot();
+#endif
             system_flush();
             check_bootfile(true); /* state gotten in main.c:init() */
             system_restore();
@@ -110,9 +110,33 @@ static unsigned int pcmbuf_desc_count;
 static unsigned int position_key = 1;
 static unsigned int pcmbuf_sampr = 0;
 
+/* The chunks form a single-producer, single-consumer ring: the codec
+   thread publishes committed chunks by advancing chunk_widx and the PCM
+   callback frees played ones by advancing chunk_ridx. Each side only writes
+   its own index so no locking is needed, but on hosted targets the callback
+   may run concurrently on another core. Publishing an index must then make
+   the chunk data and descriptors written before it visible first, and
+   reading the other side's index must happen before using what it covers. */
 static size_t chunk_ridx;
 static size_t chunk_widx;
 
+#if (CONFIG_PLATFORM & PLATFORM_HOSTED)
+#define chunk_index_load(idx) \
+    __atomic_load_n(&(idx), __ATOMIC_ACQUIRE)
+#define chunk_index_store(idx, val) \
+    __atomic_store_n(&(idx), (val), __ATOMIC_RELEASE)
+#else
+/* The callback interrupts the producer on the same core; only the compiler
+   must not reorder around the index access */
+#define chunk_index_load(idx) \
+    ({ size_t __idx = *(volatile size_t *)&(idx); \
+       asm volatile ("" : : : "memory"); \
+       __idx; })
+#define chunk_index_store(idx, val) \
+    ({ asm volatile ("" : : : "memory"); \
+       *(volatile size_t *)&(idx) = (val); })
+#endif /* CONFIG_PLATFORM */
+
 static size_t pcmbuf_bytes_waiting;
 static struct chunkdesc *current_desc;
 static size_t chunk_transidx;
@@ -215,8 +239,8 @@ static void start_audio_playback(void)
    a full chunk even if only partially filled) */
 static size_t pcmbuf_unplayed_bytes(void)
 {
-    size_t ridx = chunk_ridx;
-    size_t widx = chunk_widx;
+    size_t ridx = chunk_index_load(chunk_ridx);
+    size_t widx = chunk_index_load(chunk_widx);
 
     if (ridx > widx)
         widx += pcmbuf_size;
@@ -283,8 +307,8 @@ static bool index_committed(size_t index)
     if (index == INVALID_BUF_INDEX)
         return false;
 
-    size_t ridx = chunk_ridx;
-    size_t widx = chunk_widx;
+    size_t ridx = chunk_index_load(chunk_ridx);
+    size_t widx = chunk_index_load(chunk_widx);
 
     if (widx < ridx)
     {
@@ -309,7 +333,7 @@ void snip_buffer_tail(size_t index, int offset)
     if (!index_committed(index) && index != chunk_widx)
         return;
 
-    chunk_widx = index;
+    chunk_index_store(chunk_widx, index);
     pcmbuf_bytes_waiting = 0;
     index_chunkdesc(index)->pos_key = 0;
 
@@ -349,7 +373,8 @@ static void commit_chunks(size_t threshold)
 
         /* Advance the current write chunk and make it available to the
            PCM callback */
-        chunk_widx = index = index_next(index);
+        index = index_next(index);
+        chunk_index_store(chunk_widx, index);
         desc = index_chunkdesc(index);
 
         /* Reset it before using it */
@@ -508,7 +533,7 @@ void * pcmbuf_request_buffer(int *count)
 #ifdef HAVE_CROSSFADE
     if (crossfade_status != CROSSFADE_INACTIVE)
     {
-        crossfade_bufidx = index_chunk_offs(chunk_ridx, -1);
+        crossfade_bufidx = index_chunk_offs(chunk_index_load(chunk_ridx), -1);
         buf = index_buffer(crossfade_bufidx); /* always CROSSFADE_BUFSIZE */
     }
     else
@@ -801,11 +826,12 @@ static void pcmbuf_pcm_callback(const void **start, size_t *size)
         }
 
         /* Free it for reuse */
-        chunk_ridx = index = index_next(index);
+        index = index_next(index);
+        chunk_index_store(chunk_ridx, index);
     }
 
     /*- Process the new one -*/
-    if (index != chunk_widx && !fade_out_complete)
+    if (index != chunk_index_load(chunk_widx) && !fade_out_complete)
     {
         current_desc = desc = index_chunkdesc(index);
 
@@ -31,6 +31,7 @@
 #include "voice_thread.h"
 #include "metadata.h"
 #include "cuesheet.h"
+#include "seekidx.h"
 #include "buffering.h"
 #include "talk.h"
 #include "playlist.h"
@@ -52,6 +53,7 @@
 
 #ifdef HAVE_ALBUMART
 #include "albumart.h"
+#include "albumart_cache.h"
 #endif
 
 #ifdef HAVE_PLAY_FREQ
@@ -74,6 +76,9 @@
  * for their correct seek target, 32k seems a good size */
 #define AUDIO_REBUFFER_GUESS_SIZE    (1024*32)
 
+/* Maximum number of upcoming tracks predicted to be buffered in one go */
+#define PLAYBACK_READAHEAD_TRACKS    4
+
 /* Define LOGF_ENABLE to enable logf output in this file */
 #if 0
 #define LOGF_ENABLE
@@ -136,6 +141,9 @@ static struct audio_scratch_memory
     struct mp3entry codec_id3; /* (A,C) */
     struct mp3entry unbuffered_id3;
     struct cuesheet *curr_cue; /* Will follow this structure */
+#ifdef AUDIO_MP3_SEEKIDX
+    struct mp3_seekidx *curr_seekidx; /* (C) Follows the cuesheet if any */
+#endif
 } * audio_scratch_memory = NULL;
 
 /* These are used to store the current, next and optionally the peek-ahead
@@ -209,7 +217,14 @@ static enum filling_state
 #define TRACK_INFO_CODEC    0
 #endif
 
-#define TRACK_INFO_HANDLES  (3 + TRACK_INFO_AA + TRACK_INFO_CODEC)
+#ifdef AUDIO_MP3_SEEKIDX
+#define TRACK_INFO_SEEKIDX  1
+#else
+#define TRACK_INFO_SEEKIDX  0
+#endif
+
+#define TRACK_INFO_HANDLES  (3 + TRACK_INFO_AA + TRACK_INFO_CODEC + \
+                             TRACK_INFO_SEEKIDX)
 
 struct track_info
 {
@@ -221,6 +236,9 @@ struct track_info
     struct {
     int id3_hid;                    /* Metadata handle ID */
     int cuesheet_hid;               /* Parsed cuesheet handle ID */
+#ifdef AUDIO_MP3_SEEKIDX
+    int seekidx_hid;                /* MP3 seek index handle ID */
+#endif
 #ifdef HAVE_ALBUMART
     int aa_hid[MAX_MULTIPLE_AA];    /* Album art handle IDs */
 #endif
@@ -774,6 +792,10 @@ static size_t scratch_mem_size(void)
     if (global_settings.cuesheet)
         size += sizeof (struct cuesheet);
 
+#ifdef AUDIO_MP3_SEEKIDX
+    size += sizeof (struct mp3_seekidx);
+#endif
+
     return size;
 }
 
@@ -793,6 +815,13 @@ static void scratch_mem_init(void *mem)
             SKIPBYTES((struct cuesheet *)audio_scratch_memory,
                       sizeof (struct audio_scratch_memory));
     }
+
+#ifdef AUDIO_MP3_SEEKIDX
+    audio_scratch_memory->curr_seekidx =
+        SKIPBYTES((struct mp3_seekidx *)audio_scratch_memory,
+                  sizeof (struct audio_scratch_memory) +
+                  (global_settings.cuesheet ? sizeof (struct cuesheet) : 0));
+#endif
 }
 
 static int audiobuf_handle;
@@ -823,7 +852,7 @@ static void audio_reset_buffer_noalloc(
 {
     /*
      * Layout audio buffer as follows:
-     * [|SCRATCH|BUFFERING|PCM]
+     * [|SCRATCH|AA WORK|BUFFERING|PCM]
      */
     logf("%s()", __func__);
 
@@ -852,6 +881,17 @@ static void audio_reset_buffer_noalloc(
     filebuf += allocsize;
     filebuflen -= allocsize;
 
+#ifdef HAVE_ALBUMART
+    /* Album art cache work memory, only if buffering can spare it */
+    allocsize = ALIGN_UP(albumart_cache_buffer_size(), sizeof (intptr_t));
+    if (allocsize + AUDIO_BUFFER_RESERVE > filebuflen)
+        allocsize = 0;
+
+    albumart_cache_set_buffer(allocsize ? filebuf : NULL, allocsize);
+    filebuf += allocsize;
+    filebuflen -= allocsize;
+#endif
+
     buffering_reset(filebuf, filebuflen);
 
     buffer_state = AUDIOBUF_STATE_INITIALIZED;
@@ -950,6 +990,9 @@ static int shrink_callback(int handle, unsigned hints, void* start, size_t old_s
 #ifdef PLAYBACK_VOICE
     voice_stop();
 #endif
+#ifdef HAVE_ALBUMART
+    albumart_cache_set_buffer(NULL, 0);
+#endif
 
     /* we should be free to change the buffer now */
     if (give_up)
@@ -990,6 +1033,9 @@ static void audio_reset_buffer(void)
 {
     if (audiobuf_handle > 0)
     {
+#ifdef HAVE_ALBUMART
+        albumart_cache_set_buffer(NULL, 0);
+#endif
         core_free(audiobuf_handle);
         audiobuf_handle = 0;
     }
@@ -1359,6 +1405,22 @@ static void buf_read_cuesheet(int handle_id)
     bufread(handle_id, sizeof (struct cuesheet), cue);
 }
 
+#ifdef AUDIO_MP3_SEEKIDX
+/* Read the seek index of the codec's track from the buffer - returns NULL
+   if the track has none */
+static struct mp3_seekidx * buf_read_seekidx(int handle_id)
+{
+    struct mp3_seekidx *idx = audio_scratch_memory->curr_seekidx;
+
+    if (handle_id < 0 ||
+        bufread(handle_id, sizeof (struct mp3_seekidx), idx) !=
+            (ssize_t)sizeof (struct mp3_seekidx))
+        return NULL;
+
+    return idx;
+}
+#endif /* AUDIO_MP3_SEEKIDX */
+
 /* Backend to peek/current/next track metadata interface functions -
    fill in the mp3entry with as much information as we may obtain about
    the track at the specified offset from the user current track -
@@ -1399,7 +1461,7 @@ static bool audio_get_track_metadata(int offset, struct mp3entry *id3)
     char path[MAX_PATH+1];
     if (playlist_peek(offset, path, sizeof (path)))
     {
-#if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
+#ifdef HAVE_TC_RAMCACHE
         /* Try to get it from the database */
         if (!tagcache_fill_tags(id3, path))
 #endif
@@ -1608,6 +1670,14 @@ static bool audio_start_codec(bool auto_skip)
     /* Update the codec API with the metadata and track info */
     id3_write(CODEC_ID3, cur_id3);
 
+#ifdef AUDIO_MP3_SEEKIDX
+    ci.id3->seekidx = buf_read_seekidx(info.seekidx_hid);
+
+    /* First play of a file without one: have it made for next time */
+    if (info.seekidx_hid == ERR_FILE_ERROR)
+        seekidx_request(cur_id3);
+#endif
+
     ci.audio_hid = info.audio_hid;
     ci.filesize = buf_filesize(info.audio_hid);
     buf_set_base_handle(info.audio_hid);
@@ -1687,6 +1757,52 @@ static bool audio_load_cuesheet(struct track_info *infop,
     return true;
 }
 
+#ifdef AUDIO_MP3_SEEKIDX
+/* Load the seek index for the file if it needs and has one - returns false
+   if the buffer is full */
+static bool audio_load_seekidx(struct track_info *infop,
+                               struct mp3entry *track_id3)
+{
+    if (infop->seekidx_hid != ERR_HANDLE_NOT_FOUND)
+        return true;
+
+    /* "Unsupported" if the file doesn't need one, a file error if it has
+       none yet so that one is built when it plays */
+    int hid = ERR_UNSUPPORTED_TYPE;
+
+    if (seekidx_wanted(track_id3))
+    {
+        hid = bufalloc(NULL, sizeof (struct mp3_seekidx), TYPE_RAW_ATOMIC);
+
+        if (hid >= 0)
+        {
+            void *idx = NULL;
+            bufgetdata(hid, sizeof (struct mp3_seekidx), &idx);
+
+            if (seekidx_load(track_id3, idx))
+            {
+                /* The index knows the exact length */
+                seekidx_apply(idx, track_id3);
+            }
+            else
+            {
+                bufclose(hid);
+                hid = ERR_FILE_ERROR;
+            }
+        }
+    }
+
+    if (hid == ERR_BUFFER_FULL)
+    {
+        logf("buffer is full for now (%s)", __func__);
+        return false;
+    }
+
+    infop->seekidx_hid = hid;
+    return true;
+}
+#endif /* AUDIO_MP3_SEEKIDX */
+
 #ifdef HAVE_ALBUMART
 /* Load any album art for the file - returns false if the buffer is full */
 static bool audio_load_albumart(struct track_info *infop,
@@ -1805,6 +1921,36 @@ static bool audio_buffer_codec(struct track_info *track_infop,
 }
 #endif /* HAVE_CODEC_BUFFERING */
 
+/* Predict how many of the next tracks will be added to the buffer in this
+   fill, sizing them like the track just loaded, and let buffering keep the
+   disk spinning for them */
+static void audio_update_readahead(const struct mp3entry *id3)
+{
+    size_t free = buf_length() - buf_used();
+    size_t size = 0;
+    int tracks = 0;
+
+    if (id3)
+    {
+        size = id3->filesize;
+
+        if (id3->bitrate && id3->length)
+            size = (uint64_t)id3->bitrate * id3->length / 8;
+    }
+
+    while (tracks < PLAYBACK_READAHEAD_TRACKS &&
+           playlist_peek(playlist_peek_offset + tracks + 1, NULL, 0))
+    {
+        if (size > free)
+            break;
+
+        free -= size;
+        tracks++;
+    }
+
+    buf_set_readahead(tracks);
+}
+
 /* Load metadata for the next track (with bufopen). The rest of the track
    loading will be handled by audio_finish_load_track once the metadata has
    been actually loaded by the buffering thread.
@@ -1876,6 +2022,7 @@ static int audio_load_track(void)
         /* No track - exhausted the playlist entries */
         logf("End-of-playlist");
         id3_write_locked(UNBUFFERED_ID3, NULL);
+        buf_set_readahead(0);
 
         if (filling != STATE_FULL)
             track_list_free_info(&info); /* Free this entry */
@@ -1920,6 +2067,8 @@ static int audio_load_track(void)
             filling = STATE_FULL;
         }
 
+        buf_set_readahead(0);
+
         logf("%s: buffer is full for now (%u tracks)", __func__,
              track_list_count());
     }
@@ -1979,6 +2128,16 @@ static int audio_finish_load_track(struct track_info *infop)
         goto audio_finish_load_track_exit;
     }
 
+#ifdef AUDIO_MP3_SEEKIDX
+    /* Try to load a seek index for the track */
+    if (!audio_load_seekidx(infop, track_id3))
+    {
+        /* No space for the index on buffer, not an error */
+        filling = STATE_FULL;
+        goto audio_finish_load_track_exit;
+    }
+#endif
+
 #ifdef HAVE_ALBUMART
     /* Try to load album art for the track */
     if (!audio_load_albumart(infop, track_id3))
@@ -2121,6 +2280,8 @@ audio_finish_load_track_exit:
 
     if (filling != STATE_FULL)
     {
+        audio_update_readahead(track_id3);
+
         /* Load next track - error or not */
         track_list.in_progress_hid = 0;
         LOGFQUEUE("audio > audio Q_AUDIO_FILL_BUFFER");
@@ -2129,6 +2290,7 @@ audio_finish_load_track_exit:
     else
     {
         /* Full */
+        buf_set_readahead(0);
         trackstat = LOAD_TRACK_ERR_FINISH_FULL;
     }
 
@@ -2772,6 +2934,7 @@ static void audio_stop_playback(void)
 
     /* Go idle */
     filling = STATE_IDLE;
+    buf_set_readahead(0);
     cancel_cpu_boost();
 }
 
@@ -3575,7 +3738,12 @@ void audio_hard_stop(void)
     voice_stop();
 #endif
     if (audiobuf_handle > 0)
+    {
+#ifdef HAVE_ALBUMART
+        albumart_cache_set_buffer(NULL, 0);
+#endif
         audiobuf_handle = core_free(audiobuf_handle);
+    }
 }
 
 /* Resume playback if paused */
@@ -3735,6 +3903,20 @@ int playback_claim_aa_slot(struct dim *dim)
     return -1;
 }
 
+/* Copy the dimensions of the claimed album art slots - returns how many */
+int playback_get_aa_dims(struct dim *dims, int max)
+{
+    int count = 0;
+
+    FOREACH_ALBUMART(i)
+    {
+        if (count < max && albumart_slots[i].used)
+            dims[count++] = albumart_slots[i].dim;
+    }
+
+    return count;
+}
+
 /* Invalidate the albumart_slot - decrement the use count if > 0 */
 void playback_release_aa_slot(int slot)
 {
@@ -3924,6 +4106,12 @@ void INIT_ATTR playback_init(void)
     mutex_init(&id3_mutex);
     track_list_init();
     buffering_init();
+#ifdef AUDIO_MP3_SEEKIDX
+    seekidx_init();
+#endif
+#ifdef HAVE_ALBUMART
+    albumart_cache_init();
+#endif
     pcmbuf_update_frequency();
 #ifdef HAVE_PLAY_FREQ
     add_event(PLAYBACK_EVENT_TRACK_CHANGE, audio_change_frequency_callback);
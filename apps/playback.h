@@ -33,6 +33,12 @@
 #define AUDIO_FAST_SKIP_PREVIEW
 #endif
 
+/* Seek indices for MP3s without a VBR header cost a thread, a bit of
+   buffer per track and one extra read of each file */
+#if MEMORYSIZE > 2
+#define AUDIO_MP3_SEEKIDX
+#endif
+
 #ifdef HAVE_ALBUMART
 
 #include "bmp.h"
@@ -65,6 +71,13 @@ void playback_release_aa_slot(int slot);
  * Save to call from other threads */
 void playback_update_aa_dims(void);
 
+/*
+ * Copies the dimensions of the album art slots in use to dims, at most max
+ * of them - returns how many were copied
+ *
+ * Save to call from other threads */
+int playback_get_aa_dims(struct dim *dims, int max);
+
 struct bufopen_bitmap_data {
     struct dim *dim;
     struct mp3_albumart *embedded_albumart;
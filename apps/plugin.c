@@ -665,7 +665,7 @@ static const struct plugin_api rockbox_api = {
     tagcache_retrieve,
     tagcache_search_finish,
     tagcache_get_numeric,
-#if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
+#ifdef HAVE_TC_RAMCACHE
     tagcache_fill_tags,
 #endif
     tagcache_get_stat,
@@ -803,6 +803,10 @@ static const struct plugin_api rockbox_api = {
 
     /* new stuff at the end, sort into place next time
        the API gets incompatible */
+#ifdef HAVE_ALBUMART
+    albumart_cache_read,
+    albumart_cache_write,
+#endif
 
 };
 
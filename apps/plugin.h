@@ -114,6 +114,7 @@ int plugin_open(char *plugin, char *parameter);
 
 #ifdef HAVE_ALBUMART
 #include "albumart.h"
+#include "albumart_cache.h"
 #endif
 
 #ifdef HAVE_REMOTE_LCD
@@ -155,12 +156,12 @@ int plugin_open(char *plugin, char *parameter);
 #define PLUGIN_MAGIC 0x526F634B /* RocK */
 
 /* increase this every time the api struct changes */
-#define PLUGIN_API_VERSION 241
+#define PLUGIN_API_VERSION 244
 
 /* update this to latest version if a change to the api struct breaks
    backwards compatibility (and please take the opportunity to sort in any
    new function which are "waiting" at the end of the function table) */
-#define PLUGIN_MIN_API_VERSION 241
+#define PLUGIN_MIN_API_VERSION 243
 
 /* 239 Marks the removal of ARCHOS HWCODEC and CHARCELL */
 
@@ -759,7 +760,7 @@ struct plugin_api {
                            int tag, char *buf, long size);
     void (*tagcache_search_finish)(struct tagcache_search *tcs);
     long (*tagcache_get_numeric)(const struct tagcache_search *tcs, int tag);
-#if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
+#ifdef HAVE_TC_RAMCACHE
     bool (*tagcache_fill_tags)(struct mp3entry *id3, const char *filename);
 #endif
     struct tagcache_stat* (*tagcache_get_stat)(void);
@@ -930,6 +931,13 @@ struct plugin_api {
 
     /* new stuff at the end, sort into place next time
        the API gets incompatible */
+#ifdef HAVE_ALBUMART
+    int (*albumart_cache_read)(const char *src, off_t offset, off_t length,
+                               struct bitmap *bm, int maxsize);
+    bool (*albumart_cache_write)(const char *src, off_t offset, off_t length,
+                                 const struct dim *dim,
+                                 const struct bitmap *bm);
+#endif
 
 };
 
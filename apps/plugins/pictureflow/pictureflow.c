@@ -1759,7 +1759,7 @@ static bool get_albumart_for_index_from_db(const int slide_index, char *buf,
         struct mp3entry id3;
         int fd;
 
-#if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
+#ifdef HAVE_TC_RAMCACHE
         if (rb->tagcache_fill_tags(&id3, tcs.result))
         {
             rb->strlcpy(id3.path, tcs.result, sizeof(id3.path));
@@ -1913,6 +1913,58 @@ static bool save_pfraw(char* filename, struct bitmap *bm)
     return true;
 }
 
+#if defined(HAVE_ALBUMART) && !defined(USEGSLIB)
+/**
+ Get the slide in native format from the album art cache shared with the
+ WPS and transpose it into bm. The native image goes after the room for the
+ transposed one in aa_cache.buf. Returns <= 0 if it isn't there or doesn't
+ fit, the slide is then decoded the usual way.
+ */
+static int read_shared_albumart(const char *file, struct bitmap *bm)
+{
+    const size_t slide_sz = DISPLAY_WIDTH * DISPLAY_HEIGHT * sizeof(pix_t);
+    struct bitmap native;
+    int ret;
+
+    if (aa_cache.buf_sz < 2 * slide_sz)
+        return -1;
+
+    int fd = rb->open(file, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    off_t length = rb->filesize(fd);
+    rb->close(fd);
+
+    rb->memset(&native, 0, sizeof(native));
+    native.width = DISPLAY_WIDTH;
+    native.height = DISPLAY_HEIGHT;
+    native.data = (unsigned char *)aa_cache.buf + slide_sz;
+
+    /* Only read: the cache holds dithered images, the slides aren't */
+    ret = rb->albumart_cache_read(file, -1, length, &native,
+                                  aa_cache.buf_sz - slide_sz);
+    if (ret <= 0)
+        return ret;
+
+    const pix_t *src = (const pix_t *)native.data;
+    pix_t *dest = (pix_t *)aa_cache.buf;
+    int w = native.width, h = native.height;
+#if defined(LCD_STRIDEFORMAT) && LCD_STRIDEFORMAT == VERTICAL_STRIDE
+    /* native bitmaps are stored column by column already */
+    rb->memcpy(dest, src, w * h * sizeof(pix_t));
+#else
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            dest[x * h + y] = *src++;
+#endif
+
+    bm->width = w;
+    bm->height = h;
+    bm->data = aa_cache.buf;
+    return w * h * sizeof(pix_t);
+}
+#endif
+
 static bool incremental_albumart_cache(bool verbose)
 {
     if (!aa_cache.buf)
@@ -1958,8 +2010,14 @@ static bool incremental_albumart_cache(bool verbose)
     aa_cache.input_bmp.width = DISPLAY_WIDTH;
     aa_cache.input_bmp.height = DISPLAY_HEIGHT;
 
-    ret = read_image_file(aa_cache.file, &aa_cache.input_bmp,
-                          aa_cache.buf_sz, format, &format_transposed);
+    ret = -1;
+#if defined(HAVE_ALBUMART) && !defined(USEGSLIB)
+    if (pf_cfg.resize)
+        ret = read_shared_albumart(aa_cache.file, &aa_cache.input_bmp);
+#endif
+    if (ret <= 0)
+        ret = read_image_file(aa_cache.file, &aa_cache.input_bmp,
+                              aa_cache.buf_sz, format, &format_transposed);
     if (ret <= 0) {
         if (verbose) {
             rb->splashf(HZ, "Album art is bad: %s", get_album_name(idx));
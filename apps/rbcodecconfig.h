@@ -73,6 +73,16 @@ static inline void dsp_process_end(struct dsp_loop_context *ctx)
 #define DSP_PROCESS_END() \
     dsp_process_end(&__ctx)
 
+/* Timer for DSP stage profiling (debug menu). Where there is no
+ * microsecond timer, the tick still gives usable averages over time. */
+#ifdef USEC_TIMER
+#define DSP_PROFILE_TIMER()     ((unsigned long)USEC_TIMER)
+#define DSP_PROFILE_TIMER_HZ    1000000
+#else
+#define DSP_PROFILE_TIMER()     ((unsigned long)current_tick)
+#define DSP_PROFILE_TIMER_HZ    HZ
+#endif
+
 #endif
 
 #define DSP_OUT_MIN_HZ      PLAY_SAMPR_HW_MIN
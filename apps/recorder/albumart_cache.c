@@ -0,0 +1,452 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/*
+ * Album art scaled to the sizes the skins (and pictureflow) show it at, in
+ * the native format of the display, kept in ALBUMART_CACHE_DIR. Buffering
+ * then only has to read the image instead of decoding a JPEG on every track
+ * change. A background thread makes the images of the upcoming playlist
+ * entries after each track change, in memory playback sets aside for it,
+ * next time the disk is spinning anyway.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "string-extra.h"
+#include "config.h"
+#include "system.h"
+#include "kernel.h"
+#include "thread.h"
+#include "file.h"
+#include "dir.h"
+#include "storage.h"
+#include "usb.h"
+#include "crc32.h"
+#include "logf.h"
+#include "appevents.h"
+#include "metadata.h"
+#include "playlist.h"
+#include "playback.h"
+#include "albumart.h"
+#include "albumart_cache.h"
+#include "bmp.h"
+#ifdef HAVE_JPEG
+#include "jpeg_load.h"
+#endif
+
+#ifdef HAVE_ALBUMART
+
+#define AACACHE_MAGIC   (0x41410000 | LCD_DEPTH) /* "AA" */
+/* Decoder state and rows besides the image, see clip_jpeg_fd() */
+#define AACACHE_SCRATCH (48*1024)
+
+struct aacache_key
+{
+    uint32_t path_crc;
+    int32_t  offset;        /* of embedded art, -1 for image files */
+    uint32_t length;
+    uint16_t width;         /* size the image was scaled to fit */
+    uint16_t height;
+};
+
+struct aacache_header
+{
+    uint32_t magic;
+    struct aacache_key key;
+    uint16_t width;         /* actual size of the image */
+    uint16_t height;
+    uint32_t size;          /* bytes of bitmap data following */
+};
+
+enum
+{
+    Q_AACACHE_LOOKAHEAD = 1,
+};
+
+static struct event_queue aacache_queue SHAREDBSS_ATTR;
+/* Decodes like the buffering thread and looks up the metadata on top */
+static long aacache_stack[(DEFAULT_STACK_SIZE + 0x2800)/sizeof(long)];
+static const char aacache_thread_name[] = "albumart cache";
+static unsigned int aacache_thread_id = 0;
+static volatile bool lookahead_pending = false;
+
+/* Work memory inside the audio buffer; the mutex is held while using it */
+static struct mutex work_mutex SHAREDBSS_ATTR;
+static void *work_buf = NULL;
+static size_t work_size = 0;
+
+int albumart_decode_fd(int fd, const char *path, off_t offset, off_t length,
+                       struct bitmap *bm, int maxsize)
+{
+    const int format = FORMAT_NATIVE|FORMAT_DITHER|
+                       FORMAT_RESIZE|FORMAT_KEEP_ASPECT;
+
+#if (LCD_DEPTH > 1) || defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1)
+    bm->maskdata = NULL;
+#endif
+
+#ifdef HAVE_JPEG
+    if (offset >= 0) {
+        lseek(fd, offset, SEEK_SET);
+        return clip_jpeg_fd(fd, length, bm, maxsize, format, NULL);
+    }
+    else if (strcmp(path + strlen(path) - 4, ".bmp"))
+        return read_jpeg_fd(fd, bm, maxsize, format, NULL);
+    else
+#endif
+        return read_bmp_fd(fd, bm, maxsize, format, NULL);
+
+    (void)path;
+    (void)offset;
+    (void)length;
+}
+
+static void make_key(const char *src, off_t offset, off_t length,
+                     const struct dim *dim, struct aacache_key *key)
+{
+    memset(key, 0, sizeof (*key));
+    key->path_crc = crc_32(src, strlen(src), 0xffffffff);
+    key->offset = offset;
+    key->length = length;
+    key->width = dim->width;
+    key->height = dim->height;
+}
+
+static void get_entry_path(const struct aacache_key *key,
+                           char *buf, size_t bufsize)
+{
+    uint32_t slot = crc_32(key, sizeof (*key), 0xffffffff);
+    snprintf(buf, bufsize, ALBUMART_CACHE_DIR "/%03lx.art",
+             (unsigned long)(slot % ALBUMART_CACHE_SLOTS));
+}
+
+/* Open the image for key, positioned at the bitmap data */
+static int open_entry(const struct aacache_key *key,
+                      struct aacache_header *hdr)
+{
+    char path[MAX_PATH];
+    get_entry_path(key, path, sizeof (path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (read(fd, hdr, sizeof (*hdr)) == (ssize_t)sizeof (*hdr)
+        && hdr->magic == AACACHE_MAGIC
+        && !memcmp(&hdr->key, key, sizeof (*key))
+        && hdr->width > 0 && hdr->height > 0
+        && hdr->size == (uint32_t)BM_SIZE(hdr->width, hdr->height,
+                                          FORMAT_NATIVE, false))
+        return fd;
+
+    close(fd);
+    return -1;
+}
+
+/* Create (or take over) the slot file for key */
+static int create_entry(const struct aacache_key *key,
+                        char *path, size_t pathsize)
+{
+    mkdir(ALBUMART_CACHE_DIR);
+    get_entry_path(key, path, pathsize);
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+}
+
+static bool write_entry(int fd, const struct aacache_key *key,
+                        const struct bitmap *bm)
+{
+    struct aacache_header hdr;
+
+    hdr.magic = AACACHE_MAGIC;
+    hdr.key = *key;
+    hdr.width = bm->width;
+    hdr.height = bm->height;
+    hdr.size = BM_SIZE(bm->width, bm->height, FORMAT_NATIVE, false);
+
+    return write(fd, &hdr, sizeof (hdr)) == (ssize_t)sizeof (hdr) &&
+           write(fd, bm->data, hdr.size) == (ssize_t)hdr.size;
+}
+
+int albumart_cache_read(const char *src, off_t offset, off_t length,
+                        struct bitmap *bm, int maxsize)
+{
+    struct dim dim = { .width = bm->width, .height = bm->height };
+    struct aacache_key key;
+    struct aacache_header hdr;
+
+    make_key(src, offset, length, &dim, &key);
+
+    int fd = open_entry(&key, &hdr);
+    if (fd < 0)
+        return -1;
+
+    int rc = -1;
+    if ((int)hdr.size <= maxsize &&
+        read(fd, bm->data, hdr.size) == (ssize_t)hdr.size)
+    {
+        bm->width = hdr.width;
+        bm->height = hdr.height;
+#if (LCD_DEPTH > 1) || defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1)
+        bm->format = FORMAT_NATIVE;
+        bm->maskdata = NULL;
+#endif
+#ifdef HAVE_LCD_COLOR
+        bm->alpha_offset = 0;
+#endif
+        rc = hdr.size;
+    }
+
+    close(fd);
+    return rc;
+}
+
+bool albumart_cache_write(const char *src, off_t offset, off_t length,
+                          const struct dim *dim, const struct bitmap *bm)
+{
+    char path[MAX_PATH];
+    struct aacache_key key;
+
+    make_key(src, offset, length, dim, &key);
+
+    int fd = create_entry(&key, path, sizeof (path));
+    if (fd < 0)
+        return false;
+
+    bool ok = write_entry(fd, &key, bm);
+    close(fd);
+
+    if (!ok)
+        remove(path);
+
+    return ok;
+}
+
+size_t albumart_cache_buffer_size(void)
+{
+    struct dim dims[SKINNABLE_SCREENS_COUNT];
+    int count = playback_get_aa_dims(dims, ARRAYLEN(dims));
+    size_t size = 0;
+
+    /* Nothing decodes in the background without the thread */
+    if (!aacache_thread_id)
+        return 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t bm_size = BM_SCALED_SIZE(dims[i].width, dims[i].height,
+                                        FORMAT_NATIVE, false);
+        size = MAX(size, bm_size);
+    }
+
+    if (size == 0)
+        return 0;
+
+    return sizeof (struct bitmap) + size + AACACHE_SCRATCH;
+}
+
+void albumart_cache_set_buffer(void *buf, size_t size)
+{
+    mutex_lock(&work_mutex);
+    work_buf = buf;
+    work_size = buf ? size : 0;
+    mutex_unlock(&work_mutex);
+}
+
+/* Make the image of the track's album art for one size, if needed */
+static void make_image(const struct mp3entry *id3, const struct dim *dim)
+{
+    static char artpath[MAX_PATH];
+    char path[MAX_PATH];
+    const char *src = id3->path;
+    off_t offset = -1, length = 0;
+
+    /* Same order as playback looks for it */
+    if (id3->has_embedded_albumart && id3->albumart.type == AA_TYPE_JPG)
+    {
+        offset = id3->albumart.pos;
+        length = id3->albumart.size;
+    }
+    else if (find_albumart(id3, artpath, sizeof (artpath), dim))
+        src = artpath;
+    else
+        return;
+
+    int fd = open(src, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    if (offset < 0)
+        length = filesize(fd);
+
+    struct aacache_key key;
+    struct aacache_header hdr;
+    make_key(src, offset, length, dim, &key);
+
+    int cfd = open_entry(&key, &hdr);
+    if (cfd >= 0)
+    {
+        /* made before */
+        close(cfd);
+        close(fd);
+        return;
+    }
+
+    /* Create the file before taking the work memory; playback may need to
+       wait for it */
+    cfd = create_entry(&key, path, sizeof (path));
+    if (cfd >= 0)
+    {
+        bool ok = false;
+
+        mutex_lock(&work_mutex);
+
+        if (work_size > sizeof (struct bitmap))
+        {
+            struct bitmap *bm = work_buf;
+            bm->width = dim->width;
+            bm->height = dim->height;
+            bm->data = (unsigned char *)(bm + 1);
+
+            int rc = albumart_decode_fd(fd, src, offset, length, bm,
+                                        work_size - sizeof (*bm));
+            if (rc > 0)
+                ok = write_entry(cfd, &key, bm);
+        }
+
+        mutex_unlock(&work_mutex);
+
+        close(cfd);
+        if (!ok)
+            remove(path);
+
+        logf("aacache: %s %dx%d %s", src, dim->width, dim->height,
+             ok ? "made" : "failed");
+    }
+
+    close(fd);
+}
+
+static void lookahead(void)
+{
+    static struct mp3entry id3;
+    static char trackbuf[MAX_PATH];
+    struct dim dims[SKINNABLE_SCREENS_COUNT];
+
+    int count = playback_get_aa_dims(dims, ARRAYLEN(dims));
+    if (count == 0)
+        return;
+
+    /* The current track too, for the next time it's played */
+    for (int step = 0; step <= ALBUMART_CACHE_LOOKAHEAD; step++)
+    {
+        /* Give way to a newer request or USB */
+        if (!queue_empty(&aacache_queue))
+            break;
+
+        const char *trackname = playlist_peek(step, trackbuf,
+                                              sizeof (trackbuf));
+        if (!trackname)
+            break;
+
+        int fd = open(trackname, O_RDONLY);
+        if (fd < 0)
+            continue;
+
+        bool ok = get_metadata(&id3, fd, trackname);
+        close(fd);
+
+        if (!ok)
+            continue;
+
+        for (int i = 0; i < count; i++)
+            make_image(&id3, &dims[i]);
+    }
+}
+
+static void track_change_callback(unsigned short id, void *param)
+{
+    (void)id;
+    (void)param;
+
+    if (lookahead_pending)
+        return;
+
+    lookahead_pending = true;
+    queue_post(&aacache_queue, Q_AACACHE_LOOKAHEAD, 0);
+}
+
+static void albumart_cache_thread(void)
+{
+    struct queue_event ev;
+
+    while (1)
+    {
+        /* Wait for the disk to spin up while a lookahead is pending */
+        if (lookahead_pending)
+            queue_wait_w_tmo(&aacache_queue, &ev, HZ);
+        else
+            queue_wait(&aacache_queue, &ev);
+
+        switch (ev.id)
+        {
+            case Q_AACACHE_LOOKAHEAD:
+            case SYS_TIMEOUT:
+                if (!lookahead_pending)
+                    break;
+#ifdef HAVE_DISK_STORAGE
+                if (!storage_disk_is_active())
+                    break;
+#endif
+                /* a track change from now on asks again */
+                lookahead_pending = false;
+                lookahead();
+                break;
+
+            case SYS_USB_CONNECTED:
+                lookahead_pending = false;
+                usb_acknowledge(SYS_USB_CONNECTED_ACK);
+                usb_wait_for_disconnect(&aacache_queue);
+                break;
+        }
+    }
+}
+
+void INIT_ATTR albumart_cache_init(void)
+{
+    mutex_init(&work_mutex);
+    queue_init(&aacache_queue, true);
+    aacache_thread_id = create_thread(albumart_cache_thread, aacache_stack,
+                                      sizeof (aacache_stack), 0,
+                                      aacache_thread_name
+                                      IF_PRIO(, PRIORITY_BACKGROUND)
+                                      IF_COP(, CPU));
+    if (!aacache_thread_id)
+    {
+        /* Images are still cached as playback decodes them */
+        logf("aacache: no thread");
+        queue_delete(&aacache_queue);
+        return;
+    }
+
+    add_event(PLAYBACK_EVENT_TRACK_CHANGE, track_change_callback);
+}
+
+#endif /* HAVE_ALBUMART */
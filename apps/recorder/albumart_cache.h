@@ -0,0 +1,73 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#ifndef _ALBUMART_CACHE_H_
+#define _ALBUMART_CACHE_H_
+
+#ifdef HAVE_ALBUMART
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "bmp.h"
+
+/* A fixed number of slot files, each holding one scaled image */
+#define ALBUMART_CACHE_DIR   ROCKBOX_DIR "/albumart"
+#define ALBUMART_CACHE_SLOTS 1024
+
+/* Upcoming playlist entries made ahead of time */
+#define ALBUMART_CACHE_LOOKAHEAD 4
+
+/*
+ * An image is identified by its source file, the offset and length of the
+ * JPEG in it for embedded art (offset -1 and the file size otherwise) and
+ * the size it was scaled to fit. Images are stored in the native format of
+ * the main display, as read_jpeg_fd() with FORMAT_NATIVE|FORMAT_DITHER|
+ * FORMAT_RESIZE|FORMAT_KEEP_ASPECT makes them.
+ */
+
+/* Read the image scaled to fit bm->width x bm->height into bm->data, which
+   has room for maxsize bytes. Sets the actual size of the image and returns
+   the number of bytes read, or < 0 if it isn't cached. */
+int albumart_cache_read(const char *src, off_t offset, off_t length,
+                        struct bitmap *bm, int maxsize);
+
+/* Store an image that was scaled to fit dim */
+bool albumart_cache_write(const char *src, off_t offset, off_t length,
+                          const struct dim *dim, const struct bitmap *bm);
+
+/* Decode the album art in the open file, scaled to fit bm->width x
+   bm->height. Returns the size of the bitmap data or < 0 on error. */
+int albumart_decode_fd(int fd, const char *path, off_t offset, off_t length,
+                       struct bitmap *bm, int maxsize);
+
+/* Memory playback sets aside for decoding in the background, enough for
+   the largest album art size in use */
+size_t albumart_cache_buffer_size(void);
+
+/* Hand over that memory, or take it back with NULL. Waits for a decode
+   that is using it to finish. */
+void albumart_cache_set_buffer(void *buf, size_t size);
+
+void albumart_cache_init(void) INIT_ATTR;
+
+#endif /* HAVE_ALBUMART */
+
+#endif /* _ALBUMART_CACHE_H_ */
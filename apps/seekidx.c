@@ -0,0 +1,277 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/*
+ * Seek indices for MPEG audio files without a Xing/VBRI header. Without
+ * one the codec can only guess the byte offset of a time from the average
+ * bitrate, so seeks and resumes drift on VBR files. The first time such a
+ * file is played, a background thread walks all its frames and saves the
+ * offset of every few hundred milliseconds to SEEKIDX_DIR. Playback puts
+ * the index on the buffer next to the track and hands it to the codec.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "string-extra.h"
+#include "config.h"
+#include "system.h"
+#include "kernel.h"
+#include "thread.h"
+#include "file.h"
+#include "dir.h"
+#include "storage.h"
+#include "usb.h"
+#include "core_alloc.h"
+#include "crc32.h"
+#include "logf.h"
+#include "playback.h"
+#include "seekidx.h"
+
+#ifdef AUDIO_MP3_SEEKIDX
+
+/* Header part of the index, the entries follow on disk */
+#define SEEKIDX_HEADER_SIZE  offsetof(struct mp3_seekidx, offset)
+#define SEEKIDX_READ_SIZE    (8*1024)
+
+enum
+{
+    Q_SEEKIDX_BUILD = 1,
+};
+
+static struct event_queue seekidx_queue SHAREDBSS_ATTR;
+static long seekidx_stack[(DEFAULT_STACK_SIZE + 0x400)/sizeof(long)];
+static const char seekidx_thread_name[] = "seekidx";
+static unsigned int seekidx_thread_id = 0;
+
+/* The one pending build; only touched by the requester while not busy */
+static struct
+{
+    char path[MAX_PATH];
+    unsigned long filesize;
+    unsigned long first_frame_offset;
+    unsigned long frequency;
+} job;
+static volatile bool job_busy = false;
+
+static void get_index_path(const char *trackpath, char *buf, size_t bufsize)
+{
+    snprintf(buf, bufsize, SEEKIDX_DIR "/%08lx.idx",
+             (unsigned long)crc_32(trackpath, strlen(trackpath), 0xffffffff));
+}
+
+bool seekidx_wanted(const struct mp3entry *id3)
+{
+    /* No thread to build them, seek the old way */
+    if (!seekidx_thread_id)
+        return false;
+
+    switch (id3->codectype)
+    {
+    case AFMT_MPA_L1:
+    case AFMT_MPA_L2:
+    case AFMT_MPA_L3:
+        return !id3->has_toc && id3->filesize > 0 && id3->frequency > 0;
+    default:
+        return false;
+    }
+}
+
+static bool read_index(const char *trackpath, unsigned long filesize,
+                       unsigned long first_frame_offset,
+                       unsigned long frequency, struct mp3_seekidx *idx)
+{
+    char path[MAX_PATH];
+    bool ok = false;
+
+    get_index_path(trackpath, path, sizeof (path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (read(fd, idx, SEEKIDX_HEADER_SIZE) == (ssize_t)SEEKIDX_HEADER_SIZE
+        && idx->magic == MP3_SEEKIDX_MAGIC
+        && idx->filesize == filesize
+        && idx->first_frame_offset == first_frame_offset
+        && idx->frequency == frequency
+        && idx->frame_samples > 0 && idx->frame_step > 0
+        && idx->count <= MP3_SEEKIDX_ENTRIES)
+    {
+        ssize_t size = idx->count * sizeof (idx->offset[0]);
+        ok = read(fd, idx->offset, size) == size;
+    }
+
+    close(fd);
+    return ok;
+}
+
+bool seekidx_load(const struct mp3entry *id3, struct mp3_seekidx *idx)
+{
+    return read_index(id3->path, id3->filesize, id3->first_frame_offset,
+                      id3->frequency, idx);
+}
+
+void seekidx_apply(const struct mp3_seekidx *idx, struct mp3entry *id3)
+{
+    if (idx->frame_count == 0)
+        return;
+
+    id3->frame_count = idx->frame_count;
+    id3->length = (uint64_t)idx->frame_count * idx->frame_samples * 1000
+                    / idx->frequency;
+}
+
+void seekidx_request(const struct mp3entry *id3)
+{
+    if (job_busy || !seekidx_wanted(id3))
+        return;
+
+    strlcpy(job.path, id3->path, sizeof (job.path));
+    job.filesize = id3->filesize;
+    job.first_frame_offset = id3->first_frame_offset;
+    job.frequency = id3->frequency;
+    job_busy = true;
+
+    queue_post(&seekidx_queue, Q_SEEKIDX_BUILD, 0);
+}
+
+static bool build_progress(int percent)
+{
+    (void)percent;
+    yield();
+    /* Give way to anything else we are told */
+    return queue_empty(&seekidx_queue);
+}
+
+static void build_index(void)
+{
+    /* dummy ops with no callbacks, needed because by
+     * default buflib buffers can be moved around which must be avoided */
+    static struct buflib_callbacks dummy_ops;
+    char path[MAX_PATH];
+
+    int handle = core_alloc_ex("seekidx",
+                               sizeof (struct mp3_seekidx) + SEEKIDX_READ_SIZE,
+                               &dummy_ops);
+    if (handle <= 0)
+        return;
+
+    struct mp3_seekidx *idx = core_get_data(handle);
+    unsigned char *buf = (unsigned char *)(idx + 1);
+
+    /* Already made the last time this was played? */
+    if (read_index(job.path, job.filesize, job.first_frame_offset,
+                   job.frequency, idx))
+        goto out;
+
+    idx->magic = MP3_SEEKIDX_MAGIC;
+    idx->filesize = job.filesize;
+    idx->first_frame_offset = job.first_frame_offset;
+
+    int fd = open(job.path, O_RDONLY);
+    if (fd < 0)
+        goto out;
+
+    trigger_cpu_boost();
+    int frames = build_mp3_seekidx(fd, idx,
+                                   job.first_frame_offset + job.filesize,
+                                   build_progress, buf, SEEKIDX_READ_SIZE);
+    cancel_cpu_boost();
+    close(fd);
+
+    /* A different rate than the metadata means it found something else */
+    if (frames <= 0 || idx->frequency != job.frequency)
+    {
+        logf("seekidx: no index for %s (%d)", job.path, frames);
+        goto out;
+    }
+
+    mkdir(SEEKIDX_DIR);
+    get_index_path(job.path, path, sizeof (path));
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        goto out;
+
+    ssize_t size = SEEKIDX_HEADER_SIZE + idx->count * sizeof (idx->offset[0]);
+    bool ok = write(fd, idx, size) == size;
+    close(fd);
+
+    if (!ok)
+        remove(path);
+
+    logf("seekidx: %d frames, %lu entries for %s", frames,
+         (unsigned long)idx->count, job.path);
+out:
+    core_free(handle);
+}
+
+static void seekidx_thread(void)
+{
+    struct queue_event ev;
+
+    while (1)
+    {
+        /* Wait for the disk to spin up while a build is pending */
+        if (job_busy)
+            queue_wait_w_tmo(&seekidx_queue, &ev, HZ);
+        else
+            queue_wait(&seekidx_queue, &ev);
+
+        switch (ev.id)
+        {
+            case Q_SEEKIDX_BUILD:
+            case SYS_TIMEOUT:
+                if (!job_busy)
+                    break;
+#ifdef HAVE_DISK_STORAGE
+                if (!storage_disk_is_active())
+                    break;
+#endif
+                build_index();
+                job_busy = false;
+                break;
+
+            case SYS_USB_CONNECTED:
+                job_busy = false;
+                usb_acknowledge(SYS_USB_CONNECTED_ACK);
+                usb_wait_for_disconnect(&seekidx_queue);
+                break;
+        }
+    }
+}
+
+void INIT_ATTR seekidx_init(void)
+{
+    queue_init(&seekidx_queue, true);
+    seekidx_thread_id = create_thread(seekidx_thread, seekidx_stack,
+                                      sizeof (seekidx_stack), 0,
+                                      seekidx_thread_name
+                                      IF_PRIO(, PRIORITY_BACKGROUND)
+                                      IF_COP(, CPU));
+    if (!seekidx_thread_id)
+    {
+        logf("seekidx: no thread");
+        queue_delete(&seekidx_queue);
+    }
+}
+
+#endif /* AUDIO_MP3_SEEKIDX */
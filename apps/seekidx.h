@@ -0,0 +1,48 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#ifndef _SEEKIDX_H_
+#define _SEEKIDX_H_
+
+#include <stdbool.h>
+#include "metadata.h"
+#include "mp3data.h"
+
+/* One small file per track, named after the CRC of its path */
+#define SEEKIDX_DIR  ROCKBOX_DIR "/seekidx"
+
+/* Is the track MPEG audio that has no VBR header to seek with? */
+bool seekidx_wanted(const struct mp3entry *id3);
+
+/* Read the cached seek index of the track - returns false if there is
+   none or it doesn't match the file anymore */
+bool seekidx_load(const struct mp3entry *id3, struct mp3_seekidx *idx);
+
+/* Set the exact length of the track from its seek index */
+void seekidx_apply(const struct mp3_seekidx *idx, struct mp3entry *id3);
+
+/* Build the seek index of the track in the background, next time the
+   disk is spinning anyway. Dropped if a build is already pending. */
+void seekidx_request(const struct mp3entry *id3);
+
+void seekidx_init(void) INIT_ATTR;
+
+#endif /* _SEEKIDX_H_ */
@@ -89,12 +89,29 @@
 #include "eeprom_settings.h"
 #endif
 
+#ifdef HAVE_TC_RAMCACHE_MMAP
+#include <sys/mman.h>
+#endif
+
 #ifdef __PCTOOL__
 #define yield() do { } while(0)
 #define sim_sleep(timeout) do { } while(0)
 #define do_timed_yield() do { } while(0)
 #endif
 
+#if (defined(__PCTOOL__) || defined(APPLICATION)) && !defined(WIN32)
+/* Hosted builds sort the tag indices externally at commit (see
+ * tempbuf_sort()), so the library size isn't limited by tempbuf. */
+#define TAGCACHE_EXTERNAL_SORT
+#endif
+
+#if defined(TAGCACHE_EXTERNAL_SORT) || defined(TAGCACHE_PARALLEL_SCAN)
+#include <pthread.h>
+#include <time.h>
+/* Maximum number of threads sorting the runs or reading metadata. */
+#define WORKER_THREADS_MAX  8
+#endif
+
 #ifndef __PCTOOL__
 /* Tag Cache thread. */
 static struct event_queue tagcache_queue SHAREDBSS_ATTR;
@@ -109,8 +126,10 @@ static char curpath[TAG_MAXLEN+32];
 static char *tempbuf;     /* Allocated when needed. */
 static long tempbufidx;   /* Current location in buffer. */
 static size_t tempbuf_size; /* Buffer size (TEMPBUF_SIZE). */
+#ifndef TAGCACHE_EXTERNAL_SORT
 static long tempbuf_left; /* Buffer space left. */
 static long tempbuf_pos;
+#endif
 #ifndef __PCTOOL__
 static int tempbuf_handle;
 #endif
@@ -130,6 +149,12 @@ static int tempbuf_handle;
     (1LU << tag_genre) | (1LU << tag_composer) | (1LU << tag_comment) | \
     (1LU << tag_albumartist) | (1LU << tag_grouping))
 
+/* Filter tags getting an inverted index in the ramcache (see build_postings()). */
+#define TAGCACHE_POSTINGS_TAGS ((1LU << tag_artist) | (1LU << tag_album) | \
+    (1LU << tag_genre) | (1LU << tag_composer) | (1LU << tag_albumartist))
+#define TAGCACHE_POSTINGS_COUNT 5
+#define TAGCACHE_HAS_POSTINGS(tag) (BIT_N(tag) & TAGCACHE_POSTINGS_TAGS)
+
 /* String presentation of the tags defined in tagcache.h. Must be in correct order! */
 static const char *tags_str[] = { "artist", "album", "genre", "title", 
     "filename", "composer", "comment", "albumartist", "grouping", "year", 
@@ -205,6 +230,27 @@ static const char * const index_entry_ec     = "lllllllllllllllllllllll";
 static const char * const tagcache_header_ec = "lll";
 static const char * const master_header_ec   = "llllll";
 
+/* Open addressed table of filename hashes. Each slot points to the
+ * filename entry of a file, written by commit() and only valid with the
+ * master index of the same commit. */
+struct pathhash_header {
+    int32_t magic;        /* Header version number */
+    int32_t commitid;     /* Commit the table was built for */
+    int32_t entry_count;  /* Number of master index entries at that commit */
+    int32_t bucket_count; /* Number of slots, a power of two */
+};
+
+struct pathhash_slot {
+    int32_t hash; /* crc_32() of the filename */
+    int32_t seek; /* Offset of the filename entry, 0 if the slot is free */
+};
+
+static const char * const pathhash_header_ec = "llll";
+static const char * const pathhash_slot_ec   = "ll";
+
+/* Slots read at once when probing. */
+#define PATHHASH_PROBE_SLOTS 8
+
 static struct master_header current_tcmh;
 
 #ifdef HAVE_TC_RAMCACHE
@@ -217,6 +263,14 @@ static struct master_header current_tcmh;
 
 #define IF_TCRCDC(...) IF_DIRCACHE(__VA_ARGS__)
 
+#ifdef HAVE_TC_RAMCACHE_MMAP
+/* The filename tag file is mapped like the others. */
+#define TCRC_HAS_FILENAMES true
+#else
+/* Only dircache references of the filenames are kept in ram. */
+#define TCRC_HAS_FILENAMES false
+#endif
+
 #ifdef HAVE_DIRCACHE
 #define tcrc_dcfrefs \
     ((struct dircache_fileref *)(tcramcache.hdr->tags[tag_filename] + \
@@ -227,7 +281,11 @@ static struct master_header current_tcmh;
 struct ramcache_header {
     char *tags[TAG_COUNT];       /* Tag file content (dcfrefs if tag_filename) */
     int entry_count[TAG_COUNT];  /* Number of entries in the indices. */
-    struct index_entry indices[0]; /* Master index file content */
+    int32_t *postings[TAG_COUNT]; /* idx_ids sorted by tag seek (filter tags) */
+    int postings_count;          /* Number of idx_ids in each postings list */
+    bool postings_valid;         /* Cleared when tag seeks change in ram */
+    struct index_entry *indices; /* Master index file content (follows hdr
+                                    unless mapped) */
 };
 
 #ifdef HAVE_EEPROM_SETTINGS
@@ -245,6 +303,13 @@ static struct tcramcache
     struct ramcache_header *hdr;      /* allocated ramcache_header */
     int handle;                       /* buffer handle */
     int move_lock;
+#ifdef HAVE_TC_RAMCACHE_MMAP
+    struct ramcache_header maphdr;    /* hdr of the mapped files */
+    void *map[TAG_COUNT+1];           /* Tag files, master index is last */
+    size_t map_size[TAG_COUNT+1];
+    void *postings_map;
+    size_t postings_size;
+#endif
 } tcramcache;
 
 static inline void tcrc_buffer_lock(void)
@@ -274,6 +339,7 @@ struct temp_file_entry {
     long data_length;
 };
 
+#ifndef TAGCACHE_EXTERNAL_SORT
 struct tempbuf_id_list {
     long id;
     struct tempbuf_id_list *next;
@@ -285,11 +351,14 @@ struct tempbuf_searchidx {
     int seek;
     struct tempbuf_id_list idlist;
 };
+#endif /* !TAGCACHE_EXTERNAL_SORT */
 
 /* Lookup buffer for fixing messed up index while after sorting. */
 static long commit_entry_count;
 static long lookup_buffer_depth;
+#ifndef TAGCACHE_EXTERNAL_SORT
 static struct tempbuf_searchidx **lookup;
+#endif
 
 /* Used when building the temporary file. */
 static int cachefd = -1, filenametag_fd;
@@ -446,6 +515,18 @@ static bool do_timed_yield(void)
 }
 #endif /* __PCTOOL__ */
 
+#if defined(TAGCACHE_EXTERNAL_SORT) || defined(TAGCACHE_PARALLEL_SCAN)
+static int worker_thread_count(void)
+{
+    static int count = 0;
+
+    if (count == 0)
+        count = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), WORKER_THREADS_MAX);
+
+    return count;
+}
+#endif
+
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
 /* find the ramcache entry corresponding to the file indicated by
  * filename and dc (it's corresponding dircache id). */
@@ -601,6 +682,136 @@ static long find_entry_disk(const char *filename_raw, bool localfd)
     return tfe.idx_id;
 }
 
+/* Look up filename from the path hash index. Returns the index id,
+ * -1 if the file isn't in the database or -2 if there is no valid
+ * index and the filename tag has to be searched instead. */
+static long find_entry_hash(const char *filename_raw)
+{
+    struct pathhash_header phdr;
+    struct pathhash_slot slots[PATHHASH_PROBE_SLOTS];
+    struct tagcache_header tch;
+    struct tagfile_entry tfe;
+    char buf[TAG_MAXLEN+32];
+    long idx_id = -1;
+    int32_t hash, mask;
+    int fd, namefd = -1;
+    int pos, probed = 0;
+
+    const char *filename = filename_raw;
+#ifdef APPLICATION
+    char pathbuf[PATH_MAX]; /* Note: Don't use MAX_PATH here, it's too small */
+    if (realpath(filename, pathbuf) == pathbuf)
+        filename = pathbuf;
+#endif /* APPLICATION */
+
+    if (!tc_stat.ready)
+        return -2;
+
+    fd = open(TAGCACHE_FILE_PATHHASH, O_RDONLY);
+    if (fd < 0)
+        return -2;
+
+    if (ecread(fd, &phdr, 1, pathhash_header_ec, tc_stat.econ)
+            != sizeof(struct pathhash_header)
+        || phdr.magic != TAGCACHE_MAGIC
+        || phdr.commitid != current_tcmh.commitid
+        || phdr.entry_count != current_tcmh.tch.entry_count
+        || phdr.bucket_count <= 0
+        || (phdr.bucket_count & (phdr.bucket_count - 1)))
+    {
+        logf("path index not valid");
+        close(fd);
+        return -2;
+    }
+
+    hash = crc_32(filename, strlen(filename), 0xffffffff);
+    mask = phdr.bucket_count - 1;
+    pos = hash & mask;
+
+    while (probed < phdr.bucket_count)
+    {
+        int count = MIN(PATHHASH_PROBE_SLOTS, phdr.bucket_count - pos);
+
+        lseek(fd, sizeof(struct pathhash_header)
+                  + pos * sizeof(struct pathhash_slot), SEEK_SET);
+        if (ecread(fd, slots, count, pathhash_slot_ec, tc_stat.econ)
+                != (ssize_t)(count * sizeof(struct pathhash_slot)))
+        {
+            logf("path index read error");
+            idx_id = -2;
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (slots[i].seek <= 0)
+                goto done; /* End of the chain */
+
+            if (slots[i].hash != hash)
+                continue;
+
+            /* Compare the name, the hash may collide. */
+#ifdef HAVE_TC_RAMCACHE_MMAP
+            if (tc_stat.ramcache)
+            {
+                size_t size = tcramcache.map_size[tag_filename];
+                struct tagfile_entry *ep;
+
+                if (slots[i].seek + sizeof(struct tagfile_entry) > size)
+                    continue;
+
+                ep = (struct tagfile_entry *)
+                        &tcramcache.hdr->tags[tag_filename][slots[i].seek];
+                if (ep->tag_length > (long)strlen(filename)
+                    && slots[i].seek + sizeof(struct tagfile_entry)
+                        + ep->tag_length <= size
+                    && !strncmp(filename, ep->tag_data, ep->tag_length))
+                {
+                    idx_id = ep->idx_id;
+                    goto done;
+                }
+                continue;
+            }
+#endif /* HAVE_TC_RAMCACHE_MMAP */
+            if (namefd < 0 &&
+                (namefd = open_tag_fd(&tch, tag_filename, false)) < 0)
+            {
+                idx_id = -2;
+                goto done;
+            }
+
+            lseek(namefd, slots[i].seek, SEEK_SET);
+            if (ecread_tagfile_entry(namefd, &tfe)
+                    != sizeof(struct tagfile_entry)
+                || tfe.tag_length <= 0
+                || tfe.tag_length >= (long)sizeof(buf)
+                || read(namefd, buf, tfe.tag_length) != tfe.tag_length)
+            {
+                logf("path index points to a bad entry");
+                idx_id = -2;
+                goto done;
+            }
+
+            buf[tfe.tag_length] = '\0';
+            if (!strcmp(filename, buf))
+            {
+                idx_id = tfe.idx_id;
+                goto done;
+            }
+        }
+
+        probed += count;
+        pos = (pos + count) & mask;
+    }
+
+done:
+    if (namefd >= 0)
+        close(namefd);
+    close(fd);
+
+    return idx_id;
+}
+
 static int find_index(const char *filename)
 {
     long idx_id = -1;
@@ -610,6 +821,9 @@ static int find_index(const char *filename)
 #endif
     
     if (idx_id < 0)
+        idx_id = find_entry_hash(filename);
+
+    if (idx_id == -2)
         idx_id = find_entry_disk(filename, true);
     
     return idx_id;
@@ -785,7 +999,7 @@ static bool retrieve(struct tagcache_search *tcs, IF_DIRCACHE(int idx_id,)
         }
         else
 #endif /* HAVE_DIRCACHE */
-        if (tag != tag_filename)
+        if (tag != tag_filename || TCRC_HAS_FILENAMES)
         {
             struct tagfile_entry *ep =
                 (struct tagfile_entry *)&tcramcache.hdr->tags[tag][seek];
@@ -1184,6 +1398,114 @@ static bool add_uniqbuf(struct tagcache_search *tcs, unsigned long id)
     return true;
 }
 
+#ifdef HAVE_TC_RAMCACHE
+/* Add a ramcache entry to the seek list if it matches the search. The buffer
+ * must be locked by the caller. */
+static void ramsearch_add_entry(struct tagcache_search *tcs, int idx_id)
+{
+    struct tagcache_seeklist_entry *seeklist;
+    /* idx points to movable data, don't yield or reload */
+    struct index_entry *idx = &tcramcache.hdr->indices[idx_id];
+    int j;
+
+    /* Skip deleted files. */
+    if (idx->flag & FLAG_DELETED)
+        return ;
+
+    /* Go through all filters.. */
+    for (j = 0; j < tcs->filter_count; j++)
+    {
+        if (idx->tag_seek[tcs->filter_tag[j]] != tcs->filter_seek[j])
+            return ;
+    }
+
+    /* Check for conditions. */
+    if (!check_clauses(tcs, idx, tcs->clause, tcs->clause_count))
+        return ;
+    /* Add to the seek list if not already in uniq buffer (doesn't yield)*/
+    if (!add_uniqbuf(tcs, idx->tag_seek[tcs->type]))
+        return ;
+
+    /* Lets add it. */
+    seeklist = &tcs->seeklist[tcs->seek_list_count];
+    seeklist->seek = idx->tag_seek[tcs->type];
+    seeklist->flag = idx->flag;
+    seeklist->idx_id = idx_id;
+    tcs->seek_list_count++;
+}
+
+/* First position in the postings list of tag with a tag seek >= seek. */
+static int postings_lower_bound(const int32_t *list, int count, int tag,
+                                int32_t seek)
+{
+    int lo = 0, hi = count;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (tcramcache.hdr->indices[list[mid]].tag_seek[tag] < seek)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * Find the entries matching the most selective filter of the search,
+ * starting from tcs->seek_pos. Returns the number of entries, with their
+ * ascending idx_ids at *listp, or -1 if none of the filters has postings.
+ */
+static int find_postings(struct tagcache_search *tcs, const int32_t **listp)
+{
+    int count = tcramcache.hdr->postings_count;
+    int best = -1;
+    int lo, hi;
+
+    if (!tcramcache.hdr->postings_valid)
+        return -1;
+
+    for (int j = 0; j < tcs->filter_count; j++)
+    {
+        int tag = tcs->filter_tag[j];
+        const int32_t *list = tcramcache.hdr->postings[tag];
+
+        if (list == NULL)
+            continue;
+
+        lo = postings_lower_bound(list, count, tag, tcs->filter_seek[j]);
+        hi = postings_lower_bound(list, count, tag, tcs->filter_seek[j] + 1);
+
+        if (best < 0 || hi - lo < best)
+        {
+            best = hi - lo;
+            *listp = &list[lo];
+        }
+    }
+
+    if (best <= 0)
+        return best;
+
+    /* Skip the entries already seen by the previous rounds. */
+    lo = 0;
+    hi = best;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if ((*listp)[mid] < tcs->seek_pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *listp += lo;
+    return best - lo;
+}
+#endif /* HAVE_TC_RAMCACHE */
+
 static bool build_lookup_list(struct tagcache_search *tcs)
 {
     struct index_entry entry;
@@ -1194,45 +1516,34 @@ static bool build_lookup_list(struct tagcache_search *tcs)
 #ifdef HAVE_TC_RAMCACHE
     if (tcs->ramsearch)
     {
+        const int32_t *postings;
+        int count;
+
         tcrc_buffer_lock(); /* lock because below makes a pointer to movable data */
 
-        for (i = tcs->seek_pos; i < current_tcmh.tch.entry_count; i++)
+        count = find_postings(tcs, &postings);
+        if (count >= 0)
         {
-            struct tagcache_seeklist_entry *seeklist;
-            /* idx points to movable data, don't yield or reload */
-            struct index_entry *idx = &tcramcache.hdr->indices[i];
-            if (tcs->seek_list_count == SEEK_LIST_SIZE)
-                break ;
-            
-            /* Skip deleted files. */
-            if (idx->flag & FLAG_DELETED)
-                continue;
-            
-            /* Go through all filters.. */
-            for (j = 0; j < tcs->filter_count; j++)
+            /* Only the entries of the most selective filter can match. */
+            for (j = 0; j < count; j++)
             {
-                if (idx->tag_seek[tcs->filter_tag[j]] != tcs->filter_seek[j])
-                {
+                if (tcs->seek_list_count == SEEK_LIST_SIZE)
                     break ;
-                }
+
+                ramsearch_add_entry(tcs, postings[j]);
             }
-            
-            if (j < tcs->filter_count)
-                continue ;
 
-            /* Check for conditions. */
-            if (!check_clauses(tcs, idx, tcs->clause, tcs->clause_count))
-                continue;
-            /* Add to the seek list if not already in uniq buffer (doesn't yield)*/
-            if (!add_uniqbuf(tcs, idx->tag_seek[tcs->type]))
-                continue;
-            
-            /* Lets add it. */
-            seeklist = &tcs->seeklist[tcs->seek_list_count];
-            seeklist->seek = idx->tag_seek[tcs->type];
-            seeklist->flag = idx->flag;
-            seeklist->idx_id = i;
-            tcs->seek_list_count++;
+            i = j < count ? postings[j] : current_tcmh.tch.entry_count;
+        }
+        else
+        {
+            for (i = tcs->seek_pos; i < current_tcmh.tch.entry_count; i++)
+            {
+                if (tcs->seek_list_count == SEEK_LIST_SIZE)
+                    break ;
+
+                ramsearch_add_entry(tcs, i);
+            }
         }
 
         tcrc_buffer_unlock();
@@ -1308,6 +1619,7 @@ static void remove_files(void)
     tc_stat.ramcache = false;
     tc_stat.econ = false;
     remove(TAGCACHE_FILE_MASTER);
+    remove(TAGCACHE_FILE_PATHHASH);
     for (i = 0; i < TAG_COUNT; i++)
     {
         if (TAGCACHE_IS_NUMERIC(i))
@@ -1566,7 +1878,7 @@ static bool get_next(struct tagcache_search *tcs)
         }
 #endif /* HAVE_DIRCACHE */
 
-        if (tcs->type != tag_filename)
+        if (tcs->type != tag_filename || TCRC_HAS_FILENAMES)
         {
             struct tagfile_entry *ep;
             
@@ -1704,7 +2016,7 @@ void tagcache_search_finish(struct tagcache_search *tcs)
         write_lock--;
 }
 
-#if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
+#ifdef HAVE_TC_RAMCACHE
 static struct tagfile_entry *get_tag(const struct index_entry *entry, int tag)
 {
     return (struct tagfile_entry *)&tcramcache.hdr->tags[tag][entry->tag_seek[tag]];
@@ -1729,9 +2041,21 @@ bool tagcache_fill_tags(struct mp3entry *id3, const char *filename)
     if (!tc_stat.ready || !tc_stat.ramcache)
         return false;
     
-    /* Find the corresponding entry in tagcache. */
+    /* Find the corresponding entry in tagcache. Skins call this on every
+     * refresh, so the path index is only used where reading it doesn't
+     * touch the disk: hosted targets, which have the filename tag mapped
+     * and the index in the page cache. */
+#ifdef HAVE_DIRCACHE
     idx_id = find_entry_ram(filename);
+#else
+    idx_id = -1;
+    (void)filename;
+#endif
+#ifdef HAVE_TC_RAMCACHE_MMAP
     if (idx_id < 0)
+        idx_id = find_entry_hash(filename);
+#endif
+    if (idx_id < 0 || idx_id >= current_tcmh.tch.entry_count)
         return false;
     
     entry = &tcramcache.hdr->indices[idx_id];
@@ -1792,7 +2116,7 @@ bool tagcache_fill_tags(struct mp3entry *id3, const char *filename)
 
     return true;
 }
-#endif /* defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE) */
+#endif /* HAVE_TC_RAMCACHE */
 
 static inline void write_item(const char *item)
 {
@@ -1823,28 +2147,12 @@ static int check_if_empty(char **tag)
     return length + 1;
 }
 
-/* GCC 3.4.6 for Coldfire can choose to inline this function. Not a good
- * idea, as it uses lots of stack and is called from a recursive function
- * (check_dir).
- */
-static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
+/* Check a file found by the scan against the database. Returns true if
+ * its metadata has to be read and added to the temporary db file. */
+static bool check_tagcache_file(const char *path, unsigned long mtime)
 {
-    #define ADD_TAG(entry, tag, data) \
-        /* Adding tag */                              \
-        entry.tag_offset[tag] = offset;               \
-        entry.tag_length[tag] = check_if_empty(data); \
-        offset += entry.tag_length[tag]
-
-    struct mp3entry id3;
-    struct temp_file_entry entry;
-    bool ret;
-    int fd;
     int idx_id = -1;
-    char tracknumfix[3];
-    int offset = 0;
     int path_length = strlen(path);
-    bool has_albumartist;
-    bool has_grouping;
 
 #ifdef SIMULATOR
     /* Crude logging for the sim - to aid in debugging */
@@ -1859,19 +2167,19 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
 #endif /* SIMULATOR */
 
     if (cachefd < 0)
-        return ;
+        return false;
 
     /* Check for overlength file path. */
     if (path_length > TAG_MAXLEN)
     {
         /* Path can't be shortened. */
         logf("Too long path: %s", path);
-        return ;
+        return false;
     }
     
     /* Check if the file is supported. */
     if (probe_file_format(path) == AFMT_UNKNOWN)
-        return ;
+        return false;
     
     /* Check if the file is already cached. */
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
@@ -1880,7 +2188,11 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
 
     /* Be sure the entry doesn't exist. */
     if (filenametag_fd >= 0 && idx_id < 0)
-        idx_id = find_entry_disk(path, false);
+    {
+        idx_id = find_entry_hash(path);
+        if (idx_id == -2)
+            idx_id = find_entry_disk(path, false);
+    }
     
     /* Check if file has been modified. */
     if (idx_id >= 0)
@@ -1893,13 +2205,13 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
         if (!get_index(-1, idx_id, &idx, true))
         {
             logf("failed to retrieve index entry");
-            return ;
+            return false;
         }
         
         if ((unsigned long)idx.tag_seek[tag_mtime] == mtime)
         {
             /* No changes to file. */
-            return ;
+            return false;
         }
         
         /* Metadata might have been changed. Delete the entry. */
@@ -1907,69 +2219,73 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
         if (!delete_entry(idx_id))
         {
             logf("delete_entry failed: %d", idx_id);
-            return ;
+            return false;
         }
     }
-    
-    fd = open(path, O_RDONLY);
-    if (fd < 0)
-    {
-        logf("open fail: %s", path);
-        return ;
-    }
 
-    memset(&id3, 0, sizeof(struct mp3entry));
-    memset(&entry, 0, sizeof(struct temp_file_entry));
-    memset(&tracknumfix, 0, sizeof(tracknumfix));
-    ret = get_metadata(&id3, fd, path);
-    close(fd);
+    return true;
+}
 
-    if (!ret)
-        return ;
+/* Write the metadata read from path to the temporary db file. */
+static void add_tagcache_entry(struct mp3entry *id3, char *path,
+                               unsigned long mtime)
+{
+    #define ADD_TAG(entry, tag, data) \
+        /* Adding tag */                              \
+        entry.tag_offset[tag] = offset;               \
+        entry.tag_length[tag] = check_if_empty(data); \
+        offset += entry.tag_length[tag]
+
+    struct temp_file_entry entry;
+    int offset = 0;
+    bool has_albumartist;
+    bool has_grouping;
 
     logf("-> %s", path);
     
-    if (id3.tracknum <= 0)              /* Track number missing? */
+    memset(&entry, 0, sizeof(struct temp_file_entry));
+
+    if (id3->tracknum <= 0)              /* Track number missing? */
     {
-        id3.tracknum = -1;
+        id3->tracknum = -1;
     }
     
     /* Numeric tags */
-    entry.tag_offset[tag_year] = id3.year;
-    entry.tag_offset[tag_discnumber] = id3.discnum;
-    entry.tag_offset[tag_tracknumber] = id3.tracknum;
-    entry.tag_offset[tag_length] = id3.length;
-    entry.tag_offset[tag_bitrate] = id3.bitrate;
+    entry.tag_offset[tag_year] = id3->year;
+    entry.tag_offset[tag_discnumber] = id3->discnum;
+    entry.tag_offset[tag_tracknumber] = id3->tracknum;
+    entry.tag_offset[tag_length] = id3->length;
+    entry.tag_offset[tag_bitrate] = id3->bitrate;
     entry.tag_offset[tag_mtime] = mtime;
     
     /* String tags. */
-    has_albumartist = id3.albumartist != NULL
-        && strlen(id3.albumartist) > 0;
-    has_grouping = id3.grouping != NULL
-        && strlen(id3.grouping) > 0;
+    has_albumartist = id3->albumartist != NULL
+        && strlen(id3->albumartist) > 0;
+    has_grouping = id3->grouping != NULL
+        && strlen(id3->grouping) > 0;
 
     ADD_TAG(entry, tag_filename, &path);
-    ADD_TAG(entry, tag_title, &id3.title);
-    ADD_TAG(entry, tag_artist, &id3.artist);
-    ADD_TAG(entry, tag_album, &id3.album);
-    ADD_TAG(entry, tag_genre, &id3.genre_string);
-    ADD_TAG(entry, tag_composer, &id3.composer);
-    ADD_TAG(entry, tag_comment, &id3.comment);
+    ADD_TAG(entry, tag_title, &id3->title);
+    ADD_TAG(entry, tag_artist, &id3->artist);
+    ADD_TAG(entry, tag_album, &id3->album);
+    ADD_TAG(entry, tag_genre, &id3->genre_string);
+    ADD_TAG(entry, tag_composer, &id3->composer);
+    ADD_TAG(entry, tag_comment, &id3->comment);
     if (has_albumartist)
     {
-        ADD_TAG(entry, tag_albumartist, &id3.albumartist);
+        ADD_TAG(entry, tag_albumartist, &id3->albumartist);
     }
     else
     {
-        ADD_TAG(entry, tag_albumartist, &id3.artist);
+        ADD_TAG(entry, tag_albumartist, &id3->artist);
     }
     if (has_grouping)
     {
-        ADD_TAG(entry, tag_grouping, &id3.grouping);
+        ADD_TAG(entry, tag_grouping, &id3->grouping);
     }
     else
     {
-        ADD_TAG(entry, tag_grouping, &id3.title);
+        ADD_TAG(entry, tag_grouping, &id3->title);
     }
     entry.data_length = offset;
     
@@ -1978,27 +2294,27 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
     
     /* And tags also... Correct order is critical */
     write_item(path);
-    write_item(id3.title);
-    write_item(id3.artist);
-    write_item(id3.album);
-    write_item(id3.genre_string);
-    write_item(id3.composer);
-    write_item(id3.comment);
+    write_item(id3->title);
+    write_item(id3->artist);
+    write_item(id3->album);
+    write_item(id3->genre_string);
+    write_item(id3->composer);
+    write_item(id3->comment);
     if (has_albumartist)
     {
-        write_item(id3.albumartist);
+        write_item(id3->albumartist);
     }
     else
     {
-        write_item(id3.artist);
+        write_item(id3->artist);
     }
     if (has_grouping)
     {
-        write_item(id3.grouping);
+        write_item(id3->grouping);
     }
     else
     {
-        write_item(id3.title);
+        write_item(id3->title);
     }
 
     total_entry_count++;
@@ -2006,6 +2322,37 @@ static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
     #undef ADD_TAG
 }
 
+/* GCC 3.4.6 for Coldfire can choose to inline this function. Not a good
+ * idea, as it uses lots of stack and is called from a recursive function
+ * (check_dir).
+ */
+static void NO_INLINE add_tagcache(char *path, unsigned long mtime)
+{
+    struct mp3entry id3;
+    bool ret;
+    int fd;
+
+    if (!check_tagcache_file(path, mtime))
+        return ;
+    
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        logf("open fail: %s", path);
+        return ;
+    }
+
+    memset(&id3, 0, sizeof(struct mp3entry));
+    ret = get_metadata(&id3, fd, path);
+    close(fd);
+
+    if (!ret)
+        return ;
+
+    add_tagcache_entry(&id3, path, mtime);
+}
+
+#ifndef TAGCACHE_EXTERNAL_SORT
 static bool tempbuf_insert(char *str, int id, int idx_id, bool unique)
 {
     struct tempbuf_searchidx *index = (struct tempbuf_searchidx *)tempbuf;
@@ -2216,13 +2563,504 @@ inline static int tempbuf_find_location(int id)
 
     return entry->seek;
 }
+#else /* TAGCACHE_EXTERNAL_SORT */
 
-static bool build_numeric_indices(struct tagcache_header *h, int tmpfd)
-{
-    struct master_header tcmh;
-    struct index_entry idx;
-    int masterfd;
-    int masterfd_pos;
+/**
+ * External merge sort for the sorted indices. Instead of keeping every
+ * tag of the index in tempbuf, the tags are collected into the run area
+ * of tempbuf. Whenever it fills up the area is split between worker
+ * threads which sort their part in parallel, and the sorted runs are
+ * spilled to TAGCACHE_FILE_SORTRUN. tempbuf_sort() finally merges all
+ * runs into the index file, dropping duplicates of unique tags.
+ *
+ * The lookup buffer is replaced by a plain table of the new index file
+ * seeks, so only that table (4 bytes per lookup id) has to fit in
+ * memory.
+ */
+
+/* Don't bother with threads for less records than this. */
+#define SORT_THREAD_MIN   4096
+/* Maximum number of runs to merge. */
+#define SORT_RUNS_MAX     256
+
+struct sortrec_hdr {
+    int32_t id;      /* Lookup id (see build_index()) */
+    int32_t idx_id;  /* Master index entry or -1 */
+    int32_t seq;     /* Insertion order, the first duplicate is kept */
+    int32_t length;  /* String length including '\0' */
+};
+
+struct sortrec {
+    struct sortrec_hdr h;
+    char *str;
+};
+
+struct sort_part {
+    struct sortrec *recs;
+    long count;
+    volatile bool done;
+};
+
+struct sort_run {
+    long pos;        /* Next position to load from the run file */
+    long end;        /* End of the run in the run file */
+    char *buf;       /* Load buffer */
+    int buf_len;     /* Bytes loaded */
+    int buf_pos;     /* Next record in the buffer */
+    struct sortrec rec; /* Current record */
+};
+
+static int32_t *seektable;        /* Index file seek of every lookup id */
+static struct sortrec *sortrecs;  /* Records from the start of run area.. */
+static char *sortstr;             /* ..and strings from the end */
+static char *sortarea;
+static long sortarea_size;
+static long sortrec_count;
+static long sortrec_seq;
+static bool sort_unique;
+static int sort_runfd = -1;
+static int sort_run_count;
+static long sort_run_ofs[SORT_RUNS_MAX + 1];
+static struct sort_run sort_runs[SORT_RUNS_MAX];
+static int sort_heap[SORT_RUNS_MAX];
+static char sort_iobuf[32*1024];
+static int sort_iobuf_len;
+
+static bool sort_iobuf_flush(int fd)
+{
+    if (sort_iobuf_len > 0 &&
+        write(fd, sort_iobuf, sort_iobuf_len) != sort_iobuf_len)
+        return false;
+
+    sort_iobuf_len = 0;
+    return true;
+}
+
+static bool sort_iobuf_put(int fd, const void *data, int len)
+{
+    if (sort_iobuf_len + len > (int)sizeof(sort_iobuf) &&
+        !sort_iobuf_flush(fd))
+        return false;
+
+    memcpy(&sort_iobuf[sort_iobuf_len], data, len);
+    sort_iobuf_len += len;
+    return true;
+}
+
+static int compare_tags(const char *s1, const char *s2)
+{
+    if (strcmp(s1, UNTAGGED) == 0)
+    {
+        if (strcmp(s2, UNTAGGED) == 0)
+            return 0;
+        return -1;
+    }
+    else if (strcmp(s2, UNTAGGED) == 0)
+        return 1;
+
+    return strncasecmp(s1, s2, TAG_MAXLEN);
+}
+
+static int compare_sortrecs(const struct sortrec *e1,
+                            const struct sortrec *e2)
+{
+    int cmp = compare_tags(e1->str, e2->str);
+
+    if (cmp == 0)
+        cmp = e1->h.seq < e2->h.seq ? -1 : 1;
+
+    return cmp;
+}
+
+/* Called from the worker threads, so no yielding here. */
+static int compare(const void *p1, const void *p2)
+{
+    return compare_sortrecs(p1, p2);
+}
+
+static int compare_yield(const void *p1, const void *p2)
+{
+    do_timed_yield();
+    return compare_sortrecs(p1, p2);
+}
+
+static void * sort_thread(void *data)
+{
+    struct sort_part *part = data;
+
+    qsort(part->recs, part->count, sizeof(struct sortrec), compare);
+    part->done = true;
+    return NULL;
+}
+
+static bool tempbuf_init_sort(void)
+{
+    size_t tablesize = ALIGN_UP(lookup_buffer_depth * sizeof(int32_t),
+                                sizeof(long));
+
+    /* Each run needs room for at least one record when merging. */
+    if (tablesize + (sizeof(struct sortrec_hdr) + TAG_MAXLEN+32)
+        * SORT_RUNS_MAX > tempbuf_size)
+        return false;
+
+    seektable = (int32_t *)tempbuf;
+    memset(seektable, 0xff, tablesize); /* -1 == not found */
+
+    sortarea = &tempbuf[tablesize];
+    sortarea_size = tempbuf_size - tablesize;
+    sortrecs = (struct sortrec *)sortarea;
+    sortstr = &sortarea[sortarea_size];
+    sortrec_count = 0;
+    sortrec_seq = 0;
+    sort_run_count = 0;
+    sort_run_ofs[0] = 0;
+
+    if (sort_runfd < 0)
+    {
+        sort_runfd = open(TAGCACHE_FILE_SORTRUN,
+                          O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (sort_runfd < 0)
+        {
+            logf("%s open fail", TAGCACHE_FILE_SORTRUN);
+            return false;
+        }
+    }
+    else
+    {
+        lseek(sort_runfd, 0, SEEK_SET);
+        ftruncate(sort_runfd, 0);
+    }
+
+    return true;
+}
+
+static void tempbuf_finish_sort(void)
+{
+    if (sort_runfd < 0)
+        return ;
+
+    close(sort_runfd);
+    sort_runfd = -1;
+    remove(TAGCACHE_FILE_SORTRUN);
+}
+
+static bool write_sort_run(struct sortrec *recs, long count)
+{
+    static const char padding[4];
+    long i;
+
+    for (i = 0; i < count; i++)
+    {
+        int len = recs[i].h.length;
+
+        if (!sort_iobuf_put(sort_runfd, &recs[i].h, sizeof(struct sortrec_hdr))
+            || !sort_iobuf_put(sort_runfd, recs[i].str, len)
+            || !sort_iobuf_put(sort_runfd, padding, ALIGN_UP(len, 4) - len))
+            return false;
+    }
+
+    if (!sort_iobuf_flush(sort_runfd))
+        return false;
+
+    sort_run_ofs[++sort_run_count] = lseek(sort_runfd, 0, SEEK_CUR);
+    return true;
+}
+
+/* Sort the collected records and spill them to the run file. */
+static bool tempbuf_flush_sort(void)
+{
+    struct sort_part parts[WORKER_THREADS_MAX];
+    pthread_t threads[WORKER_THREADS_MAX];
+    bool started[WORKER_THREADS_MAX];
+    int nparts = worker_thread_count();
+    long per_part;
+    int i;
+
+    if (sortrec_count == 0)
+        return true;
+
+    if (sortrec_count < nparts * SORT_THREAD_MIN)
+        nparts = 1;
+
+    if (sort_run_count + nparts > SORT_RUNS_MAX)
+    {
+        logf("too many sort runs");
+        return false;
+    }
+
+    per_part = (sortrec_count + nparts - 1) / nparts;
+    for (i = 0; i < nparts; i++)
+    {
+        parts[i].recs = &sortrecs[i * per_part];
+        parts[i].count = MIN(per_part, sortrec_count - i * per_part);
+        parts[i].done = false;
+        started[i] = i > 0 &&
+            pthread_create(&threads[i], NULL, sort_thread, &parts[i]) == 0;
+    }
+
+    /* Sort the first part here and any part a thread couldn't be
+     * created for. */
+    for (i = 0; i < nparts; i++)
+    {
+        if (!started[i])
+            qsort(parts[i].recs, parts[i].count, sizeof(struct sortrec),
+                  compare_yield);
+    }
+
+    for (i = 0; i < nparts; i++)
+    {
+        if (!started[i])
+            continue;
+#ifndef __PCTOOL__
+        /* Let the other threads run while the workers are busy. */
+        while (!parts[i].done)
+            sleep(1);
+#endif
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < nparts; i++)
+    {
+        if (!write_sort_run(parts[i].recs, parts[i].count))
+        {
+            logf("sort run write error");
+            return false;
+        }
+        do_timed_yield();
+    }
+
+    sortrec_count = 0;
+    sortstr = &sortarea[sortarea_size];
+    return true;
+}
+
+static bool tempbuf_insert(char *str, int id, int idx_id, bool unique)
+{
+    struct sortrec *rec;
+    int len = strlen(str) + 1;
+
+    if (id < 0 || id >= lookup_buffer_depth)
+    {
+        logf("lookup buf overf.: %d", id);
+        return false;
+    }
+
+    if ((char *)&sortrecs[sortrec_count + 1] > sortstr - len)
+    {
+        if (!tempbuf_flush_sort())
+            return false;
+    }
+
+    sortstr -= len;
+    memcpy(sortstr, str, len);
+
+    rec = &sortrecs[sortrec_count++];
+    rec->h.id = id;
+    rec->h.idx_id = idx_id;
+    rec->h.seq = sortrec_seq++;
+    rec->h.length = len;
+    rec->str = sortstr;
+    sort_unique = unique;
+
+    return true;
+}
+
+/**
+ * Load the next record of a run.
+ * Returns 1 on success, 0 at the end of the run and -1 on error.
+ */
+static int sort_run_next(struct sort_run *run, int bufsize)
+{
+    int left = run->buf_len - run->buf_pos;
+    struct sortrec_hdr *h = (struct sortrec_hdr *)&run->buf[run->buf_pos];
+
+    if (left < (int)sizeof(struct sortrec_hdr)
+        || left < (int)sizeof(struct sortrec_hdr) + ALIGN_UP(h->length, 4))
+    {
+        /* Move the partial record to the front and load some more. */
+        int amount = MIN(bufsize - left, run->end - run->pos);
+
+        memmove(run->buf, &run->buf[run->buf_pos], left);
+        if (amount > 0)
+        {
+            lseek(sort_runfd, run->pos, SEEK_SET);
+            if (read(sort_runfd, &run->buf[left], amount) != amount)
+                return -1;
+            run->pos += amount;
+        }
+
+        run->buf_len = left + amount;
+        run->buf_pos = 0;
+        left = run->buf_len;
+        h = (struct sortrec_hdr *)run->buf;
+
+        if (left == 0)
+            return 0;
+    }
+
+    if (left < (int)sizeof(struct sortrec_hdr) || h->length <= 0
+        || h->length > TAG_MAXLEN+32
+        || left < (int)sizeof(struct sortrec_hdr) + ALIGN_UP(h->length, 4))
+        return -1;
+
+    run->rec.h = *h;
+    run->rec.str = (char *)(h + 1);
+    run->buf_pos += sizeof(struct sortrec_hdr) + ALIGN_UP(h->length, 4);
+
+    return 1;
+}
+
+static void sort_heap_down(int pos, int count)
+{
+    int run = sort_heap[pos];
+
+    while (pos * 2 + 1 < count)
+    {
+        int child = pos * 2 + 1;
+
+        if (child + 1 < count &&
+            compare_sortrecs(&sort_runs[sort_heap[child + 1]].rec,
+                             &sort_runs[sort_heap[child]].rec) < 0)
+            child++;
+
+        if (compare_sortrecs(&sort_runs[run].rec,
+                             &sort_runs[sort_heap[child]].rec) < 0)
+            break;
+
+        sort_heap[pos] = sort_heap[child];
+        pos = child;
+    }
+
+    sort_heap[pos] = run;
+}
+
+/**
+ * Merge the sorted runs into the index file and fill the seek table.
+ * Returns the number of tags written or < 0 on error.
+ */
+static int tempbuf_sort(int fd)
+{
+    static const char padding[] = "XXXXXXXX";
+    char prev[TAG_MAXLEN+32];
+    long prev_seek = -1;
+    long pos;
+    int bufsize;
+    int count = 0;
+    int nruns = 0;
+    int i, rc;
+
+    if (!tempbuf_flush_sort())
+        return -1;
+
+    if (sort_run_count == 0)
+        return 0;
+
+    /* Give each run an equal share of the (now free) run area. */
+    bufsize = ALIGN_DOWN(sortarea_size / sort_run_count, 4);
+    for (i = 0; i < sort_run_count; i++)
+    {
+        struct sort_run *run = &sort_runs[i];
+
+        run->pos = sort_run_ofs[i];
+        run->end = sort_run_ofs[i+1];
+        run->buf = &sortarea[i * bufsize];
+        run->buf_len = 0;
+        run->buf_pos = 0;
+
+        rc = sort_run_next(run, bufsize);
+        if (rc < 0)
+            return -1;
+        if (rc > 0)
+            sort_heap[nruns++] = i;
+    }
+
+    for (i = nruns / 2 - 1; i >= 0; i--)
+        sort_heap_down(i, nruns);
+
+    pos = lseek(fd, 0, SEEK_CUR);
+    while (nruns > 0)
+    {
+        struct sort_run *run = &sort_runs[sort_heap[0]];
+        struct sortrec *rec = &run->rec;
+
+        if (sort_unique && prev_seek >= 0 && !strcasecmp(prev, rec->str))
+        {
+            /* Duplicate of the previous tag. */
+            seektable[rec->h.id] = prev_seek;
+        }
+        else
+        {
+            struct tagfile_entry fe;
+            int length = rec->h.length;
+            int pad;
+
+            fe.tag_length = length;
+            fe.idx_id = rec->h.idx_id;
+
+            /* Check the chunk alignment. */
+            if ((fe.tag_length + sizeof(struct tagfile_entry))
+                % TAGFILE_ENTRY_CHUNK_LENGTH)
+            {
+                fe.tag_length += TAGFILE_ENTRY_CHUNK_LENGTH -
+                    ((fe.tag_length + sizeof(struct tagfile_entry))
+                     % TAGFILE_ENTRY_CHUNK_LENGTH);
+            }
+
+            seektable[rec->h.id] = pos;
+            prev_seek = pos;
+            memcpy(prev, rec->str, length);
+            pos += sizeof(struct tagfile_entry) + fe.tag_length;
+            pad = fe.tag_length - length;
+
+            structec_convert(&fe, tagfile_entry_ec, 1, tc_stat.econ);
+            if (!sort_iobuf_put(fd, &fe, sizeof(struct tagfile_entry))
+                || !sort_iobuf_put(fd, rec->str, length)
+                || !sort_iobuf_put(fd, padding, pad))
+            {
+                logf("tempbuf_sort: write error");
+                return -2;
+            }
+            count++;
+        }
+
+        rc = sort_run_next(run, bufsize);
+        if (rc < 0)
+        {
+            logf("tempbuf_sort: run read error");
+            return -1;
+        }
+        if (rc == 0)
+            sort_heap[0] = sort_heap[--nruns];
+
+        sort_heap_down(0, nruns);
+        do_timed_yield();
+    }
+
+    if (!sort_iobuf_flush(fd))
+    {
+        logf("tempbuf_sort: write error");
+        return -2;
+    }
+
+    tempbufidx = count;
+    return count;
+}
+
+inline static int tempbuf_find_location(int id)
+{
+    if (id < 0 || id >= lookup_buffer_depth)
+        return -1;
+
+    return seektable[id];
+}
+#endif /* TAGCACHE_EXTERNAL_SORT */
+
+static bool build_numeric_indices(struct tagcache_header *h, int tmpfd)
+{
+    struct master_header tcmh;
+    struct index_entry idx;
+    int masterfd;
+    int masterfd_pos;
     struct temp_file_entry *entrybuf = (struct temp_file_entry *)tempbuf;
     int max_entries;
     int entries_processed = 0;
@@ -2505,9 +3343,20 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     logf("lookup_buffer_depth=%ld", lookup_buffer_depth);
     logf("commit_entry_count=%ld", commit_entry_count);
     
+    tempbufidx = 0;
+#ifdef TAGCACHE_EXTERNAL_SORT
+    /* Only the seek table has to fit in memory, the tags are sorted on
+     * disk. */
+    if (TAGCACHE_IS_SORTED(index_type) && !tempbuf_init_sort())
+    {
+        logf("Buffer way too small!");
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+#else
     /* Allocate buffer for all index entries from both old and new
      * tag files. */
-    tempbufidx = 0;
     tempbuf_pos = commit_entry_count * sizeof(struct tempbuf_searchidx);
 
     /* Allocate lookup buffer. The first portion of commit_entry_count
@@ -2545,6 +3394,7 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
         logf("Buffer way too small!");
         return 0;
     }
+#endif /* TAGCACHE_EXTERNAL_SORT */
 
     if (fd >= 0)
     {
@@ -2949,28 +3799,126 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     return 1;
 }
 
-static bool commit(void)
+/* Hash every filename of the committed database into a table in
+ * tempbuf and write it to TAGCACHE_FILE_PATHHASH. Without enough
+ * memory the file is left out and lookups search the filename tag. */
+static bool build_pathhash_index(const struct master_header *tcmh)
 {
+    struct pathhash_header phdr;
+    struct pathhash_slot *table;
     struct tagcache_header tch;
-    struct master_header   tcmh;
-    int i, len, rc;
-    int tmpfd;
-    int masterfd;
-#ifdef HAVE_DIRCACHE
-    bool dircache_buffer_stolen = false;
-#endif
-#ifdef HAVE_TC_RAMCACHE
-    bool ramcache_buffer_stolen = false;
-#endif
-    logf("committing tagcache");
-    
-    while (write_lock)
-        sleep(1);
+    struct tagfile_entry tfe;
+    char buf[TAG_MAXLEN+32];
+    long entry_count = tcmh->tch.entry_count;
+    int32_t bucket_count = 16;
+    int32_t mask;
+    int fd, namefd;
+    bool ret = false;
 
-    tmpfd = open(TAGCACHE_FILE_TEMP, O_RDONLY);
-    if (tmpfd < 0)
+    /* Keep the table at most half full if there's room for it. */
+    while (bucket_count < entry_count * 2)
+        bucket_count <<= 1;
+
+    while ((size_t)bucket_count * sizeof(struct pathhash_slot) > tempbuf_size
+           && bucket_count / 2 > entry_count + entry_count / 4)
+        bucket_count >>= 1;
+
+    if ((size_t)bucket_count * sizeof(struct pathhash_slot) > tempbuf_size)
     {
-        logf("nothing to commit");
+        logf("no room for the path index");
+        return false;
+    }
+
+    table = (struct pathhash_slot *)tempbuf;
+    memset(table, 0, bucket_count * sizeof(struct pathhash_slot));
+    mask = bucket_count - 1;
+
+    namefd = open_tag_fd(&tch, tag_filename, false);
+    if (namefd < 0)
+        return false;
+
+    for (long pos = sizeof(struct tagcache_header); ; )
+    {
+        int32_t hash, slot;
+
+        if (ecread_tagfile_entry(namefd, &tfe) != sizeof(struct tagfile_entry))
+            break;
+
+        if (tfe.tag_length <= 0 || tfe.tag_length >= (long)sizeof(buf)
+            || read(namefd, buf, tfe.tag_length) != tfe.tag_length)
+        {
+            logf("filename read error at %ld", pos);
+            close(namefd);
+            return false;
+        }
+
+        buf[tfe.tag_length] = '\0';
+        hash = crc_32(buf, strlen(buf), 0xffffffff);
+
+        for (slot = hash & mask; table[slot].seek != 0; slot = (slot + 1) & mask)
+            ;
+
+        table[slot].hash = hash;
+        table[slot].seek = pos;
+
+        pos += sizeof(struct tagfile_entry) + tfe.tag_length;
+        do_timed_yield();
+    }
+
+    close(namefd);
+
+    fd = open(TAGCACHE_FILE_PATHHASH, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        logf("%s open fail", TAGCACHE_FILE_PATHHASH);
+        return false;
+    }
+
+    phdr.magic = TAGCACHE_MAGIC;
+    phdr.commitid = tcmh->commitid;
+    phdr.entry_count = entry_count;
+    phdr.bucket_count = bucket_count;
+
+    if (ecwrite(fd, &phdr, 1, pathhash_header_ec, tc_stat.econ)
+            == sizeof(struct pathhash_header)
+        && ecwrite(fd, table, bucket_count, pathhash_slot_ec, tc_stat.econ)
+            == (ssize_t)(bucket_count * sizeof(struct pathhash_slot)))
+    {
+        ret = true;
+    }
+
+    close(fd);
+    if (!ret)
+    {
+        logf("path index write error");
+        remove(TAGCACHE_FILE_PATHHASH);
+    }
+
+    return ret;
+}
+
+static bool commit(void)
+{
+    struct tagcache_header tch;
+    struct master_header   tcmh;
+    int i, len, rc;
+    int tmpfd;
+    int masterfd;
+#ifdef HAVE_DIRCACHE
+    bool dircache_buffer_stolen = false;
+#endif
+#ifdef HAVE_TC_RAMCACHE
+    bool ramcache_buffer_stolen = false;
+#endif
+    logf("committing tagcache");
+    
+    while (write_lock)
+        sleep(1);
+
+    tmpfd = open(TAGCACHE_FILE_TEMP, O_RDONLY);
+    if (tmpfd < 0)
+    {
+        logf("nothing to commit");
         return true;
     }
     
@@ -3023,7 +3971,7 @@ static bool commit(void)
     }
 #endif /* HAVE_DIRCACHE */
     
-#ifdef HAVE_TC_RAMCACHE
+#if defined(HAVE_TC_RAMCACHE) && !defined(HAVE_TC_RAMCACHE_MMAP)
     if (tempbuf_size == 0 && tc_stat.ramcache_allocated > 0)
     {
         tcrc_buffer_lock();
@@ -3045,6 +3993,9 @@ static bool commit(void)
     
     logf("commit %ld entries...", tch.entry_count);
     
+    /* The path index gets rebuilt for the new master index. */
+    remove(TAGCACHE_FILE_PATHHASH);
+    
     /* Mark DB dirty so it will stay disabled if commit fails. */
     current_tcmh.dirty = true;
     update_master_header();
@@ -3104,6 +4055,8 @@ static bool commit(void)
     ecwrite(masterfd, &tcmh, 1, master_header_ec, tc_stat.econ);
     close(masterfd);
     
+    build_pathhash_index(&tcmh);
+    
     logf("tagcache committed");
     tc_stat.ready = check_all_headers();
     tc_stat.readyvalid = true;
@@ -3125,6 +4078,9 @@ static bool commit(void)
     rc = true;
 
 commit_error:
+#ifdef TAGCACHE_EXTERNAL_SORT
+    tempbuf_finish_sort();
+#endif
 #ifdef HAVE_TC_RAMCACHE
     if (ramcache_buffer_stolen)
     {
@@ -3633,9 +4589,13 @@ static bool delete_entry(long idx_id)
     logf("delete_entry(): %ld", idx_id);
     
 #ifdef HAVE_TC_RAMCACHE
-    /* At first mark the entry removed from ram cache. */
+    /* At first mark the entry removed from ram cache. The tag seeks of the
+     * entry are replaced below, which breaks the postings order. */
     if (tc_stat.ramcache)
+    {
         tcramcache.hdr->indices[idx_id].flag |= FLAG_DELETED;
+        tcramcache.hdr->postings_valid = false;
+    }
 #endif
     
     if ( (masterfd = open_master_fd(&myhdr, true) ) < 0)
@@ -3845,11 +4805,19 @@ static bool check_event_queue(void)
 
 #ifdef HAVE_TC_RAMCACHE
 
+#ifndef HAVE_TC_RAMCACHE_MMAP
 static void fix_ramcache(void* old_addr, void* new_addr)
 {
     ptrdiff_t offpos = new_addr - old_addr;
+    tcramcache.hdr->indices =
+        (struct index_entry *)((char *)tcramcache.hdr->indices + offpos);
     for (int i = 0; i < TAG_COUNT; i++)
+    {
         tcramcache.hdr->tags[i] += offpos;
+        if (tcramcache.hdr->postings[i])
+            tcramcache.hdr->postings[i] =
+                (int32_t *)((char *)tcramcache.hdr->postings[i] + offpos);
+    }
 }
 
 static int move_cb(int handle, void* current, void* new)
@@ -3887,7 +4855,8 @@ static bool allocate_tagcache(void)
      * some extra space for alignment fixes. 
      */
     size_t alloc_size = tcmh.tch.datasize + 256 + TAGCACHE_RESERVE +
-        sizeof(struct ramcache_header) + TAG_COUNT*sizeof(void *);
+        sizeof(struct ramcache_header) + TAG_COUNT*sizeof(void *) +
+        TAGCACHE_POSTINGS_COUNT*tcmh.tch.entry_count*sizeof(int32_t);
 #ifdef HAVE_DIRCACHE
     alloc_size += tcmh.tch.entry_count*sizeof(struct dircache_fileref);
 #endif
@@ -3906,6 +4875,68 @@ static bool allocate_tagcache(void)
 
     return true;
 }
+#else /* HAVE_TC_RAMCACHE_MMAP */
+static void unmap_tagcache(void)
+{
+    for (int i = 0; i <= TAG_COUNT; i++)
+    {
+        if (tcramcache.map[i])
+            munmap(tcramcache.map[i], tcramcache.map_size[i]);
+        tcramcache.map[i] = NULL;
+    }
+
+    if (tcramcache.postings_map)
+        munmap(tcramcache.postings_map, tcramcache.postings_size);
+    tcramcache.postings_map = NULL;
+
+    memset(&tcramcache.maphdr, 0, sizeof(struct ramcache_header));
+}
+
+/* Map a database file privately, so the changes made in ram stay there. */
+static void * map_tagcache_file(int i, const char *path, size_t minsize)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        logf("%s open fail", path);
+        return NULL;
+    }
+
+    off_t size = filesize(fd);
+    void *p = size >= (off_t)minsize ?
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+        MAP_FAILED;
+    close(fd);
+
+    if (p == MAP_FAILED)
+    {
+        logf("%s map fail", path);
+        return NULL;
+    }
+
+    tcramcache.map[i] = p;
+    tcramcache.map_size[i] = size;
+    tc_stat.ramcache_allocated += size;
+
+    return p;
+}
+
+static bool allocate_tagcache(void)
+{
+    /* Nothing to allocate, the files are mapped when loading. */
+    struct master_header tcmh;
+    int fd = open_master_fd(&tcmh, false);
+    if (fd < 0)
+        return false;
+
+    close(fd);
+
+    tcramcache.hdr = &tcramcache.maphdr;
+    memcpy(&current_tcmh, &tcmh, sizeof current_tcmh);
+
+    return true;
+}
+#endif /* HAVE_TC_RAMCACHE_MMAP */
 
 #ifdef HAVE_EEPROM_SETTINGS
 static bool tagcache_dumpload(void)
@@ -4000,6 +5031,80 @@ static bool tagcache_dumpsave(void)
 }
 #endif /* HAVE_EEPROM_SETTINGS */
 
+/* Tag the postings lists are currently being sorted by. */
+static int postings_tag;
+
+static int compare_postings(const void *p1, const void *p2)
+{
+    int32_t id1 = *(const int32_t *)p1;
+    int32_t id2 = *(const int32_t *)p2;
+    int32_t seek1 = tcramcache.hdr->indices[id1].tag_seek[postings_tag];
+    int32_t seek2 = tcramcache.hdr->indices[id2].tag_seek[postings_tag];
+
+    do_timed_yield();
+
+    if (seek1 != seek2)
+        return seek1 < seek2 ? -1 : 1;
+
+    return id1 < id2 ? -1 : 1;
+}
+
+/**
+ * Build the inverted index of the filter tags: for each tag the idx_ids
+ * of all present entries sorted by tag seek, so that the entries having
+ * a given tag form a range of ascending idx_ids. Filtered searches walk
+ * only that range instead of the whole index (see build_lookup_list()).
+ *
+ * The lists are optional, if they don't fit they are simply skipped.
+ * Returns false only if loading should be aborted.
+ */
+static bool build_postings(char **pp, ssize_t *bytesleftp)
+{
+    ssize_t rc;
+    char *p = TC_ALIGN_PTR(*pp, int32_t, &rc);
+    int32_t *list = (int32_t *)p;
+    int count = 0;
+
+    if (*bytesleftp - rc < (ssize_t)(TAGCACHE_POSTINGS_COUNT *
+                           current_tcmh.tch.entry_count * sizeof(int32_t)))
+    {
+        logf("no room for postings");
+        return true;
+    }
+
+    for (int i = 0; i < current_tcmh.tch.entry_count; i++)
+    {
+        if (!(tcramcache.hdr->indices[i].flag & FLAG_DELETED))
+            list[count++] = i;
+    }
+
+    for (int tag = 0; tag < TAG_COUNT; tag++)
+    {
+        if (!TAGCACHE_HAS_POSTINGS(tag))
+            continue;
+
+        if (list != (int32_t *)p)
+            memcpy(list, p, count * sizeof(int32_t));
+
+        postings_tag = tag;
+        qsort(list, count, sizeof(int32_t), compare_postings);
+        tcramcache.hdr->postings[tag] = list;
+        list += count;
+
+        if (check_event_queue())
+            return false;
+    }
+
+    tcramcache.hdr->postings_count = count;
+    tcramcache.hdr->postings_valid = true;
+
+    *bytesleftp -= (char *)list - *pp;
+    *pp = (char *)list;
+
+    return true;
+}
+
+#ifndef HAVE_TC_RAMCACHE_MMAP
 static bool load_tagcache(void)
 {
     /* DEBUG: After tagcache commit and dircache rebuild, hdr-sturcture
@@ -4019,7 +5124,11 @@ static bool load_tagcache(void)
     logf("loading tagcache to ram...");
 
     tcrc_buffer_lock(); /* lock for the rest of the scan, simpler to handle */
-    
+
+    tcramcache.hdr->postings_valid = false;
+    memset(tcramcache.hdr->postings, 0, sizeof(tcramcache.hdr->postings));
+    tcramcache.hdr->indices = (struct index_entry *)(tcramcache.hdr + 1);
+
     fd = open(TAGCACHE_FILE_MASTER, O_RDONLY);
     if (fd < 0)
     {
@@ -4239,7 +5348,11 @@ static bool load_tagcache(void)
 
         close(fd);
     }
-    
+
+    fd = -1;
+    if (!build_postings(&p, &bytesleft))
+        goto failure;
+
     tc_stat.ramcache_used = tc_stat.ramcache_allocated - bytesleft;
     logf("tagcache loaded into ram!");
     logf("utilization: %d%%", 100*tc_stat.ramcache_used / tc_stat.ramcache_allocated);
@@ -4253,6 +5366,138 @@ failure:
     tcrc_buffer_unlock();
     return ok;
 }
+#else /* HAVE_TC_RAMCACHE_MMAP */
+/**
+ * Map the master index and the tag files instead of reading them in. The
+ * data is then shared with the page cache and paged in on demand, so the
+ * database doesn't need to fit the buffer and nothing is copied at boot.
+ * The mappings are private: runtime changes to the ramcache (numeric
+ * data, deleted entries) are done in ram like with a loaded ramcache and
+ * written to the files separately, as usual.
+ */
+static bool load_tagcache(void)
+{
+    char buf[MAX_PATH];
+    ssize_t bytesleft;
+    char *p;
+
+    logf("mapping tagcache...");
+
+    /* Searches in progress may still use the old mappings. */
+    tc_stat.ramcache = false;
+    while (write_lock)
+        sleep(1);
+
+    unmap_tagcache();
+    tc_stat.ramcache_allocated = 0;
+    tcramcache.hdr = &tcramcache.maphdr;
+
+    if (tc_stat.econ)
+    {
+        logf("can't map a foreign endian db");
+        goto failure;
+    }
+
+    struct master_header *tcmh = map_tagcache_file(TAG_COUNT,
+        TAGCACHE_FILE_MASTER, sizeof(struct master_header));
+    if (tcmh == NULL)
+        goto failure;
+
+    if (tcmh->tch.magic != TAGCACHE_MAGIC
+        || tcramcache.map_size[TAG_COUNT] < sizeof(struct master_header)
+            + tcmh->tch.entry_count * sizeof(struct index_entry))
+    {
+        logf("incorrect header");
+        goto failure;
+    }
+
+    current_tcmh = *tcmh;
+    tcramcache.hdr->indices = (struct index_entry *)(tcmh + 1);
+
+    for (int tag = 0; tag < TAG_COUNT; tag++)
+    {
+        if (TAGCACHE_IS_NUMERIC(tag))
+            continue;
+
+        snprintf(buf, sizeof buf, TAGCACHE_FILE_INDEX, tag);
+        struct tagcache_header *tch = map_tagcache_file(tag, buf,
+            sizeof(struct tagcache_header));
+        if (tch == NULL)
+            goto failure;
+
+        if (tch->magic != TAGCACHE_MAGIC
+            || tcramcache.map_size[tag] < sizeof(struct tagcache_header)
+                                          + tch->datasize)
+        {
+            logf("incorrect header #%d", tag);
+            goto failure;
+        }
+
+        tcramcache.hdr->tags[tag] = (char *)tch;
+        tcramcache.hdr->entry_count[tag] = tch->entry_count;
+    }
+
+    /* Drop the entries of removed files, like loading the ramcache does. */
+    for (int i = 0; global_settings.tagcache_autoupdate
+                    && i < current_tcmh.tch.entry_count; i++)
+    {
+        struct index_entry *idx = &tcramcache.hdr->indices[i];
+        long seek = idx->tag_seek[tag_filename];
+        struct tagfile_entry *fe;
+
+        if (do_timed_yield() && check_event_queue())
+            goto failure;
+
+        if (idx->flag & FLAG_DELETED)
+            continue;
+
+        fe = (struct tagfile_entry *)&tcramcache.hdr->tags[tag_filename][seek];
+        if (seek < (long)sizeof(struct tagcache_header)
+            || seek + sizeof(struct tagfile_entry) + fe->tag_length
+                > tcramcache.map_size[tag_filename]
+            || fe->tag_length <= 0
+            || strnlen(fe->tag_data, fe->tag_length) >= (size_t)fe->tag_length)
+        {
+            logf("corrupt filename entry:idxid=%d", i);
+            goto failure;
+        }
+
+        if (!file_exists(fe->tag_data))
+        {
+            logf("Entry no longer valid.");
+            logf("-> %s", fe->tag_data);
+            delete_entry(i);
+            idx->flag |= FLAG_DELETED;
+        }
+    }
+
+    /* The postings lists need writable memory of their own. */
+    tcramcache.postings_size = TAGCACHE_POSTINGS_COUNT *
+        MAX(current_tcmh.tch.entry_count, 1) * sizeof(int32_t);
+    p = mmap(NULL, tcramcache.postings_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        logf("postings map fail");
+        goto failure;
+    }
+
+    tcramcache.postings_map = p;
+    bytesleft = tcramcache.postings_size;
+    if (!build_postings(&p, &bytesleft))
+        goto failure;
+
+    tc_stat.ramcache_allocated += tcramcache.postings_size;
+    tc_stat.ramcache_used = tc_stat.ramcache_allocated - bytesleft;
+    logf("tagcache mapped: %d bytes", tc_stat.ramcache_allocated);
+
+    return true;
+
+failure:
+    unmap_tagcache();
+    return false;
+}
+#endif /* HAVE_TC_RAMCACHE_MMAP */
 #endif /* HAVE_TC_RAMCACHE */
 
 static bool check_deleted_files(void)
@@ -4443,6 +5688,242 @@ static int free_search_roots(struct search_roots_ll * start)
 #define free_search_roots(a) do {} while(0)
 #endif
 
+#ifdef TAGCACHE_PARALLEL_SCAN
+/*
+ * Pipelined scan. check_dir() walks the directories and checks every file
+ * against the database as before, then queues the files that need their
+ * metadata read. The reader threads run get_metadata() into the mp3entry
+ * of the queue slot, and the scanning thread writes the finished slots to
+ * the temporary db file in queue order, so the result is the same as with
+ * a serial scan.
+ *
+ * Only the scanning thread opens and closes files, a queued file keeps
+ * its descriptor until it's written.
+ */
+#ifdef APPLICATION
+#define SCAN_QUEUE_DEPTH  32
+#else
+/* The simulated file system has only MAX_OPEN_FILES descriptors. Leave
+ * two for the temp file and the filename tag, and two for looking up the
+ * files in the database. */
+#define SCAN_QUEUE_DEPTH  (MAX_OPEN_FILES - 4)
+#endif
+
+enum scan_slot_state
+{
+    SCAN_SLOT_QUEUED = 0,
+    SCAN_SLOT_BUSY,
+    SCAN_SLOT_DONE,
+};
+
+struct scan_slot
+{
+    struct mp3entry id3;
+    char path[TAG_MAXLEN+1];
+    unsigned long mtime;
+    int fd;
+    bool ok;
+    enum scan_slot_state state; /* Protected by scan_lock */
+};
+
+static struct scan_slot scan_slots[SCAN_QUEUE_DEPTH];
+static unsigned int scan_head; /* Next slot to write */
+static unsigned int scan_next; /* Next slot for a reader */
+static unsigned int scan_tail; /* Next slot to queue */
+static bool scan_quit;
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scan_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t scan_threads[WORKER_THREADS_MAX];
+static uint64_t scan_start_us;
+
+static uint64_t scan_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void * scan_thread(void *data)
+{
+    (void)data;
+
+    pthread_mutex_lock(&scan_lock);
+
+    while (true)
+    {
+        while (!scan_quit && scan_next == scan_tail)
+            pthread_cond_wait(&scan_queued_cond, &scan_lock);
+
+        if (scan_next == scan_tail)
+            break;
+
+        struct scan_slot *slot = &scan_slots[scan_next++ % SCAN_QUEUE_DEPTH];
+        slot->state = SCAN_SLOT_BUSY;
+        pthread_mutex_unlock(&scan_lock);
+
+        uint64_t start = scan_time_us();
+        memset(&slot->id3, 0, sizeof(struct mp3entry));
+        slot->ok = get_metadata(&slot->id3, slot->fd, slot->path);
+        uint64_t elapsed = scan_time_us() - start;
+
+        pthread_mutex_lock(&scan_lock);
+        tc_stat.scan.read_us += elapsed;
+        tc_stat.scan.read++;
+        slot->state = SCAN_SLOT_DONE;
+        pthread_cond_signal(&scan_done_cond);
+    }
+
+    pthread_mutex_unlock(&scan_lock);
+    return NULL;
+}
+
+/* Write the finished slots at the head of the queue. Waits for the
+ * readers if the queue is full, or until it's empty if all is set. */
+static void scan_write(bool all)
+{
+    while (scan_head != scan_tail)
+    {
+        struct scan_slot *slot = &scan_slots[scan_head % SCAN_QUEUE_DEPTH];
+        uint64_t start = scan_time_us();
+
+        pthread_mutex_lock(&scan_lock);
+        while (slot->state != SCAN_SLOT_DONE)
+        {
+            if (!all && scan_tail - scan_head < SCAN_QUEUE_DEPTH)
+            {
+                pthread_mutex_unlock(&scan_lock);
+                return ;
+            }
+
+#ifdef __PCTOOL__
+            pthread_cond_wait(&scan_done_cond, &scan_lock);
+#else
+            /* Don't hold up the other threads for longer than a moment
+             * while the readers are busy. */
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 1000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&scan_done_cond, &scan_lock, &ts);
+            pthread_mutex_unlock(&scan_lock);
+            yield();
+            pthread_mutex_lock(&scan_lock);
+#endif
+        }
+        pthread_mutex_unlock(&scan_lock);
+
+        uint64_t ready = scan_time_us();
+        tc_stat.scan.stall_us += ready - start;
+
+        close(slot->fd);
+        if (slot->ok)
+        {
+            int size = data_size;
+
+            add_tagcache_entry(&slot->id3, slot->path, slot->mtime);
+            tc_stat.scan.written++;
+            tc_stat.scan.written_bytes += sizeof(struct temp_file_entry)
+                                          + data_size - size;
+        }
+
+        scan_head++;
+        tc_stat.scan.write_us += scan_time_us() - ready;
+    }
+}
+
+/* Queue a file found by check_dir() for the readers. */
+static void scan_queue(const char *path, unsigned long mtime)
+{
+    struct scan_slot *slot;
+    int fd;
+
+    if (!check_tagcache_file(path, mtime))
+        return ;
+
+    /* Make room for it. */
+    scan_write(false);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        logf("open fail: %s", path);
+        return ;
+    }
+
+    slot = &scan_slots[scan_tail % SCAN_QUEUE_DEPTH];
+    strlcpy(slot->path, path, sizeof(slot->path));
+    slot->mtime = mtime;
+    slot->fd = fd;
+
+    pthread_mutex_lock(&scan_lock);
+    slot->state = SCAN_SLOT_QUEUED;
+    scan_tail++;
+    pthread_cond_signal(&scan_queued_cond);
+    pthread_mutex_unlock(&scan_lock);
+}
+
+/* Start the reader threads. Returns false if the scan has to be done
+ * serially. */
+static bool scan_start(void)
+{
+    int count = worker_thread_count();
+
+    memset(&tc_stat.scan, 0, sizeof(tc_stat.scan));
+    scan_start_us = scan_time_us();
+    scan_head = scan_next = scan_tail = 0;
+    scan_quit = false;
+
+    if (count < 2)
+        return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (pthread_create(&scan_threads[i], NULL, scan_thread, NULL) != 0)
+            break;
+        tc_stat.scan.threads++;
+    }
+
+    if (tc_stat.scan.threads == 0)
+        return false;
+
+    return true;
+}
+
+/* Write out the rest of the queue and stop the reader threads. */
+static void scan_stop(void)
+{
+    scan_write(true);
+
+    pthread_mutex_lock(&scan_lock);
+    scan_quit = true;
+    pthread_cond_broadcast(&scan_queued_cond);
+    pthread_mutex_unlock(&scan_lock);
+
+    for (int i = 0; i < tc_stat.scan.threads; i++)
+        pthread_join(scan_threads[i], NULL);
+
+    tc_stat.scan.walked = processed_dir_count;
+    tc_stat.scan.total_us = scan_time_us() - scan_start_us;
+
+    logf("scan: %ld entries, %ld read by %d threads, %ld written",
+         tc_stat.scan.walked, tc_stat.scan.read, tc_stat.scan.threads,
+         tc_stat.scan.written);
+    logf("scan: total %ld ms, read %ld ms, write %ld ms, stall %ld ms",
+         (long)(tc_stat.scan.total_us / 1000),
+         (long)(tc_stat.scan.read_us / 1000),
+         (long)(tc_stat.scan.write_us / 1000),
+         (long)(tc_stat.scan.stall_us / 1000));
+}
+
+static bool scan_threaded = false;
+#endif /* TAGCACHE_PARALLEL_SCAN */
+
 static bool check_dir(const char *dirname, int add_files)
 {
     int success = false;
@@ -4497,7 +5978,12 @@ static bool check_dir(const char *dirname, int add_files)
             tc_stat.curentry = curpath;
             
             /* Add a new entry to the temporary db file. */
-            add_tagcache(curpath, info.mtime);
+#ifdef TAGCACHE_PARALLEL_SCAN
+            if (scan_threaded)
+                scan_queue(curpath, info.mtime);
+            else
+#endif
+                add_tagcache(curpath, info.mtime);
             
             /* Wait until current path for debug screen is read and unset. */
             while (tc_stat.syncscreen && tc_stat.curentry != NULL)
@@ -4540,6 +6026,8 @@ void do_tagcache_build(const char *path[])
     
 #ifdef HAVE_DIRCACHE
     dircache_wait();
+    /* the scan covers whatever dircache has seen change so far */
+    dircache_clear_changes();
 #endif
     
     logf("updating tagcache");
@@ -4584,6 +6072,10 @@ void do_tagcache_build(const char *path[])
         j++;
     }
 
+#ifdef TAGCACHE_PARALLEL_SCAN
+    scan_threaded = scan_start();
+#endif
+
     struct search_roots_ll * this;
     /* check_dir might add new roots */
     for(this = &roots_ll[0]; this; this = this->next)
@@ -4593,6 +6085,14 @@ void do_tagcache_build(const char *path[])
     }
     free_search_roots(&roots_ll[0]);
 
+#ifdef TAGCACHE_PARALLEL_SCAN
+    if (scan_threaded)
+    {
+        scan_stop();
+        scan_threaded = false;
+    }
+#endif
+
     /* Write the header. */
     header.magic = TAGCACHE_MAGIC;
     header.datasize = data_size;
@@ -4625,6 +6125,10 @@ void do_tagcache_build(const char *path[])
 #ifdef __PCTOOL__
     free_tempbuf();
 #endif
+#ifdef HAVE_DIRCACHE
+    /* commit borrows the dircache buffer, which drops its change journal */
+    dircache_clear_changes();
+#endif
     
 #ifdef HAVE_TC_RAMCACHE
     if (tcramcache.hdr)
@@ -4669,9 +6173,13 @@ static void load_ramcache(void)
          * so disable it entirely to prevent further issues. */
         tc_stat.ready = false;
         tcramcache.hdr = NULL;
+#ifdef HAVE_TC_RAMCACHE_MMAP
+        unmap_tagcache();
+#else
         int handle = tcramcache.handle;
         tcramcache.handle = 0;
         core_free(handle);
+#endif
     }
     
     cpu_boost(false);
@@ -4685,6 +6193,189 @@ void tagcache_unload_ramcache(void)
 }
 #endif /* HAVE_TC_RAMCACHE */
 
+#if defined(HAVE_DIRCACHE) && !defined(__PCTOOL__)
+/* Check if a full scan would pick up the file: it has to be below one of the
+ * scan paths and not excluded by database.ignore on the way down. */
+static bool is_scanned_path(const char *path)
+{
+    char *vect[MAX_STATIC_ROOTS + 1];
+    char str[sizeof(global_settings.tagcache_scan_paths)];
+    char dirname[MAX_PATH];
+    const char *p = NULL;
+
+    strlcpy(str, global_settings.tagcache_scan_paths, sizeof(str));
+    int count = split_string(str, ':', vect, MAX_STATIC_ROOTS);
+
+    for (int i = 0; i < count && !p; i++)
+    {
+        size_t len = strlen(vect[i]);
+        while (len > 0 && vect[i][len-1] == '/')
+            len--;
+
+        if (!strncmp(vect[i], path, len) && path[len] == '/')
+            p = path + len;
+    }
+
+    if (!p)
+        return false;
+
+    int ignore, unignore;
+    bool add_files = true;
+
+    for (; p; p = strchr(p + 1, '/'))
+    {
+        size_t len = p - path;
+        if (len >= sizeof(dirname))
+            return false;
+
+        memcpy(dirname, path, len);
+        dirname[len] = '\0';
+
+        check_ignore(dirname, &ignore, &unignore);
+        if (ignore != unignore)
+            add_files = unignore;
+    }
+
+    return add_files;
+}
+
+/* Patch the database with the files dircache saw change since the last
+ * update instead of walking the whole tree. Removed files are marked deleted
+ * in the master index right away, new and modified ones go through the
+ * temporary file and a commit. Returns false if changes were missed and a
+ * full update is needed. */
+static bool update_changed_files(void)
+{
+    struct tagcache_header header;
+    struct dircache_change chg;
+    bool aborted = false;
+    int rc;
+
+    if (file_exists(TAGCACHE_FILE_TEMP))
+    {
+        logf("skipping, cache already waiting for commit");
+        return true;
+    }
+
+    cachefd = -1;
+    data_size = 0;
+    total_entry_count = 0;
+
+    while ((rc = dircache_get_change(&chg)) > 0)
+    {
+        if (probe_file_format(chg.path) == AFMT_UNKNOWN)
+            continue;
+
+        if (chg.type == DCC_REMOVED)
+        {
+            int idx_id = find_index(chg.path);
+            if (idx_id >= 0)
+            {
+                logf("removed: %s", chg.path);
+                delete_entry(idx_id);
+            }
+            continue;
+        }
+
+        if (!is_scanned_path(chg.path))
+            continue;
+
+        if (cachefd < 0)
+        {
+            cachefd = open(TAGCACHE_FILE_TEMP, O_RDWR | O_CREAT | O_TRUNC, 0666);
+            if (cachefd < 0)
+            {
+                logf("master file open failed: %s", TAGCACHE_FILE_TEMP);
+                return false;
+            }
+
+            filenametag_fd = open_tag_fd(&header, tag_filename, false);
+
+            memset(&header, 0, sizeof(struct tagcache_header));
+            write(cachefd, &header, sizeof(struct tagcache_header));
+        }
+
+        /* an existing entry with a different mtime is replaced */
+        tc_stat.curentry = chg.path;
+        add_tagcache(chg.path, chg.mtime);
+        tc_stat.curentry = NULL;
+
+        if (check_event_queue())
+        {
+            aborted = true;
+            break;
+        }
+    }
+
+    if (cachefd >= 0)
+    {
+        header.magic = TAGCACHE_MAGIC;
+        header.datasize = data_size;
+        header.entry_count = total_entry_count;
+        lseek(cachefd, 0, SEEK_SET);
+        write(cachefd, &header, sizeof(struct tagcache_header));
+        close(cachefd);
+        cachefd = -1;
+
+        if (filenametag_fd >= 0)
+        {
+            close(filenametag_fd);
+            filenametag_fd = -1;
+        }
+
+        /* like an interrupted scan, leave it to be committed at boot */
+        if (aborted)
+            return true;
+
+        cpu_boost(true);
+        commit();
+        cpu_boost(false);
+
+        /* commit borrows the dircache buffer, which drops its change
+           journal */
+        dircache_clear_changes();
+    }
+
+    return rc >= 0;
+}
+
+/* Run an incremental update once the file system has been quiet for a
+ * while, so a batch of copies costs one commit */
+static void check_changed_files(void)
+{
+    struct dircache_info info;
+    long tick;
+
+    if (!global_settings.tagcache_autoupdate)
+        return;
+
+    int pending = dircache_changes_pending(&tick);
+    if (pending == 0 || TIME_BEFORE(current_tick, tick + TAGCACHE_CHANGES_DELAY))
+        return;
+
+    dircache_get_info(&info);
+    if (info.status != DIRCACHE_READY)
+        return;
+
+    logf("%d file changes", pending);
+
+    if (pending < 0 || !update_changed_files())
+    {
+        logf("changes missed, full update");
+        tagcache_build();
+        check_deleted_files();
+    }
+
+#ifdef HAVE_TC_RAMCACHE
+    /* commit asks for a rescan to reload the ram cache, which would also run
+       a full update; just reload it */
+    queue_remove_from_head(&tagcache_queue, Q_START_SCAN);
+    if (!tc_stat.ramcache)
+        load_ramcache();
+#endif
+}
+#endif /* HAVE_DIRCACHE && !__PCTOOL__ */
+
 #ifndef __PCTOOL__
 static void tagcache_thread(void)
 {
@@ -4754,6 +6445,10 @@ static void tagcache_thread(void)
             case Q_START_SCAN:
                 check_done = false;
             case SYS_TIMEOUT:
+#ifdef HAVE_DIRCACHE
+                if (check_done && tc_stat.ready)
+                    check_changed_files();
+#endif
                 if (check_done || !tc_stat.ready)
                     break ;
                 
@@ -4819,6 +6514,8 @@ void tagcache_shutdown(void)
 #endif
 }
 
+#endif /* !__PCTOOL__ */
+
 static int get_progress(void)
 {
     int total_count = -1;
@@ -4857,6 +6554,7 @@ struct tagcache_stat* tagcache_get_stat(void)
     return &tc_stat;
 }
 
+#ifndef __PCTOOL__
 void tagcache_start_scan(void)
 {
     queue_post(&tagcache_queue, Q_START_SCAN, 0);
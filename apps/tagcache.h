@@ -55,7 +55,7 @@ enum tag_type { tag_artist = 0, tag_album, tag_genre, tag_title,
 #define TAGCACHE_MAGIC  0x5443480f
 
 /* Dump store/restore header version 'TCSxx'. */
-#define TAGCACHE_STATEFILE_MAGIC 0x54435301
+#define TAGCACHE_STATEFILE_MAGIC 0x54435303
 
 /* How much to allocate extra space for ramcache. */
 #define TAGCACHE_RESERVE 32768
@@ -79,6 +79,13 @@ enum tag_type { tag_artist = 0, tag_album, tag_genre, tag_title,
 #define TAGCACHE_COMMAND_QUEUE_LENGTH 32
 /* Idle time before committing events in the command queue. */
 #define TAGCACHE_COMMAND_QUEUE_COMMIT_DELAY  HZ*2
+/* File system idle time before applying file changes seen by dircache. */
+#define TAGCACHE_CHANGES_DELAY  HZ*5
+
+#if (defined(__PCTOOL__) || defined(APPLICATION)) && !defined(WIN32)
+/* Metadata of the scanned files is read by a pool of threads. */
+#define TAGCACHE_PARALLEL_SCAN
+#endif
 
 #define TAGCACHE_MAX_FILTERS 4
 #define TAGCACHE_MAX_CLAUSES 32
@@ -88,12 +95,18 @@ enum tag_type { tag_artist = 0, tag_album, tag_genre, tag_title,
 /* Temporary database containing new tags to be committed to the main db. */
 #define TAGCACHE_FILE_TEMP       ROCKBOX_DIR "/database_tmp.tcd"
 
+/* Sorted runs spilled while committing on hosted builds. */
+#define TAGCACHE_FILE_SORTRUN    ROCKBOX_DIR "/database_run.tmp"
+
 /* The main database master index and numeric data. */
 #define TAGCACHE_FILE_MASTER     ROCKBOX_DIR "/database_idx.tcd"
 
 /* The main database string data. */
 #define TAGCACHE_FILE_INDEX      ROCKBOX_DIR "/database_%d.tcd"
 
+/* Hash table of the filenames for finding entries by path. */
+#define TAGCACHE_FILE_PATHHASH   ROCKBOX_DIR "/database_path.tcd"
+
 /* ASCII dumpfile of the DB contents. */
 #define TAGCACHE_FILE_CHANGELOG  ROCKBOX_DIR "/database_changelog.txt"
 
@@ -128,6 +141,21 @@ enum clause { clause_none, clause_is, clause_is_not, clause_gt, clause_gteq,
     clause_begins_with, clause_not_begins_with, clause_ends_with,
     clause_not_ends_with, clause_oneof, clause_logical_or };
 
+#ifdef TAGCACHE_PARALLEL_SCAN
+/* Stages of the last disk scan. Times are in microseconds. */
+struct tagcache_scan_stat {
+    int  threads;            /* Metadata reader threads */
+    long walked;             /* Directory entries walked */
+    long read;               /* Files read by the reader threads */
+    long written;            /* Entries written to the temp file */
+    long written_bytes;      /* Bytes written to the temp file */
+    uint64_t total_us;       /* Duration of the whole scan */
+    uint64_t read_us;        /* Reader busy time, all threads together */
+    uint64_t write_us;       /* Time spent writing the temp file */
+    uint64_t stall_us;       /* Time the walker waited for the readers */
+};
+#endif
+
 struct tagcache_stat {
     bool initialized;        /* Is tagcache currently busy? */
     bool readyvalid;         /* Has tagcache ready status been ascertained */
@@ -144,6 +172,9 @@ struct tagcache_stat {
     volatile const char 
         *curentry;           /* Path of the current entry being scanned. */
     volatile bool syncscreen;/* Synchronous operation with debug screen? */
+#ifdef TAGCACHE_PARALLEL_SCAN
+    struct tagcache_scan_stat scan; /* Throughput of the scan stages */
+#endif
     // const char *uimessage;   /* Pending error message. Implement soon. */
 };
 
@@ -243,9 +274,7 @@ void tagcache_screensync_event(void);
 void tagcache_screensync_enable(bool state);
 
 #ifdef HAVE_TC_RAMCACHE
-#ifdef HAVE_DIRCACHE
 bool tagcache_fill_tags(struct mp3entry *id3, const char *filename);
-#endif
 void tagcache_unload_ramcache(void);
 #endif
 void tagcache_init(void) INIT_ATTR;
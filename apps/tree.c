@@ -1189,9 +1189,6 @@ void tree_flush(void)
 
 #ifdef HAVE_DIRCACHE
     int old_val = global_status.dircache_size;
-#ifdef HAVE_EEPROM_SETTINGS
-    bool savecache = false;
-#endif
 
     if (global_settings.dircache)
     {
@@ -1201,9 +1198,6 @@ void tree_flush(void)
         dircache_get_info(&info);
 
         global_status.dircache_size = info.last_size;
-    #ifdef HAVE_EEPROM_SETTINGS
-        savecache = firmware_settings.initialized;
-    #endif            
     }
     else
     {
@@ -1212,11 +1206,6 @@ void tree_flush(void)
 
     if (old_val != global_status.dircache_size)
         status_save();
-
-    #ifdef HAVE_EEPROM_SETTINGS
-        if (savecache)
-            dircache_save();
-    #endif
 #endif /* HAVE_DIRCACHE */
 }
 
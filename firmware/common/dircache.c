@@ -212,7 +212,7 @@ static struct dircache
     size_t       sizeused;            /* bytes of .size bytes actually used */
     union {
     unsigned int numentries;          /* entry count (including holes) */
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
     size_t       sizeentries;         /* used when persisting */
 #endif
     };
@@ -256,6 +256,9 @@ static struct dircache_runinfo
     unsigned char         *pname;  /* alias of .p to assist name resolution */
     };
     struct buflib_callbacks ops;   /* buflib ops callbacks */
+#ifdef DIRCACHE_SNAPSHOT
+    dc_serial_t  unverified;       /* last serial number of loaded snapshot */
+#endif
     /* per-volume data */
     struct dircache_runinfo_volume
     {
@@ -291,11 +294,60 @@ static struct dircache_runinfo
 #define DCRIVOL_bindp(bindp)     (&dircache_runinfo.dcrivol[BASEBINDING_VOL(bindp)])
 #define DCRIVOL(x)               DCRIVOL_##x(x)
 
+#ifdef DIRCACHE_NATIVE
+#define ENTRY_MTIME(p) fattime_mktime((p)->wrtdate, (p)->wrttime)
+#else
+#define ENTRY_MTIME(p) ((p)->mtime)
+#endif
+
+#ifdef DIRCACHE_NAME_INDEX
+/* hash index of entries keyed by parent index and case-folded name; open
+   addressing with linear probing */
+static struct dircache_index
+{
+    int            handle;      /* buflib handle of the table */
+    int            *table;      /* 0 = empty, INDEX_DELETED or entry index */
+    unsigned int   slots;       /* size of table (power of 2) */
+    unsigned int   used;        /* slots holding an entry */
+    unsigned int   deleted;     /* slots holding a tombstone */
+    bool           valid;       /* has every linked entry (that it can) */
+    unsigned long  hits;        /* lookups that found the entry */
+    unsigned long  absent;      /* lookups that proved it absent */
+    unsigned long  passed;      /* lookups left to the directory scan */
+    struct buflib_callbacks ops; /* buflib ops callbacks */
+} dcindex;
+
+#define INDEX_DELETED   (-1)
+#define INDEX_MIN_SLOTS 1024
+#endif /* DIRCACHE_NAME_INDEX */
+
+/* change journal; records are only added with writer exclusion and the ring
+   is allocated along with the cache buffer */
+static struct dircache_journal
+{
+    unsigned int head;          /* sequence number of the next record */
+    unsigned int read;          /* sequence number of the next unread one */
+    bool         lost;          /* records were dropped since last read */
+    long         tick;          /* time of the last record */
+    int          handle;        /* buflib handle of the ring */
+    struct dircache_change *ring; /* DIRCACHE_JOURNAL_SIZE records */
+    struct buflib_callbacks ops; /* buflib ops callbacks */
+} journal;
+
+#define JOURNAL_RECORD(seq) (&journal.ring[(seq) & (DIRCACHE_JOURNAL_SIZE-1)])
+
+static void journal_record(int idx, enum dircache_change_type type,
+                           time_t mtime);
+static void journal_invalidate(void);
+static int journal_alloc(void);
+static void journal_set_buffer(int handle);
+static int journal_reset_buffer(void);
+
 /* reserve over 75% full? */
 #define DIRCACHE_STUFFED(reserve_used) \
     ((reserve_used) > 3*DIRCACHE_RESERVE / 4)
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
 /**
  * remove the snapshot file
  */
@@ -311,7 +363,7 @@ static int open_dircache_file(int oflag)
 {
     return open(DIRCACHE_FILE, oflag, 0666);
 }
-#endif /* HAVE_EEPROM_SETTINGS */
+#endif /* DIRCACHE_SNAPSHOT */
 
 #ifdef DIRCACHE_DUMPSTER
 /**
@@ -628,6 +680,20 @@ static uint32_t get_frontier(int idx)
         return get_idx_dcvolp(idx)->frontier;
 }
 
+#ifdef DIRCACHE_SNAPSHOT
+/**
+ * is this an entry from a loaded snapshot that has yet to be compared with
+ * the storage? only the scan settling its parent directory vouches for it.
+ */
+static bool entry_unverified(const struct dircache_entry *ce)
+{
+    return ce->serialnum <= dircache_runinfo.unverified &&
+           get_frontier(ce->up) != FRONTIER_SETTLED;
+}
+#else
+#define entry_unverified(ce) false
+#endif /* DIRCACHE_SNAPSHOT */
+
 /**
  *  return the sublist down pointer for the sublist that contains entry 'idx'
  */
@@ -758,6 +824,24 @@ static void entry_name_copy(char *dst, const struct dircache_entry *ce)
     *dst = '\0';
 }
 
+/**
+ * compare the entry's name with a string
+ */
+static bool entry_name_equals(const struct dircache_entry *ce,
+                              const char *name)
+{
+    size_t len = strlen(name);
+
+    if (LIKELY(!ce->tinyname))
+    {
+        return CE_NAMESIZE(ce->namelen) == len &&
+               !memcmp(get_name(ce->name), name, len);
+    }
+
+    return len <= MAX_TINYNAME &&
+           !strncmp((const char *)ce->namebuf, name, MAX_TINYNAME);
+}
+
 /**
  * set the namesfree hint to a new position
  */
@@ -959,6 +1043,246 @@ static int entry_reassign_name(struct dircache_entry *ce,
     return entry_assign_name(ce, newname, newlen);
 }
 
+#ifdef DIRCACHE_NAME_INDEX
+/**
+ * ASCII case folding, as strcasecmp() does it
+ */
+static inline unsigned int index_fold(unsigned int c)
+{
+    return (c - 'A' < 26u) ? c + ('a' - 'A') : c;
+}
+
+/**
+ * hash the parent index and name
+ */
+static unsigned int index_hash(int up, const unsigned char *name, size_t len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)up;
+
+    while (len--)
+        h = (h ^ index_fold(*name++)) * 16777619u;
+
+    return h ^ (h >> 15);
+}
+
+/**
+ * get the entry's name and its length without copying it
+ */
+static const unsigned char * entry_name_ptr(const struct dircache_entry *ce,
+                                            size_t *lenp)
+{
+    if (LIKELY(!ce->tinyname))
+    {
+        *lenp = CE_NAMESIZE(ce->namelen);
+        return get_name(ce->name);
+    }
+
+    const char *end = memchr((const char *)ce->namebuf, '\0', MAX_TINYNAME);
+    *lenp = end ? (size_t)(end - (const char *)ce->namebuf) : MAX_TINYNAME;
+    return ce->namebuf;
+}
+
+/**
+ * short names may be decoded from the OEM codepage by the path walk so those
+ * with anything but ASCII can't be matched byte-wise
+ */
+static bool index_name_ok(const unsigned char *name, size_t len)
+{
+    while (len--)
+    {
+        if (*name++ >= 0x80)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * find the slot holding the entry or NULL if it isn't there
+ */
+static int * index_find_slot(const struct dircache_entry *ce, int idx)
+{
+    size_t len;
+    const unsigned char *name = entry_name_ptr(ce, &len);
+    unsigned int mask = dcindex.slots - 1;
+
+    for (unsigned int i = index_hash(ce->up, name, len);; i++)
+    {
+        int *slotp = &dcindex.table[i & mask];
+        if (*slotp == idx)
+            return slotp;
+        else if (*slotp == 0)
+            return NULL;
+    }
+}
+
+/**
+ * add a linked entry to the index
+ */
+static void index_add(struct dircache_entry *ce, int idx)
+{
+    size_t len;
+    const unsigned char *name = entry_name_ptr(ce, &len);
+
+    if (ce->direntries == 1 && !index_name_ok(name, len))
+        return; /* the scan has to handle this one */
+
+    if ((dcindex.used + 1) * 4 > dcindex.slots * 3)
+    {
+        /* full enough to be slow; let it be rebuilt larger later */
+        logf("dircache: index full");
+        dcindex.valid = false;
+        return;
+    }
+
+    unsigned int mask = dcindex.slots - 1;
+    for (unsigned int i = index_hash(ce->up, name, len);; i++)
+    {
+        int *slotp = &dcindex.table[i & mask];
+        if (*slotp > 0)
+            continue;
+
+        if (*slotp == INDEX_DELETED)
+            dcindex.deleted--;
+
+        *slotp = idx;
+        dcindex.used++;
+        break;
+    }
+}
+
+/**
+ * fill the index from scratch with everything in the cache
+ */
+static void index_refill(void)
+{
+    memset(dcindex.table, 0, dcindex.slots * sizeof (int));
+    dcindex.used    = 0;
+    dcindex.deleted = 0;
+    dcindex.valid   = true;
+
+    FOR_EACH_CACHE_ENTRY(ce)
+    {
+        index_add(ce, get_index(ce));
+        if (!dcindex.valid)
+            break;
+    }
+}
+
+/**
+ * add an entry that was just linked in
+ */
+static void index_insert(struct dircache_entry *ce, int idx)
+{
+    if (!dcindex.valid)
+        return;
+
+    if ((dcindex.used + dcindex.deleted + 1) * 4 > dcindex.slots * 3)
+    {
+        /* too many tombstones; sweep them out */
+        index_refill();
+        return; /* has it now */
+    }
+
+    index_add(ce, idx);
+}
+
+/**
+ * remove an entry that is being unlinked
+ */
+static void index_remove(struct dircache_entry *ce)
+{
+    if (!dcindex.valid)
+        return;
+
+    int *slotp = index_find_slot(ce, get_index(ce));
+    if (slotp)
+    {
+        *slotp = INDEX_DELETED;
+        dcindex.used--;
+        dcindex.deleted++;
+    }
+}
+
+/**
+ * relocate the table when the buffer has moved
+ */
+static int index_move_callback(int handle, void *current, void *new)
+{
+    dcindex.table = new;
+    return BUFLIB_CB_OK;
+    (void)handle; (void)current;
+}
+
+/**
+ * remove the table from dircache control and return the handle
+ */
+static int index_reset_buffer(void)
+{
+    int handle = dcindex.handle;
+    dcindex.handle = 0;
+    dcindex.table  = NULL;
+    dcindex.slots  = 0;
+    dcindex.valid  = false;
+    return handle;
+}
+
+/**
+ * size the index for the cache as it is now and fill it; drops and retakes
+ * the dircache lock if a new table must be allocated
+ */
+static void index_build(void)
+{
+    /* called holding dircache lock */
+    unsigned int count = dircache.sizeused / ENTRYSIZE +
+                         DIRCACHE_RESERVE / ENTRYSIZE;
+    unsigned int slots = INDEX_MIN_SLOTS;
+    while (slots * 3 < count * 4)
+        slots *= 2;
+
+    dcindex.valid = false;
+
+    if (slots != dcindex.slots)
+    {
+        int handle = index_reset_buffer();
+        dircache_unlock();
+
+        if (handle > 0)
+            core_free(handle);
+
+        handle = core_alloc_ex("dircache index", slots * sizeof (int),
+                               &dcindex.ops);
+
+        dircache_lock();
+
+        if (handle > 0 && (dircache_runinfo.suspended ||
+                           dcindex.handle > 0))
+        {
+            /* don't need it after all */
+            dircache_unlock();
+            core_free(handle);
+            dircache_lock();
+            return;
+        }
+
+        if (handle <= 0)
+        {
+            logf("dircache: no index memory");
+            return;
+        }
+
+        dcindex.handle = handle;
+        dcindex.table  = core_get_data(handle);
+        dcindex.slots  = slots;
+    }
+
+    index_refill();
+}
+#else /* !DIRCACHE_NAME_INDEX */
+#define index_insert(ce, idx) do {} while (0)
+#define index_remove(ce)      do {} while (0)
+#endif /* DIRCACHE_NAME_INDEX */
+
 /**
  * allocate a dircache_entry from memory using freed ones if available
  */
@@ -1069,6 +1393,8 @@ static int create_entry(const char *basename,
 static void remove_entry(struct dircache_runinfo_volume *dcrivolp,
                          struct dircache_entry *ce, int *prevp)
 {
+    index_remove(ce);
+
     /* unlink it from its list */
     *prevp = ce->next;
 
@@ -1165,6 +1491,8 @@ static void insert_file_entry(struct file_base_info *dirinfop,
     ce->up   = diridx;
     ce->next = *nextp;
     *nextp   = get_index(ce);
+
+    index_insert(ce, *nextp);
 }
 
 /**
@@ -1247,6 +1575,63 @@ static void process_events(void)
 }
 
 #if defined (DIRCACHE_NATIVE)
+/**
+ * compare a cached entry with what was just read from the storage
+ */
+static bool sab_entry_matches(const struct dircache_entry *ce,
+                              const struct file_base_info *infop,
+                              const struct fat_direntry *fatentp)
+{
+    if (ce->direntries   != infop->fatfile.e.entries ||
+        ce->attr         != fatentp->attr            ||
+        ce->firstcluster != fatentp->firstcluster    ||
+        ce->wrtdate      != fatentp->wrtdate         ||
+        ce->wrttime      != fatentp->wrttime)
+        return false;
+
+    if (!(ce->attr & ATTR_DIRECTORY) && ce->filesize != fatentp->filesize)
+        return false;
+
+    return entry_name_equals(ce, (const char *)fatentp->name);
+}
+
+/**
+ * line up the entries ahead of the scanner with the one just read; those
+ * that belong before it or that differ from it can't exist any more (they
+ * would come from a snapshot) and are dropped along with their contents
+ *
+ * returns: index of the existing entry if it matches or 0 if one must be
+ *          created
+ */
+static int sab_sync_entry(struct sab *sabp, struct sab_component *compp,
+                          const struct fat_direntry *fatentp,
+                          struct dircache_entry **res)
+{
+    struct file_base_info *infop = &sabp->info;
+    struct dircache_runinfo_volume *dcrivolp = DCRIVOL(infop);
+
+    while (1)
+    {
+        int idx = *compp->prevp;
+        struct dircache_entry *ce = get_entry(idx);
+        if (!ce || ce->direntry > infop->fatfile.e.entry)
+            return 0; /* belongs ahead of this one (or at the end) */
+
+        if (ce->direntry == infop->fatfile.e.entry &&
+            sab_entry_matches(ce, infop, fatentp))
+        {
+            *res = ce;
+            return idx;
+        }
+
+        if ((ce->attr & ATTR_DIRECTORY) && ce->down)
+            free_subentries(dcrivolp, &ce->down);
+
+        remove_entry(dcrivolp, ce, compp->prevp);
+        free_orphan_entry(dcrivolp, ce, idx);
+    }
+}
+
 /**
  * scan and build the contents of a subdirectory
  */
@@ -1297,61 +1682,64 @@ static void sab_process_sub(struct sab *sabp)
                 if (rc < 0)
                     sabp->quit = true;
                 else
+                {
+                    /* anything still ahead is no longer on the storage */
+                    free_subentries(DCRIVOL(infop), compp->prevp);
                     compp->prevp = downp; /* rewind list */
+                }
 
                 break;
             }
 
             struct dircache_entry *ce;
-            int prev = *compp->prevp;
+            int idx = sab_sync_entry(sabp, compp, fatentp, &ce);
 
-            if (prev)
+            if (idx > 0)
             {
-                /* there are entries ahead of us; they will be what was just
-                   read or something to be subsequently read; if it belongs
-                   ahead of this one, insert a new entry before it; if it's
-                   the entry just scanned, do nothing further and continue
-                   with the next */
-                ce = get_entry(prev);
-                if (ce->direntry == infop->fatfile.e.entry)
-                {
-                    compp->prevp = &ce->next;
-                    continue; /* already there */
-                }
+                /* the entry just scanned is already there; it was either
+                   added by a file operation ahead of the scan or came from a
+                   snapshot and was found to be unchanged */
+                compp->prevp = &ce->next;
             }
-
-            int idx = create_entry(fatentp->name, &ce);
-            if (idx <= 0)
+            else
             {
-                if (idx == -ENAMETOOLONG)
+                int prev = *compp->prevp;
+
+                idx = create_entry(fatentp->name, &ce);
+                if (idx <= 0)
                 {
-                    /* not fatal; just don't include it */
-                    establish_frontier(compp->idx, FRONTIER_ZONED);
-                    continue;
+                    if (idx == -ENAMETOOLONG)
+                    {
+                        /* not fatal; just don't include it */
+                        establish_frontier(compp->idx, FRONTIER_ZONED);
+                        continue;
+                    }
+
+                    sabp->quit = true;
+                    break;
                 }
 
-                sabp->quit = true;
-                break;
-            }
+                /* link it in */
+                ce->up = compp->idx;
+                ce->next = prev;
+                *compp->prevp = idx;
+                compp->prevp = &ce->next;
+
+                if (!(fatentp->attr & ATTR_DIRECTORY))
+                    ce->filesize = fatentp->filesize;
+                else if (!is_dotdir_name(fatentp->name))
+                    ce->frontier = FRONTIER_NEW; /* this needs scanning */
 
-            /* link it in */
-            ce->up = compp->idx;
-            ce->next = prev;
-            *compp->prevp = idx;
-            compp->prevp = &ce->next;
-
-            if (!(fatentp->attr & ATTR_DIRECTORY))
-                ce->filesize = fatentp->filesize;
-            else if (!is_dotdir_name(fatentp->name))
-                ce->frontier = FRONTIER_NEW; /* this needs scanning */
-
-            /* copy remaining FS info */
-            ce->direntry     = infop->fatfile.e.entry;
-            ce->direntries   = infop->fatfile.e.entries;
-            ce->attr         = fatentp->attr;
-            ce->firstcluster = fatentp->firstcluster;
-            ce->wrtdate      = fatentp->wrtdate;
-            ce->wrttime      = fatentp->wrttime;
+                /* copy remaining FS info */
+                ce->direntry     = infop->fatfile.e.entry;
+                ce->direntries   = infop->fatfile.e.entries;
+                ce->attr         = fatentp->attr;
+                ce->firstcluster = fatentp->firstcluster;
+                ce->wrtdate      = fatentp->wrtdate;
+                ce->wrttime      = fatentp->wrttime;
+
+                index_insert(ce, idx);
+            }
 
             /* resolve queued user bindings */
             infop->fatfile.firstcluster = fatentp->firstcluster;
@@ -1577,6 +1965,34 @@ void dircache_rewinddir_dirent(struct dirscan_info *scanp)
  * that any available binding information is not ignored even when a scan
  * directory is frontier zoned.
  */
+/**
+ * fill in the FS entry and binding information for a cached entry as an
+ * internal scan would return it
+ */
+static int entry_get_direntry(struct dircache_entry *ce, int idx,
+                              struct file_base_info *infop,
+                              struct fat_direntry *fatent)
+{
+    /* FS entry information that we maintain */
+    entry_name_copy(fatent->name, ce);
+    fatent->shortname[0]     = '\0';
+    fatent->attr             = ce->attr;
+    /* file code file scanning does not need time information */
+    fatent->filesize         = (ce->attr & ATTR_DIRECTORY) ? 0 : ce->filesize;
+    fatent->firstcluster     = ce->firstcluster;
+
+    /* FS entry directory information */
+    infop->fatfile.e.entry   = ce->direntry;
+    infop->fatfile.e.entries = ce->direntries;
+
+    /* dircache file binding information */
+    infop->dcfile.idx        = idx;
+    infop->dcfile.serialnum  = ce->serialnum;
+
+    /* return whether this needs decoding */
+    return ce->direntries == 1 ? 2 : 1;
+}
+
 int dircache_readdir_internal(struct filestr_base *stream,
                               struct file_base_info *infop,
                               struct fat_direntry *fatent)
@@ -1616,35 +2032,19 @@ int dircache_readdir_internal(struct filestr_base *stream,
            information; otherwise return the uncached read result while
            maintaining the last index */
         int rc = uncached_readdir_internal(stream, infop, fatent);
-        if (rc <= 0 || !ce || ce->direntry > infop->fatfile.e.entry)
+        if (rc <= 0 || !ce || ce->direntry > infop->fatfile.e.entry ||
+            entry_unverified(ce))
             return rc;
 
         /* entry matches next one to read */
     }
-    else if (!ce)
+    else if (!ce || entry_unverified(ce))
     {
-        /* end of dir */
+        /* end of dir (or of what can be vouched for) */
         goto read_eod;
     }
 
-    /* FS entry information that we maintain */
-    entry_name_copy(fatent->name, ce);
-    fatent->shortname[0]     = '\0';
-    fatent->attr             = ce->attr;
-    /* file code file scanning does not need time information */
-    fatent->filesize         = (ce->attr & ATTR_DIRECTORY) ? 0 : ce->filesize;
-    fatent->firstcluster     = ce->firstcluster;
-
-    /* FS entry directory information */
-    infop->fatfile.e.entry   = ce->direntry;
-    infop->fatfile.e.entries = ce->direntries;
-
-    /* dircache file binding information */
-    infop->dcfile.idx        = idx;
-    infop->dcfile.serialnum  = ce->serialnum;
-
-    /* return whether this needs decoding */
-    int rc = ce->direntries == 1 ? 2 : 1;
+    int rc = entry_get_direntry(ce, idx, infop, fatent);
 
     if (frontier == FRONTIER_SETTLED)
     {
@@ -1664,6 +2064,73 @@ read_eod:
     return 0;    
 }
 
+#ifdef DIRCACHE_NAME_INDEX
+/**
+ * look up a name in a directory by the index instead of scanning it; returns
+ * 1 (or 2 if it needs decoding) if found, 0 if it definitely doesn't exist
+ * or < 0 if the directory must be scanned to know
+ */
+int dircache_find_internal(struct filestr_base *stream,
+                           struct file_base_info *infop,
+                           struct fat_direntry *fatent,
+                           const char *name)
+{
+    /* call with writer exclusion */
+    struct file_base_info *dirinfop = stream->infop;
+
+    /* assume binding "not found" */
+    infop->dcfile.serialnum = 0;
+
+    if (!dcindex.valid || !dirinfop->dcfile.serialnum)
+        goto pass;
+
+    int diridx = dirinfop->dcfile.idx;
+    unsigned int frontier = diridx < 0 ?
+        DCVOL(dirinfop)->frontier : get_entry(diridx)->frontier;
+
+    if (frontier != FRONTIER_SETTLED)
+        goto pass; /* the index could only say what's here so far */
+
+    size_t len = strlen(name);
+    unsigned int mask = dcindex.slots - 1;
+
+    for (unsigned int i = index_hash(diridx, (const unsigned char *)name, len);;
+         i++)
+    {
+        int idx = dcindex.table[i & mask];
+        if (idx == 0)
+            break;
+        else if (idx == INDEX_DELETED)
+            continue;
+
+        struct dircache_entry *ce = get_entry(idx);
+        if (ce->up != diridx || entry_unverified(ce))
+            continue;
+
+        size_t celen;
+        const unsigned char *cename = entry_name_ptr(ce, &celen);
+        if (celen != len || strncasecmp((const char *)cename, name, len))
+            continue;
+
+        dcindex.hits++;
+        return entry_get_direntry(ce, idx, infop, fatent);
+    }
+
+    /* a short name with anything but ASCII isn't indexed */
+    if (!index_name_ok((const unsigned char *)name, len))
+        goto pass;
+
+    dcindex.absent++;
+    fat_empty_fat_direntry(fatent);
+    infop->fatfile.e.entries = 0;
+    return 0;
+
+pass:
+    dcindex.passed++;
+    return -1;
+}
+#endif /* DIRCACHE_NAME_INDEX */
+
 /**
  * rewind the scan position for an internal scan
  */
@@ -1812,6 +2279,9 @@ static void reset_volume(IF_MV_NONVOID(int volume))
     #endif
             binding_dissolve_volume(dcrivolp);
 
+        /* anything that happens now goes unseen */
+        journal_invalidate();
+
         /* set it back to unscanned */
         dcvolp->status      = DIRCACHE_IDLE;
         dcvolp->frontier    = FRONTIER_NEW;
@@ -1847,6 +2317,12 @@ static void reset_cache(void)
     dircache.namesfree    = 0;
     dircache.nextnamefree = 0;
     *get_name(dircache.names - 1) = 0;
+#ifdef DIRCACHE_SNAPSHOT
+    dircache_runinfo.unverified = 0;
+#endif
+#ifdef DIRCACHE_NAME_INDEX
+    dcindex.valid = false;
+#endif
     /* dircache.last_serialnum stays */
     /* dircache.reserve_used stays */
     /* dircache.last_size stays */
@@ -1863,7 +2339,13 @@ static void build_volumes(void)
     {
         /* this does reader locking but we already own that */
         if (!volume_ismounted(IF_MV(i)))
+        {
+        #if defined(DIRCACHE_SNAPSHOT) && defined(HAVE_MULTIVOLUME)
+            /* a snapshot may have something for a volume that's gone */
+            reset_volume(i);
+        #endif
             continue;
+        }
 
         struct dircache_volume *dcvolp = DCVOL(i);
 
@@ -1915,18 +2397,6 @@ static int prepare_build(bool *realloced)
     /* called holding dircache lock */
     size_t size = dircache.last_size;
 
-#ifdef HAVE_EEPROM_SETTINGS
-    if (realloced)
-    {
-        dircache_unlock();
-        remove_dircache_file();
-        dircache_lock();
-
-        if (dircache_runinfo.suspended)
-            return -1;
-    }
-#endif /* HAVE_EEPROM_SETTINGS */
-
     bool stuffed = DIRCACHE_STUFFED(dircache.reserve_used);
     if (dircache_runinfo.bufsize > size && !stuffed)
     {
@@ -1967,6 +2437,7 @@ static int prepare_build(bool *realloced)
         core_free(handle);
 
     handle = alloc_cache(size);
+    int jhandle = handle > 0 ? journal_alloc() : 0;
 
     dircache_lock();
 
@@ -1975,7 +2446,9 @@ static int prepare_build(bool *realloced)
         /* if we got suspended, don't keep this huge buffer around */
         dircache_unlock();
         core_free(handle);
-        handle = 0;
+        if (jhandle > 0)
+            core_free(jhandle);
+        handle = jhandle = 0;
         dircache_lock();
     }
 
@@ -1986,6 +2459,8 @@ static int prepare_build(bool *realloced)
     }
 
     set_buffer(handle, size);
+    if (jhandle > 0)
+        journal_set_buffer(jhandle);
     buffer_unlock();
 
     return syncbuild;
@@ -2077,6 +2552,11 @@ static void dircache_thread(void)
         /* if it was reallocated, compact it */
         if (realloced)
             compact_cache();
+
+    #ifdef DIRCACHE_NAME_INDEX
+        if (!dircache_runinfo.suspended)
+            index_build();
+    #endif
      }
 
      dircache_unlock();
@@ -2149,7 +2629,7 @@ void dircache_unmount(IF_MV_NONVOID(int volume))
 static void dircache_suspend_internal(bool freeit)
 {
     if (dircache_runinfo.suspended++ > 0 &&
-        (!freeit || dircache_runinfo.handle <= 0))
+        (!freeit || (dircache_runinfo.handle <= 0 && journal.handle <= 0)))
         return;
 
     unsigned int thread_id = dircache_runinfo.thread_id;
@@ -2158,15 +2638,32 @@ static void dircache_suspend_internal(bool freeit)
     clear_dircache_queue();
 
     /* grab the buffer away into our control; the cache won't need it now */
-    int handle = 0;
+    int handle = 0, jhandle = 0;
+#ifdef DIRCACHE_NAME_INDEX
+    int idxhandle = 0;
+#endif
     if (freeit)
+    {
         handle = reset_buffer();
+        jhandle = journal_reset_buffer();
+    #ifdef DIRCACHE_NAME_INDEX
+        idxhandle = index_reset_buffer();
+    #endif
+    }
 
     dircache_unlock();
 
     if (handle > 0)
         core_free(handle);
 
+    if (jhandle > 0)
+        core_free(jhandle);
+
+#ifdef DIRCACHE_NAME_INDEX
+    if (idxhandle > 0)
+        core_free(idxhandle);
+#endif
+
     thread_wait(thread_id);
 
     dircache_lock();
@@ -2349,6 +2846,7 @@ void dircache_fileop_create(struct file_base_info *dirinfop,
     if (!dirinfop->dcfile.serialnum)
     {
         /* no parent binding => no child binding */
+        journal_invalidate();
         return;
     }
 
@@ -2358,6 +2856,7 @@ void dircache_fileop_create(struct file_base_info *dirinfop,
     {
         /* failed allocation; parent cache contents are not complete */
         establish_frontier(dirinfop->dcfile.idx, FRONTIER_ZONED);
+        journal_invalidate();
         return;
     }
 
@@ -2383,6 +2882,9 @@ void dircache_fileop_create(struct file_base_info *dirinfop,
     infop->dcfile.serialnum = ce->serialnum;
     binding_resolve(infop);
 
+    if (!(dinp->attr & ATTR_DIRECTORY))
+        journal_record(idx, DCC_ADDED, ENTRY_MTIME(dinp));
+
     if ((dinp->attr & ATTR_DIRECTORY) && !is_dotdir_name(basename))
     {
         /* scan-in the contents of the new directory at this level only */
@@ -2401,7 +2903,15 @@ void dircache_fileop_remove(struct file_base_binding *bindp)
     logf("dc remove: %u\n", (unsigned int)bindp->info.dcfile.serialnum);
 
     if (!bindp->info.dcfile.serialnum)
+    {
+        journal_invalidate();
         return; /* no binding yet */
+    }
+
+    /* directories must be empty to be removed */
+    struct dircache_entry *ce = get_entry(bindp->info.dcfile.idx);
+    if (ce && !(ce->attr & ATTR_DIRECTORY))
+        journal_record(bindp->info.dcfile.idx, DCC_REMOVED, 0);
 
     free_file_entry(&bindp->info);
 
@@ -2427,6 +2937,7 @@ void dircache_fileop_rename(struct file_base_info *dirinfop,
             free_file_entry(&bindp->info);
         /* else no entry anyway */
 
+        journal_invalidate();
         return;
     }
 
@@ -2436,12 +2947,22 @@ void dircache_fileop_rename(struct file_base_info *dirinfop,
            parent which means the parent would be missing an entry in the cache;
            downgrade the parent */
         establish_frontier(dirinfop->dcfile.idx, FRONTIER_ZONED);
+        journal_invalidate();
         return;
     }
 
+    /* a renamed directory moves every path below it; that is more than the
+       journal can describe */
+    struct dircache_entry *ce = get_entry(bindp->info.dcfile.idx);
+    bool isfile = !(ce->attr & ATTR_DIRECTORY);
+    if (isfile)
+        journal_record(bindp->info.dcfile.idx, DCC_REMOVED, 0);
+    else
+        journal_invalidate();
+
     /* unlink the entry but keep it; it needs to be re-sorted since the
        underlying FS probably changed the order */
-    struct dircache_entry *ce = remove_file_entry(&bindp->info);
+    ce = remove_file_entry(&bindp->info);
 
 #ifdef DIRCACHE_NATIVE
     /* update other name-related information before inserting */
@@ -2449,23 +2970,31 @@ void dircache_fileop_rename(struct file_base_info *dirinfop,
     ce->direntries = bindp->info.fatfile.e.entries;
 #endif
 
-    /* place it into its new home */
-    insert_file_entry(dirinfop, ce);
-
-    /* lastly, update the entry name itself */
-    if (entry_reassign_name(ce, basename) == 0)
-    {
-        /* it's not really the same one now so re-stamp it */
-        dc_serial_t serialnum = next_serialnum();
-        ce->serialnum = serialnum;
-        bindp->info.dcfile.serialnum = serialnum;
-    }
-    else
+    /* update the entry name itself; it's indexed by it when inserted */
+    if (entry_reassign_name(ce, basename) < 0)
     {
         /* it cannot be kept around without a valid name */
-        free_file_entry(&bindp->info);
+        struct dircache_runinfo_volume *dcrivolp = DCRIVOL(bindp);
+
+        if (!isfile && ce->down)
+            free_subentries(dcrivolp, &ce->down);
+
+        free_orphan_entry(dcrivolp, ce, bindp->info.dcfile.idx);
         establish_frontier(dirinfop->dcfile.idx, FRONTIER_ZONED);
+        journal_invalidate();
+        return;
     }
+
+    /* place it into its new home */
+    insert_file_entry(dirinfop, ce);
+
+    /* it's not really the same one now so re-stamp it */
+    dc_serial_t serialnum = next_serialnum();
+    ce->serialnum = serialnum;
+    bindp->info.dcfile.serialnum = serialnum;
+
+    if (isfile)
+        journal_record(bindp->info.dcfile.idx, DCC_ADDED, ENTRY_MTIME(ce));
 }
 
 /**
@@ -2497,7 +3026,10 @@ void dircache_fileop_sync(struct file_base_binding *bindp,
 #endif
     ce->attr         = dinp->attr;
     if (!(dinp->attr & ATTR_DIRECTORY))
+    {
         ce->filesize = dinp->size;
+        journal_record(infop->dcfile.idx, DCC_ADDED, ENTRY_MTIME(dinp));
+    }
 }
 
 
@@ -2580,7 +3112,7 @@ static int check_file_serialnum(const struct dircache_file *dcfilep)
     if (idx > 0)
     {
         struct dircache_entry *ce = get_entry(idx);
-        if (!ce || !(s = ce->serialnum))
+        if (!ce || !(s = ce->serialnum) || entry_unverified(ce))
             return -EBADF;
     }
     else /* idx < 0 */
@@ -2823,6 +3355,185 @@ int dircache_fileref_cmp(const struct dircache_fileref *dcfrefp1,
     return cmp;
 }
 
+/** Change journal **/
+
+/**
+ * forget whatever is in the journal and flag the reader that changes were
+ * missed
+ */
+static void journal_invalidate(void)
+{
+    journal.read = journal.head;
+    journal.lost = true;
+    journal.tick = current_tick;
+}
+
+/**
+ * relocate the ring when the buffer has moved
+ */
+static int journal_move_callback(int handle, void *current, void *new)
+{
+    journal.ring = new;
+    return BUFLIB_CB_OK;
+    (void)handle; (void)current;
+}
+
+/**
+ * allocate the ring if there isn't one; call without the dircache lock
+ */
+static int journal_alloc(void)
+{
+    if (journal.handle > 0)
+        return 0;
+
+    return core_alloc_ex("dircache journal",
+                         DIRCACHE_JOURNAL_SIZE * sizeof (struct dircache_change),
+                         &journal.ops);
+}
+
+/**
+ * put a new, empty ring in dircache control
+ */
+static void journal_set_buffer(int handle)
+{
+    /* called holding dircache lock */
+    journal.handle = handle;
+    journal.ring   = core_get_data(handle);
+}
+
+/**
+ * remove the ring from dircache control and return the handle; unread
+ * changes are lost with it
+ */
+static int journal_reset_buffer(void)
+{
+    /* called holding dircache lock */
+    int handle = journal.handle;
+    journal.handle = 0;
+    journal.ring   = NULL;
+
+    if (journal.read != journal.head)
+        journal_invalidate();
+
+    return handle;
+}
+
+/**
+ * append a change for the file at the index; repeats of the last unread
+ * change to the same path are folded together
+ */
+static void journal_record(int idx, enum dircache_change_type type,
+                           time_t mtime)
+{
+    if (!journal.ring)
+    {
+        journal_invalidate();
+        return;
+    }
+
+    /* build the path right in the next slot; it is only kept if advanced */
+    struct dircache_change *chgp = JOURNAL_RECORD(journal.head);
+    struct get_path_sub_data data =
+    {
+        .buf        = chgp->path,
+        .size       = sizeof (chgp->path),
+        .serialhash = DC_SERHASH_START,
+    };
+
+    ssize_t len = get_path_sub(idx, &data);
+    if (len < 0 || (size_t)len >= sizeof (chgp->path))
+    {
+        journal_invalidate();
+        return;
+    }
+
+    journal.tick = current_tick;
+
+    for (unsigned int seq = journal.head; seq != journal.read;)
+    {
+        struct dircache_change *p = JOURNAL_RECORD(--seq);
+        if (strcmp(p->path, chgp->path))
+            continue;
+
+        if (p->type == type)
+        {
+            p->mtime = mtime;
+            return;
+        }
+
+        break;
+    }
+
+    if (journal.head - journal.read >= DIRCACHE_JOURNAL_SIZE - 1)
+    {
+        /* the reader fell behind; one more would overwrite an unread one */
+        journal_invalidate();
+        return;
+    }
+
+    chgp->type  = type;
+    chgp->mtime = mtime;
+    journal.head++;
+}
+
+/**
+ * read the next file change seen since the last call
+ *
+ * returns:
+ *   1 - a change was copied to *chgp
+ *   0 - there are no more changes
+ *  -1 - changes were missed since the last call; the reader should assume
+ *       anything may have changed
+ */
+int dircache_get_change(struct dircache_change *chgp)
+{
+    int rc = 0;
+
+    dircache_lock();
+
+    if (journal.lost)
+    {
+        journal.lost = false;
+        rc = -1;
+    }
+    else if (journal.read != journal.head)
+    {
+        *chgp = *JOURNAL_RECORD(journal.read);
+        journal.read++;
+        rc = 1;
+    }
+
+    dircache_unlock();
+    return rc;
+}
+
+/**
+ * return the number of unread changes or -1 if changes were missed; the time
+ * of the latest change is returned in *tickp
+ */
+int dircache_changes_pending(long *tickp)
+{
+    dircache_lock();
+
+    int count = journal.lost ? -1 : (int)(journal.head - journal.read);
+    if (tickp)
+        *tickp = journal.tick;
+
+    dircache_unlock();
+    return count;
+}
+
+/**
+ * drop all unread changes, including the lost state
+ */
+void dircache_clear_changes(void)
+{
+    dircache_lock();
+    journal.read = journal.head;
+    journal.lost = false;
+    dircache_unlock();
+}
+
 /** Debug screen/info stuff **/
 
 /**
@@ -2896,6 +3607,15 @@ void dircache_get_info(struct dircache_info *info)
         info->entry_count  = 0;
     }
 
+#ifdef DIRCACHE_NAME_INDEX
+    info->index_size   = dcindex.slots * sizeof (int);
+    info->index_count  = dcindex.used;
+    info->index_valid  = dcindex.valid;
+    info->index_hits   = dcindex.hits;
+    info->index_absent = dcindex.absent;
+    info->index_passed = dcindex.passed;
+#endif
+
     dircache_unlock();
 }
 
@@ -3012,23 +3732,28 @@ void dircache_dcfile_init(struct dircache_file *dcfilep)
     dcfilep->serialnum = 0;
 }
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
 
-#ifdef HAVE_HOTSWAP
-/* NOTE: This is hazardous to the filesystem of any sort of removable
-         storage unless it may be determined that the filesystem from save
-         to load is identical. If it's not possible to do so in a timely
-         manner, it's not worth persisting the cache. */
-  #warning "Don't do this; you'll find the consequences unpleasant."
-#endif
+/* NOTE: Nothing in a loaded snapshot is trusted until the background scan
+         has compared each directory with what is on the storage, so the
+         storage may have been changed in any way between save and load
+         (removable media, USB, unclean shutdown). Until then, lookups in
+         the directories not yet compared fall through to the storage. */
+
+/* dircache persistence file header magic and format version */
+#define DIRCACHE_MAGIC    0x00d0c0a1
+#define DIRCACHE_VERSION  2
 
-/* dircache persistence file header magic */
-#define DIRCACHE_MAGIC  0x00d0c0a1
+/* written first then renamed over the snapshot so that a save cut short
+   leaves the previous one in place */
+#define DIRCACHE_FILE_NEW DIRCACHE_FILE ".new"
 
 /* dircache persistence file header */
 struct dircache_maindata
 {
     uint32_t        magic;      /* DIRCACHE_MAGIC */
+    uint16_t        version;    /* DIRCACHE_VERSION */
+    uint16_t        entrysize;  /* ENTRYSIZE of the saving build */
     struct dircache dircache;   /* metadata of the cache! */
     uint32_t        datacrc;    /* CRC32 of data */
     uint32_t        hdrcrc;     /* CRC32 of header through datacrc */
@@ -3050,7 +3775,9 @@ static bool dircache_is_clean(bool saving)
 
 /**
  * function to load the internal cache structure from disk to initialize
- * the dircache really fast with little disk access.
+ * the dircache really fast with little disk access; a background scan then
+ * compares it with the storage, keeping what is unchanged and rescanning
+ * only those directories that differ
  */
 int dircache_load(void)
 {
@@ -3064,7 +3791,7 @@ int dircache_load(void)
     ssize_t size;
     struct dircache_maindata maindata;
     uint32_t crc;
-    int handle = 0;
+    int handle = 0, jhandle = 0;
     bool hasbuffer = false;
 
     size = sizeof (maindata);
@@ -3081,6 +3808,13 @@ int dircache_load(void)
         goto error_nolock;
     }
 
+    if (maindata.version != DIRCACHE_VERSION ||
+        maindata.entrysize != ENTRYSIZE)
+    {
+        logf("dircache: format mismatch");
+        goto error_nolock;
+    }
+
     crc = crc_32(&maindata, offsetof(struct dircache_maindata, hdrcrc),
                  0xffffffff);
     if (crc != maindata.hdrcrc)
@@ -3107,6 +3841,8 @@ int dircache_load(void)
         goto error_nolock;
     }
 
+    jhandle = journal_alloc();
+
     dircache_lock();
     buffer_lock();
 
@@ -3117,6 +3853,8 @@ int dircache_load(void)
     dircache = maindata.dircache;
 
     set_buffer(handle, bufsize);
+    if (jhandle > 0)
+        journal_set_buffer(jhandle);
     hasbuffer = true;
 
     /* convert back to in-RAM representation */
@@ -3156,8 +3894,7 @@ int dircache_load(void)
     if (offset != 0)
     {
         /* nothing should be open besides the dircache file itself therefore
-           no bindings need be resolved; the cache will have its own entry
-           but that should get cleaned up when removing the file */
+           no bindings need be resolved */
         FOR_EACH_CACHE_ENTRY(ce)
         {
             if (!ce->tinyname)
@@ -3166,16 +3903,41 @@ int dircache_load(void)
     }
 
     dircache.reserve_used = 0;
+    dircache.last_size    = dircache.size;
+
+    /* nothing is vouched for until the scan reaches it; serial numbers up to
+       here belong to the snapshot */
+    dircache_runinfo.unverified = dircache.last_serialnum;
+
+    FOR_EACH_VOLUME(-1, i)
+    {
+        struct dircache_volume *dcvolp = DCVOL(i);
+        dcvolp->frontier = FRONTIER_NEW;
+        if (dcvolp->status != DIRCACHE_IDLE)
+            dcvolp->status = DIRCACHE_SCANNING;
+    }
 
-    /* enable the cache but do not try to build it */
+    FOR_EACH_CACHE_ENTRY(ce)
+    {
+        if ((ce->attr & ATTR_DIRECTORY) &&
+            !entry_name_equals(ce, ".") && !entry_name_equals(ce, ".."))
+            ce->frontier = FRONTIER_NEW;
+    }
+
+    /* enable the cache and start comparing it in the background */
     dircache_enable_internal(false);
+    dircache_thread_post(NULL);
 
     /* cache successfully loaded */
     logf("Done, %ld KiB used", dircache.size / 1024);
     rc = 0;
 error:
     if (rc < 0 && hasbuffer)
+    {
         reset_buffer();
+        if (jhandle > 0)
+            journal_reset_buffer();
+    }
 
     buffer_unlock();
     dircache_unlock();
@@ -3184,10 +3946,16 @@ error_nolock:
     if (rc < 0 && handle > 0)
         core_free(handle);
 
+    if (rc < 0 && jhandle > 0)
+        core_free(jhandle);
+
     if (fd >= 0)
         close(fd);
 
-    remove_dircache_file();
+    /* the snapshot stays for the next boot unless it's no good */
+    if (rc < 0)
+        remove_dircache_file();
+
     return rc;
 }
 
@@ -3199,7 +3967,7 @@ int dircache_save(void)
 {
     logf("Saving directory cache");
 
-    int fd = open_dircache_file(O_WRONLY|O_CREAT|O_TRUNC|O_APPEND);
+    int fd = open(DIRCACHE_FILE_NEW, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0666);
     if (fd < 0)
         return -1;
 
@@ -3216,8 +3984,10 @@ int dircache_save(void)
     uint32_t crc;
     struct dircache_maindata maindata =
     {
-        .magic    = DIRCACHE_MAGIC,
-        .dircache = dircache,
+        .magic     = DIRCACHE_MAGIC,
+        .version   = DIRCACHE_VERSION,
+        .entrysize = ENTRYSIZE,
+        .dircache  = dircache,
     };
 
     /* store the size since it better detects an invalid header */
@@ -3269,20 +4039,36 @@ int dircache_save(void)
         goto error;
     }
 
-    /* as of now, no changes to the volumes should be allowed at all since
-       that makes what was saved completely invalid */
+    /* changes to the volumes after this are caught when the next boot
+       compares the snapshot with the storage */
     rc = 0;
 error:
     buffer_unlock();
     dircache_unlock();
 
+    close(fd);
+
+    if (rc == 0 && rename(DIRCACHE_FILE_NEW, DIRCACHE_FILE) < 0)
+    {
+        logf("dircache: rename failed");
+        rc = -1;
+    }
+
     if (rc < 0)
-        remove_dircache_file();
+        remove(DIRCACHE_FILE_NEW);
 
-    close(fd);
     return rc;
 }
-#endif /* HAVE_EEPROM_SETTINGS */
+
+/**
+ * forget the saved snapshot because the volumes may be changed behind our back
+ * (USB, card swap); the next boot then builds the cache by scanning
+ */
+void dircache_drop_snapshot(void)
+{
+    remove_dircache_file();
+}
+#endif /* DIRCACHE_SNAPSHOT */
 
 /**
  * main one-time initialization function that must be called before any other
@@ -3298,4 +4084,8 @@ void dircache_init(size_t last_size)
     dcrip->suspended         = 1;
     dcrip->thread_done       = true;
     dcrip->ops.move_callback = move_callback;
+    journal.ops.move_callback = journal_move_callback;
+#ifdef DIRCACHE_NAME_INDEX
+    dcindex.ops.move_callback = index_move_callback;
+#endif
 }
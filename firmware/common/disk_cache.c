@@ -19,6 +19,7 @@
  *
  ****************************************************************************/
 #include "config.h"
+#include <string.h>
 #include "debug.h"
 #include "system.h"
 #include "linked_list.h"
@@ -55,6 +56,12 @@
  *             001001 <- collision
  *             000000
  * volume map  111101 <- entry usage by the volume (OR of all map entries)
+ *
+ * Read-ahead: a few sequential streams of misses are tracked per volume. A
+ * miss that continues one doubles its window, up to DC_READAHEAD_MAX, while
+ * any other miss starts a new stream at one sector. The client reads the
+ * whole window with one storage command into a staging buffer and the cache
+ * distributes it to entries that are marked as prefetched until first used.
  */
 
 enum dce_flags /* flags for each cache entry */
@@ -62,6 +69,9 @@ enum dce_flags /* flags for each cache entry */
     DCE_INUSE = 0x01, /* entry in use and valid */
     DCE_DIRTY = 0x02, /* entry is dirty in need of writeback */
     DCE_BUF   = 0x04, /* entry is being used as a general buffer */
+#ifdef DC_READAHEAD
+    DCE_PREFETCH = 0x08, /* entry was read ahead and not yet used */
+#endif
 };
 
 struct disk_cache_entry
@@ -88,6 +98,20 @@ static cache_map_entry_t cache_map_entry[NUM_VOLUMES][DC_MAP_NUM_ENTRIES];
 static cache_map_entry_t cache_vol_map[NUM_VOLUMES] IBSS_ATTR;
 static uint8_t cache_buffer[DC_NUM_ENTRIES][DC_CACHE_BUFSIZE] CACHEALIGN_ATTR;
 struct mutex disk_cache_mutex SHAREDBSS_ATTR;
+static struct dc_stats cache_stats;
+
+#ifdef DC_READAHEAD
+#define DC_RA_NUM_STREAMS 2
+
+static struct dc_ra_stream
+{
+    unsigned long next;         /* sector following the last one filled */
+    unsigned int  window;       /* number of sectors to fill next time */
+} cache_ra_stream[NUM_VOLUMES][DC_RA_NUM_STREAMS];
+static unsigned char cache_ra_victim[NUM_VOLUMES];
+static uint8_t cache_ra_buffer[DC_READAHEAD_MAX][DC_CACHE_BUFSIZE]
+    CACHEALIGN_ATTR;
+#endif /* DC_READAHEAD */
 
 #define CACHE_MAP_ENTRY(volume, mapnum) \
     cache_map_entry[IF_MV_VOL(volume)][mapnum]
@@ -169,11 +193,9 @@ static inline void cache_discard_entry(struct disk_cache_entry *dce,
     dce->flags = 0;
 }
 
-/* search the cache for the specified sector, returning a buffer, either
-   to the specified sector, if it exists, or a new/evicted entry that must
-   be filled */
-void * dc_cache_probe(IF_MV(int volume,) unsigned long sector,
-                      unsigned int *flagsp)
+/* find the cache entry holding the sector or return NULL */
+static struct disk_cache_entry * cache_find_entry(IF_MV(int volume,)
+                                                  unsigned long sector)
 {
     unsigned int mapnum = map_sector(sector);
 
@@ -182,14 +204,16 @@ void * dc_cache_probe(IF_MV(int volume,) unsigned long sector,
         struct disk_cache_entry *dce = &cache_entry[index];
 
         if (dce->sector == sector)
-        {
-            *flagsp = DCE_INUSE;
-            touch_cache_entry(dce);
-            return cache_buffer[index];
-        }
+            return dce;
     }
 
-    /* sector not found so the LRU is the victim */
+    return NULL;
+}
+
+/* evict the LRU entry, making it the MRU, and assign the sector to it */
+static void * cache_claim_lru_entry(IF_MV(int volume,) unsigned long sector)
+{
+    unsigned int mapnum = map_sector(sector);
     struct disk_cache_entry *dce = DCE_LRU();
     cache_lru.head = dce->node.next;
 
@@ -199,6 +223,11 @@ void * dc_cache_probe(IF_MV(int volume,) unsigned long sector,
 
     if (old_flags)
     {
+    #ifdef DC_READAHEAD
+        if (old_flags & DCE_PREFETCH)
+            cache_stats.prefetch_unused++;
+    #endif
+
         int old_volume = IF_MV_VOL(dce->volume);
         unsigned long sector = dce->sector;
         unsigned int old_mapnum = map_sector(sector);
@@ -221,10 +250,106 @@ finish_setup:
 #endif
     dce->sector = sector;
 
-    *flagsp = 0;
     return buf;
 }
 
+/* search the cache for the specified sector, returning a buffer, either
+   to the specified sector, if it exists, or a new/evicted entry that must
+   be filled */
+void * dc_cache_probe(IF_MV(int volume,) unsigned long sector,
+                      unsigned int *flagsp)
+{
+    struct disk_cache_entry *dce = cache_find_entry(IF_MV(volume,) sector);
+
+    if (dce)
+    {
+    #ifdef DC_READAHEAD
+        if (dce->flags & DCE_PREFETCH)
+        {
+            cache_stats.prefetch_hits++;
+            dce->flags &= ~DCE_PREFETCH;
+        }
+    #endif
+
+        cache_stats.hits++;
+        *flagsp = DCE_INUSE;
+        touch_cache_entry(dce);
+        return cache_buffer[DCIDX_FROM_DCE(dce)];
+    }
+
+    /* sector not found so the LRU is the victim */
+    cache_stats.misses++;
+    *flagsp = 0;
+    return cache_claim_lru_entry(IF_MV(volume,) sector);
+}
+
+#ifdef DC_READAHEAD
+/* decide how many sectors, up to *countp, to read starting with a sector
+   that just missed; returns the buffer to read them into or NULL with
+   *countp == 1 if it should only be the one */
+void * dc_readahead_begin(IF_MV(int volume,) unsigned long sector,
+                          unsigned int *countp)
+{
+    struct dc_ra_stream *streams = cache_ra_stream[IF_MV_VOL(volume)];
+    struct dc_ra_stream *stream = NULL;
+
+    for (unsigned int i = 0; i < DC_RA_NUM_STREAMS; i++)
+    {
+        if (streams[i].window && streams[i].next == sector)
+        {
+            /* continues a sequence; widen the window */
+            stream = &streams[i];
+            stream->window = MIN(stream->window * 2, DC_READAHEAD_MAX);
+            break;
+        }
+    }
+
+    if (!stream)
+    {
+        /* start tracking a new one in place of the older one */
+        unsigned char *victimp = &cache_ra_victim[IF_MV_VOL(volume)];
+        stream = &streams[*victimp];
+        *victimp = (*victimp + 1) % DC_RA_NUM_STREAMS;
+        stream->window = 1;
+    }
+
+    unsigned int count = MIN(*countp, stream->window);
+
+    /* stop short of anything already cached; it may be dirty */
+    for (unsigned int i = 1; i < count; i++)
+    {
+        if (cache_find_entry(IF_MV(volume,) sector + i))
+        {
+            count = i;
+            break;
+        }
+    }
+
+    stream->next = sector + count;
+    *countp = count;
+
+    return count > 1 ? cache_ra_buffer : NULL;
+}
+
+/* distribute the sectors read into the buffer from dc_readahead_begin();
+   'buf' is the buffer returned by dc_cache_probe() for the first one */
+void dc_readahead_finish(IF_MV(int volume,) unsigned long sector,
+                         unsigned int count, void *buf)
+{
+    memcpy(buf, cache_ra_buffer[0], DC_CACHE_BUFSIZE);
+
+    cache_stats.readaheads++;
+
+    for (unsigned int i = 1; i < count; i++)
+    {
+        void *rabuf = cache_claim_lru_entry(IF_MV(volume,) sector + i);
+        memcpy(rabuf, cache_ra_buffer[i], DC_CACHE_BUFSIZE);
+        cache_entry[DCIDX_FROM_BUF(rabuf)].flags |= DCE_PREFETCH;
+        cache_stats.prefetched++;
+    }
+}
+#endif /* DC_READAHEAD */
+
 /* mark in-use cache entry as dirty by buffer */
 void dc_dirty_buf(void *buf)
 {
@@ -333,6 +458,14 @@ void dc_release_buffer(void *buf)
     dc_unlock_cache();
 }
 
+/* copy the cache statistics */
+void dc_get_stats(struct dc_stats *stats)
+{
+    dc_lock_cache();
+    *stats = cache_stats;
+    dc_unlock_cache();
+}
+
 /* one-time init at startup */
 void dc_init(void)
 {
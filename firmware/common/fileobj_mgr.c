@@ -47,6 +47,9 @@ static struct fileobj_binding
     struct filestr_cache     cache;   /* write mode shared cache */
     file_size_t              size;    /* size of this file */
     struct ll_head           list;    /* open streams for this file/dir */
+#ifdef FAT_EXTENT_CACHE
+    struct fat_extent_map    extents; /* cluster map of a file's data */
+#endif
 } fobindings[MAX_FILEOBJS];
 static struct mutex stream_mutexes[MAX_FILEOBJS] SHAREDBSS_ATTR;
 static struct ll_head free_bindings;
@@ -193,7 +196,12 @@ void fileobj_fileop_open(struct filestr_base *stream,
     stream->fatstr.fatfilep = &fobp->bind.info.fatfile;
     stream->bindp = &fobp->bind;
     stream->mtx   = &stream_mutexes[fobp - fobindings];
-
+#ifdef FAT_EXTENT_CACHE
+    /* directories are read sequentially and their chains change behind
+       their streams' backs */
+    stream->fatstr.extents = (callflags & FO_DIRECTORY) ?
+                                NULL : &fobp->extents;
+#endif
     if (first)
     {
         /* first stream for file */
@@ -202,6 +210,9 @@ void fileobj_fileop_open(struct filestr_base *stream,
                           (callflags & (FO_DIRECTORY|FO_TRUNC));
         fobp->writers   = 0;
         fobp->size      = 0;
+    #ifdef FAT_EXTENT_CACHE
+        fat_extent_map_init(&fobp->extents);
+    #endif
 
         fileobj_bind_file(&fobp->bind);
     }
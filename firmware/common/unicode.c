@@ -59,16 +59,28 @@
 #define open_noiso_internal open
 #endif /* !APPLICATION */
 
-#if 0 /* not needed just now (will probably end up a spinlock) */
+#if (defined(APPLICATION) || defined(__PCTOOL__)) && !defined(WIN32)
+/* The database scan reads metadata on its own threads on hosted builds,
+   so iso_decode() may be entered from outside of the kernel threads */
+#include <pthread.h>
+#include <sched.h>
+static pthread_mutex_t cp_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define cp_lock_init()   do {} while (0)
+#define cp_lock_enter()  pthread_mutex_lock(&cp_mutex)
+#define cp_lock_leave()  pthread_mutex_unlock(&cp_mutex)
+#define cp_yield()       sched_yield()
+#elif 0 /* not needed just now (will probably end up a spinlock) */
 #include "mutex.h"
 static struct mutex cp_mutex SHAREDBSS_ATTR;
 #define cp_lock_init()   mutex_init(&cp_mutex)
 #define cp_lock_enter()  mutex_lock(&cp_mutex)
 #define cp_lock_leave()  mutex_unlock(&cp_mutex)
+#define cp_yield()       yield()
 #else
 #define cp_lock_init()   do {} while (0)
 #define cp_lock_enter()  asm volatile ("")
 #define cp_lock_leave()  asm volatile ("")
+#define cp_yield()       yield()
 #endif
 
 enum cp_tid
@@ -307,7 +319,7 @@ unsigned char* iso_decode(const unsigned char *iso, unsigned char *utf8,
         cp_lock_leave();
 
         if (!load) {
-            yield();
+            cp_yield();
         } else if (alloc_and_load_cp_table(cp, codepage_table) < 0) {
             cp = INIT_CODEPAGE; /* table may be clobbered now */
             tid = cp_info[cp].tid;
@@ -321,6 +321,31 @@ static void cache_discard(IF_MV_NONVOID(struct bpb *fat_bpb))
     dc_unlock_cache();
 }
 
+#ifdef DC_READAHEAD
+/* returns the number of sectors from secnum that are contiguous on the disk
+   with it for the purpose of reading ahead: the rest of the FAT, of the FAT16
+   root directory or of the cluster */
+static unsigned int cache_readahead_limit(struct bpb *fat_bpb,
+                                          unsigned long secnum)
+{
+    unsigned long end;
+
+    if (IS_FAT_SECTOR(fat_bpb, secnum))
+        end = fat_bpb->fatrgnend;
+    else if (secnum >= fat_bpb->firstdatasector)
+        end = secnum + fat_bpb->bpb_secperclus -
+              (secnum - fat_bpb->firstdatasector) % fat_bpb->bpb_secperclus;
+#ifdef HAVE_FAT16SUPPORT
+    else if (fat_bpb->is_fat16 && secnum >= fat_bpb->rootdirsector)
+        end = fat_bpb->firstdatasector;
+#endif
+    else
+        return 1;
+
+    return MIN(end - secnum, DC_READAHEAD_MAX);
+}
+#endif /* DC_READAHEAD */
+
 /* caches a FAT or data area sector */
 static void * cache_sector(struct bpb *fat_bpb, unsigned long secnum)
 {
@@ -329,8 +354,20 @@ static void * cache_sector(struct bpb *fat_bpb, unsigned long secnum)
 
     if (!flags)
     {
+        void *readbuf = buf;
+        unsigned int count = 1;
+
+    #ifdef DC_READAHEAD
+        count = cache_readahead_limit(fat_bpb, secnum);
+        void *rabuf = dc_readahead_begin(IF_MV(fat_bpb->volume,) secnum,
+                                         &count);
+        if (rabuf)
+            readbuf = rabuf;
+    #endif /* DC_READAHEAD */
+
         int rc = storage_read_sectors(IF_MD(fat_bpb->drive,)
-                                      secnum + fat_bpb->startsector, 1, buf);
+                                      secnum + fat_bpb->startsector, count,
+                                      readbuf);
         if (UNLIKELY(rc < 0))
         {
             DEBUGF("%s() - Could not read sector %ld"
@@ -338,6 +375,11 @@ static void * cache_sector(struct bpb *fat_bpb, unsigned long secnum)
             dc_discard_buf(buf);
             return NULL;
         }
+
+    #ifdef DC_READAHEAD
+        if (rabuf)
+            dc_readahead_finish(IF_MV(fat_bpb->volume,) secnum, count, buf);
+    #endif
     }
 
     return buf;
@@ -2337,9 +2379,119 @@ fat_error:
 void fat_filestr_init(struct fat_filestr *fatstr, struct fat_file *file)
 {
     fatstr->fatfilep = file;
+#ifdef FAT_EXTENT_CACHE
+    fatstr->extents  = NULL;
+#endif
     fat_rewind(fatstr);
 }
 
+#ifdef FAT_EXTENT_CACHE
+void fat_extent_map_init(struct fat_extent_map *map)
+{
+    map->firstcluster = -1; /* no file's */
+    map->clustercount = 0;
+    map->count        = 0;
+}
+
+/* record the cluster at cluster number 'clusternum' of the file if it
+   directly follows the part already mapped */
+static void extent_map_add(struct fat_extent_map *map, long clusternum,
+                           long cluster)
+{
+    if (clusternum != map->clustercount)
+        return;
+
+    if (map->count)
+    {
+        struct fat_extent *run = &map->run[map->count - 1];
+        if (run->cluster + (clusternum - run->clusternum) == cluster)
+        {
+            /* extends the last run */
+            map->clustercount++;
+            return;
+        }
+    }
+
+    if (map->count >= FAT_EXTENT_COUNT)
+        return; /* full; the rest will have to be followed */
+
+    map->run[map->count].clusternum = clusternum;
+    map->run[map->count].cluster    = cluster;
+    map->count++;
+    map->clustercount++;
+}
+
+/* returns the stream's map after making sure it still describes the file;
+   if the chain now starts elsewhere, the file was emptied or removed */
+static struct fat_extent_map * extent_map_get(const struct fat_filestr *filestr)
+{
+    struct fat_extent_map *map = filestr->extents;
+    long firstcluster = filestr->fatfilep->firstcluster;
+
+    if (map && map->firstcluster != firstcluster)
+    {
+        fat_extent_map_init(map);
+        map->firstcluster = firstcluster;
+
+        if (firstcluster > 0)
+            extent_map_add(map, 0, firstcluster);
+    }
+
+    return map;
+}
+
+/* returns the cluster at cluster number 'clusternum' of the file if it is
+   mapped or else 0 */
+static long extent_map_lookup(const struct fat_extent_map *map,
+                              long clusternum)
+{
+    if (clusternum >= map->clustercount)
+        return 0;
+
+    /* find the last run starting at or before it */
+    unsigned int lo = 0, hi = map->count;
+    while (hi - lo > 1)
+    {
+        unsigned int mid = (lo + hi) / 2;
+        if (map->run[mid].clusternum <= clusternum)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return map->run[lo].cluster + (clusternum - map->run[lo].clusternum);
+}
+#endif /* FAT_EXTENT_CACHE */
+
+/* returns the cluster after 'cluster', which is at cluster number
+   'clusternum' of the stream's file, allocating one if writing */
+static long filestr_next_cluster(struct bpb *fat_bpb,
+                                 const struct fat_filestr *filestr,
+                                 long cluster, long clusternum, bool write)
+{
+#ifndef FAT_EXTENT_CACHE
+    (void)filestr; (void)clusternum;
+#else
+    struct fat_extent_map *map = extent_map_get(filestr);
+    if (map)
+    {
+        long next = extent_map_lookup(map, clusternum + 1);
+        if (next)
+            return next;
+    }
+#endif /* FAT_EXTENT_CACHE */
+
+    long next = write ? next_write_cluster(fat_bpb, cluster) :
+                        get_next_cluster(fat_bpb, cluster);
+
+#ifdef FAT_EXTENT_CACHE
+    if (map && next > 0)
+        extent_map_add(map, clusternum + 1, next);
+#endif
+
+    return next;
+}
+
 unsigned long fat_query_sectornum(const struct fat_filestr *filestr)
 {
     /* return next sector number to be transferred */
@@ -2469,8 +2621,8 @@ long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
         if (++sectornum >= fat_bpb->bpb_secperclus)
         {
             /* out of sectors in this cluster; get the next cluster */
-            long newcluster = write ? next_write_cluster(fat_bpb, cluster) :
-                                      get_next_cluster(fat_bpb, cluster);
+            long newcluster = filestr_next_cluster(fat_bpb, filestr, cluster,
+                                                   clusternum, write);
             if (newcluster)
             {
                 cluster = newcluster;
@@ -2586,23 +2738,34 @@ int fat_seek(struct fat_filestr *filestr, unsigned long seeksector)
         clusternum = seeksector / fat_bpb->bpb_secperclus;
         sectornum = seeksector % fat_bpb->bpb_secperclus;
 
-        long numclusters = clusternum;
+        long num = 0; /* cluster number of 'cluster' */
 
-        if (filestr->clusternum && clusternum >= filestr->clusternum)
+    #ifdef FAT_EXTENT_CACHE
+        /* go straight to as far along as is mapped */
+        struct fat_extent_map *map = extent_map_get(filestr);
+        if (map && map->clustercount)
+        {
+            num = MIN(clusternum, map->clustercount - 1);
+            cluster = extent_map_lookup(map, num);
+        }
+    #endif /* FAT_EXTENT_CACHE */
+
+        if (filestr->clusternum > num && clusternum >= filestr->clusternum)
         {
             /* seek forward from current position */
             cluster = filestr->lastcluster;
-            numclusters -= filestr->clusternum;
+            num = filestr->clusternum;
         }
 
-        for (long i = 0; i < numclusters; i++)
+        for (; num < clusternum; num++)
         {
-            cluster = get_next_cluster(fat_bpb, cluster);
+            cluster = filestr_next_cluster(fat_bpb, filestr, cluster, num,
+                                           false);
 
             if (!cluster)
             {
                 DEBUGF("Seeking beyond the end of the file! "
-                       "(sector %lu, cluster %ld)\n", seeksector, i);
+                       "(sector %lu, cluster %ld)\n", seeksector, num);
                 FAT_ERROR(FAT_SEEK_EOF);
             }
         }
@@ -2636,6 +2799,23 @@ int fat_truncate(const struct fat_filestr *filestr)
     long last = filestr->lastcluster;
     long next = 0;
 
+#ifdef FAT_EXTENT_CACHE
+    /* forget whatever is mapped past the new end */
+    struct fat_extent_map *map = extent_map_get(filestr);
+    if (map)
+    {
+        if (!last)
+            fat_extent_map_init(map);
+        else if (map->clustercount > filestr->clusternum + 1)
+        {
+            map->clustercount = filestr->clusternum + 1;
+            while (map->count &&
+                   map->run[map->count - 1].clusternum >= map->clustercount)
+                map->count--;
+        }
+    }
+#endif /* FAT_EXTENT_CACHE */
+
     /* truncate trailing clusters after the current position */
     if (last)
     {
@@ -2685,22 +2865,38 @@ int fat_readdir(struct fat_filestr *dirstr, struct fat_dirscan_info *scan,
         unsigned long sector = direntry / DIR_ENTRIES_PER_SECTOR;
         if (cachep->sector != sector)
         {
-            if (cachep->sector + 1 != sector)
+            /* read it through the disk cache, which sees any pending changes
+               and can read ahead; seeking to the next sector is cheap when
+               reading sequentially */
+            struct bpb *fat_bpb = FAT_BPB(dirstr->fatfilep->volume);
+            if (!fat_bpb)
+                FAT_ERROR(-4);
+
+            int rc2 = fat_seek(dirstr, sector + 1);
+            if (rc2 < 0)
             {
-                /* Nothing cached or sector isn't contiguous */
-                int rc2 = fat_seek(dirstr, sector);
-                if (rc2 < 0)
-                    FAT_ERROR(rc2 * 10 - 2);
+                if (rc2 == FAT_SEEK_EOF)
+                {
+                    fat_seek(dirstr, sector);
+                    dirstr->eof = true;
+                    break; /* eof */
+                }
+
+                FAT_ERROR(rc2 * 10 - 2);
             }
 
-            int rc2 = fat_readwrite(dirstr, 1, cachep->buffer, false);
-            if (rc2 <= 0)
-            {
-                if (rc2 == 0)
-                    break; /* eof */
+            dc_lock_cache();
 
-                DEBUGF("%s() - Couldn't read dir (err %d)\n", __func__, rc);
-                FAT_ERROR(rc2 * 10 - 3);
+            void *buf = cache_sector(fat_bpb, dirstr->lastsector);
+            if (buf)
+                memcpy(cachep->buffer, buf, SECTOR_SIZE);
+
+            dc_unlock_cache();
+
+            if (!buf)
+            {
+                DEBUGF("%s() - Couldn't read dir\n", __func__);
+                FAT_ERROR(-3);
             }
 
             cachep->sector = sector;
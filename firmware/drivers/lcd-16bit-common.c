@@ -538,6 +538,39 @@ static inline unsigned blend_two_colors(unsigned c1, unsigned c2, unsigned a)
 #endif
 }
 
+/* The 16 possible results of blending a fixed fore- and background, which
+ * is what anti-aliased text in DRMODE_SOLID boils down to. Two pairs are
+ * kept so that alternating e.g. normal and selected list lines doesn't
+ * rebuild them all the time. */
+#define ALPHA_LUT_SLOTS 2
+static struct alpha_lut {
+    unsigned fg, bg;
+    bool valid;
+    fb_data color[ALPHA_COLOR_LOOKUP_SIZE + 1];
+} alpha_luts[ALPHA_LUT_SLOTS];
+static int alpha_lut_next;
+
+/* must be called between BLEND_INIT and BLEND_FINISH */
+static const fb_data *get_alpha_lut(unsigned fg, unsigned bg)
+{
+    struct alpha_lut *lut;
+    for (int i = 0; i < ALPHA_LUT_SLOTS; i++)
+    {
+        lut = &alpha_luts[i];
+        if (lut->valid && lut->fg == fg && lut->bg == bg)
+            return lut->color;
+    }
+
+    lut = &alpha_luts[alpha_lut_next];
+    alpha_lut_next = (alpha_lut_next + 1) % ALPHA_LUT_SLOTS;
+    for (unsigned a = 0; a <= ALPHA_COLOR_LOOKUP_SIZE; a++)
+        lut->color[a] = blend_two_colors(bg, fg, a);
+    lut->fg = fg;
+    lut->bg = bg;
+    lut->valid = true;
+    return lut->color;
+}
+
 /* Blend an image with an alpha channel
  * if image is NULL, drawing will happen according to the drawmode
  * src is the alpha channel (4bit per pixel) */
@@ -661,6 +694,11 @@ static void ICODE_ATTR lcd_alpha_bitmap_part_mix(const fb_data* image,
     pixels = 8 - pixels;
 #endif
 
+    /* fixed colours on both sides, no blending left to do per pixel */
+    const fb_data *lut = NULL;
+    if (drmode == DRMODE_SOLID)
+        lut = get_alpha_lut(current_vp->fg_pattern, current_vp->bg_pattern);
+
     /* image is only accessed in DRMODE_INT_IMG cases, i.e. when non-NULL.
      * Therefore NULL accesses are impossible and we can increment
      * unconditionally (applies for stride at the end of the loop as well) */
@@ -730,7 +768,12 @@ static void ICODE_ATTR lcd_alpha_bitmap_part_mix(const fb_data* image,
                 bg = current_vp->bg_pattern;
                 do
                 {
-                    *dst = blend_two_colors(bg, *dst, data & ALPHA_COLOR_LOOKUP_SIZE );
+                    unsigned a = data & ALPHA_COLOR_LOOKUP_SIZE;
+                    /* most glyph pixels are either fully on or off */
+                    if (a == ALPHA_COLOR_LOOKUP_SIZE)
+                        *dst = bg;
+                    else if (a != 0)
+                        *dst = blend_two_colors(bg, *dst, a);
                     dst += COL_INC;
                     UPDATE_SRC_ALPHA;
                 }
@@ -750,7 +793,12 @@ static void ICODE_ATTR lcd_alpha_bitmap_part_mix(const fb_data* image,
                 fg = current_vp->fg_pattern;
                 do
                 {
-                    *dst = blend_two_colors(*dst, fg, data & ALPHA_COLOR_LOOKUP_SIZE );
+                    unsigned a = data & ALPHA_COLOR_LOOKUP_SIZE;
+                    /* most glyph pixels are either fully on or off */
+                    if (a == 0)
+                        *dst = fg;
+                    else if (a != ALPHA_COLOR_LOOKUP_SIZE)
+                        *dst = blend_two_colors(*dst, fg, a);
                     dst += COL_INC;
                     UPDATE_SRC_ALPHA;
                 }
@@ -792,11 +840,9 @@ static void ICODE_ATTR lcd_alpha_bitmap_part_mix(const fb_data* image,
                 while (--col);
                 break;
             case DRMODE_SOLID:
-                bg = current_vp->bg_pattern;
-                fg = current_vp->fg_pattern;
                 do
                 {
-                    *dst = blend_two_colors(bg, fg, data & ALPHA_COLOR_LOOKUP_SIZE );
+                    *dst = lut[data & ALPHA_COLOR_LOOKUP_SIZE];
                     dst += COL_INC;
                     UPDATE_SRC_ALPHA;
                 }
@@ -118,14 +118,192 @@ void LCDFN(update_viewport_rect)(int x, int y, int width, int height)
     LCDFN(update_rect)(current_vp->x + x, current_vp->y + y, width, height);
 }
 
+#ifdef HAVE_LCD_LINE_CACHE
+/* Rendered text line cache.
+ *
+ * A string is rasterized once into a mask in the format the font already
+ * uses (mono or 4-bit alpha) and afterwards drawn with a single bitmap blit.
+ * The mask only holds coverage, so colours, draw mode and line styles are
+ * still applied at blit time and don't need to be part of the key.
+ * Masks are packed in pool order; evicting one slides the rest down. */
+#define LINE_CACHE_ENTRIES 16
+
+struct line_cache_entry {
+    size_t offset;          /* mask position in the pool, string follows */
+    size_t mask_size;
+    size_t size;            /* total bytes taken from the pool */
+    unsigned long last_used;
+    uint32_t hash;
+    int font;
+    int width, height;
+    bool alpha;
+    size_t len;
+};
+
+static struct {
+    struct line_cache_entry entry[LINE_CACHE_ENTRIES];
+    int count;
+    size_t used;
+    unsigned long stamp;
+    unsigned int font_generation;
+    bool busy;  /* an entry is being rendered, glyph loading may yield */
+    unsigned char pool[LCDM(LINE_CACHE_SIZE)] __attribute__((aligned(4)));
+} LCDFN(line_cache);
+
+static void LCDFN(line_cache_evict)(int index)
+{
+    struct line_cache_entry *e = &LCDFN(line_cache).entry[index];
+    size_t end = e->offset + e->size;
+    size_t size = e->size;
+
+    memmove(&LCDFN(line_cache).pool[e->offset], &LCDFN(line_cache).pool[end],
+            LCDFN(line_cache).used - end);
+    LCDFN(line_cache).used -= size;
+    LCDFN(line_cache).count--;
+    for (int i = index; i < LCDFN(line_cache).count; i++)
+    {
+        LCDFN(line_cache).entry[i] = LCDFN(line_cache).entry[i+1];
+        LCDFN(line_cache).entry[i].offset -= size;
+    }
+}
+
+/* OR a glyph into a line mask at column x; alpha masks keep the most
+ * opaque value instead (0 is opaque) */
+static void LCDFN(line_cache_put_glyph)(unsigned char *mask, int stride,
+                                        bool alpha, const unsigned char *bits,
+                                        int width, int height, int x)
+{
+    int first = MAX(0, -x);
+    int last = MIN(width, stride - x);
+
+#if defined(MAIN_LCD) && defined(HAVE_LCD_COLOR)
+    if (alpha)
+    {
+        for (int row = 0; row < height; row++)
+        {
+            for (int col = first; col < last; col++)
+            {
+                int si = row * width + col;
+                int di = row * stride + x + col;
+                int sshift = (si & 1) << 2, dshift = (di & 1) << 2;
+                unsigned a = (bits[si >> 1] >> sshift) & 0xf;
+                if (a < ((mask[di >> 1] >> dshift) & 0xfu))
+                    mask[di >> 1] = (mask[di >> 1] & ~(0xf << dshift))
+                                  | (a << dshift);
+            }
+        }
+        return;
+    }
+#else
+    (void)alpha;
+#endif
+
+    for (int band = 0; band < (height + 7) / 8; band++)
+    {
+        unsigned char *dst = &mask[band * stride + x];
+        const unsigned char *src = &bits[band * width];
+        for (int col = first; col < last; col++)
+            dst[col] |= src[col];
+    }
+}
+
+static void LCDFN(putsxyofs_glyphs)(struct font *pf, int x, int y, int ofs,
+                                    const unsigned char *str,
+                                    unsigned char *mask, int mask_width);
+
+/* look up str in the cache, rendering it on a miss. Returns NULL if the
+ * string can't be cached and needs to be drawn glyph by glyph */
+static struct line_cache_entry *
+LCDFN(line_cache_get)(struct font *pf, const unsigned char *str)
+{
+    struct line_cache_entry *e;
+    unsigned int generation = font_get_generation();
+    size_t len = strlen((const char *)str);
+    uint32_t hash = 2166136261u;
+    bool alpha = pf->depth != 0;
+
+#if !defined(MAIN_LCD) || !defined(HAVE_LCD_COLOR)
+    if (alpha)
+        return NULL;
+#endif
+    if (LCDFN(line_cache).busy)
+        return NULL;
+
+    if (generation != LCDFN(line_cache).font_generation)
+    {
+        LCDFN(line_cache).count = 0;
+        LCDFN(line_cache).used = 0;
+        LCDFN(line_cache).font_generation = generation;
+    }
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ str[i]) * 16777619u;
+
+    for (int i = 0; i < LCDFN(line_cache).count; i++)
+    {
+        e = &LCDFN(line_cache).entry[i];
+        if (e->hash == hash && e->font == current_vp->font && e->len == len &&
+            !memcmp(&LCDFN(line_cache).pool[e->offset + e->mask_size], str, len))
+        {
+            e->last_used = ++LCDFN(line_cache).stamp;
+            return e;
+        }
+    }
+
+    int width = LCDFN(getstringsize)(str, NULL, NULL);
+    int height = pf->height;
+    size_t mask_size = alpha ? ((size_t)width * height + 1) / 2
+                             : (size_t)width * ((height + 7) / 8);
+    size_t size = ALIGN_UP(mask_size + len + 1, 4);
+
+    /* don't let a single huge line wipe out everything else */
+    if (width <= 0 || size > sizeof(LCDFN(line_cache).pool) / 2)
+        return NULL;
+
+    while (LCDFN(line_cache).count == LINE_CACHE_ENTRIES ||
+           LCDFN(line_cache).used + size > sizeof(LCDFN(line_cache).pool))
+    {
+        int lru = 0;
+        for (int i = 1; i < LCDFN(line_cache).count; i++)
+        {
+            if (LCDFN(line_cache).entry[i].last_used <
+                LCDFN(line_cache).entry[lru].last_used)
+                lru = i;
+        }
+        LCDFN(line_cache_evict)(lru);
+    }
+
+    e = &LCDFN(line_cache).entry[LCDFN(line_cache).count++];
+    e->offset = LCDFN(line_cache).used;
+    e->mask_size = mask_size;
+    e->size = size;
+    e->last_used = ++LCDFN(line_cache).stamp;
+    e->hash = hash;
+    e->font = current_vp->font;
+    e->width = width;
+    e->height = height;
+    e->alpha = alpha;
+    e->len = len;
+    LCDFN(line_cache).used += size;
+
+    unsigned char *mask = &LCDFN(line_cache).pool[e->offset];
+    memset(mask, alpha ? 0xff : 0, mask_size);
+    memcpy(mask + mask_size, str, len + 1);
+
+    LCDFN(line_cache).busy = true;
+    LCDFN(putsxyofs_glyphs)(pf, 0, 0, 0, str, mask, width);
+    LCDFN(line_cache).busy = false;
+
+    return e;
+}
+#endif /* HAVE_LCD_LINE_CACHE */
+
 /* put a string at a given pixel position, skipping first ofs pixel columns */
 static void LCDFN(putsxyofs)(int x, int y, int ofs, const unsigned char *str)
 {
-    unsigned short *ucs;
     font_lock(current_vp->font, true);
     struct font* pf = font_get(current_vp->font);
     int vp_flags = current_vp->flags;
-    int rtl_next_non_diac_width, last_non_diacritic_width;
 
     if ((vp_flags & VP_FLAG_ALIGNMENT_MASK) != 0)
     {
@@ -147,6 +325,37 @@ static void LCDFN(putsxyofs)(int x, int y, int ofs, const unsigned char *str)
         }
     }
 
+#ifdef HAVE_LCD_LINE_CACHE
+    struct line_cache_entry *e = LCDFN(line_cache_get)(pf, str);
+    if (e)
+    {
+        const unsigned char *mask = &LCDFN(line_cache).pool[e->offset];
+#if defined(MAIN_LCD) && defined(HAVE_LCD_COLOR)
+        if (e->alpha)
+            lcd_alpha_bitmap_part(mask, ofs, 0, e->width, x, y,
+                                  e->width - ofs, e->height);
+        else
+#endif
+            LCDFN(mono_bitmap_part)(mask, ofs, 0, e->width, x, y,
+                                    e->width - ofs, e->height);
+    }
+    else
+#endif
+        LCDFN(putsxyofs_glyphs)(pf, x, y, ofs, str, NULL, 0);
+
+    font_lock(current_vp->font, false);
+}
+
+/* draw str glyph by glyph, either to the display or, if mask is given,
+ * into a line cache mask mask_width pixels wide */
+static void LCDFN(putsxyofs_glyphs)(struct font *pf, int x, int y, int ofs,
+                                    const unsigned char *str,
+                                    unsigned char *mask, int mask_width)
+{
+    unsigned short *ucs;
+    int rtl_next_non_diac_width, last_non_diacritic_width;
+    int limit = mask ? mask_width : current_vp->width;
+
     rtl_next_non_diac_width = 0;
     last_non_diacritic_width = 0;
     /* Mark diacritic and rtl flags for each character */
@@ -157,7 +366,7 @@ static void LCDFN(putsxyofs)(int x, int y, int ofs, const unsigned char *str)
         int width, base_width, drawmode = 0, base_ofs = 0;
         const unsigned short next_ch = ucs[1];
 
-        if (x >= current_vp->width)
+        if (x >= limit)
             break;
 
         is_diac = is_diacritic(*ucs, &is_rtl);
@@ -203,40 +412,53 @@ static void LCDFN(putsxyofs)(int x, int y, int ofs, const unsigned char *str)
         }
 
         if (is_diac)
-        {
-            /* XXX: Suggested by amiconn:
-             * This will produce completely wrong results if the original
-             * drawmode is DRMODE_COMPLEMENT. We need to pre-render the current
-             * character with all its diacritics at least (in mono) and then
-             * finally draw that. And we'll need an extra buffer that can hold
-             * one char's bitmap. Basically we can't just change the draw mode
-             * to something else irrespective of the original mode and expect
-             * the result to look as intended and with DRMODE_COMPLEMENT (which
-             * means XORing pixels), overdrawing this way will cause odd results
-             * if the diacritics and the base char both have common pixels set.
-             * So we need to combine the char and its diacritics in a temp
-             * buffer using OR, and then draw the final bitmap instead of the
-             * chars, without touching the drawmode
-             **/
-            drawmode = current_vp->drawmode;
-            current_vp->drawmode = DRMODE_FG;
-
             base_ofs = (base_width - width) / 2;
-        }
 
         bits = font_get_bits(pf, *ucs);
 
-#if defined(MAIN_LCD) && defined(HAVE_LCD_COLOR)
-        if (pf->depth)
-            lcd_alpha_bitmap_part(bits, ofs, 0, width, x + base_ofs, y,
-                                  width - ofs, pf->height);
+#ifdef HAVE_LCD_LINE_CACHE
+        if (mask)
+        {
+            /* the mask is combined with OR, so diacritics come out right
+             * here whatever the drawmode is when the line gets drawn */
+            LCDFN(line_cache_put_glyph)(mask, mask_width, pf->depth, bits,
+                                        width, pf->height, x + base_ofs);
+        }
         else
 #endif
-            LCDFN(mono_bitmap_part)(bits, ofs, 0, width, x + base_ofs,
-                                    y, width - ofs, pf->height);
-        if (is_diac)
         {
-            current_vp->drawmode = drawmode;
+            if (is_diac)
+            {
+                /* XXX: Suggested by amiconn:
+                 * This will produce completely wrong results if the original
+                 * drawmode is DRMODE_COMPLEMENT. We need to pre-render the current
+                 * character with all its diacritics at least (in mono) and then
+                 * finally draw that. And we'll need an extra buffer that can hold
+                 * one char's bitmap. Basically we can't just change the draw mode
+                 * to something else irrespective of the original mode and expect
+                 * the result to look as intended and with DRMODE_COMPLEMENT (which
+                 * means XORing pixels), overdrawing this way will cause odd results
+                 * if the diacritics and the base char both have common pixels set.
+                 * So we need to combine the char and its diacritics in a temp
+                 * buffer using OR, and then draw the final bitmap instead of the
+                 * chars, without touching the drawmode
+                 **/
+                drawmode = current_vp->drawmode;
+                current_vp->drawmode = DRMODE_FG;
+            }
+
+#if defined(MAIN_LCD) && defined(HAVE_LCD_COLOR)
+            if (pf->depth)
+                lcd_alpha_bitmap_part(bits, ofs, 0, width, x + base_ofs, y,
+                                      width - ofs, pf->height);
+            else
+#endif
+                LCDFN(mono_bitmap_part)(bits, ofs, 0, width, x + base_ofs,
+                                        y, width - ofs, pf->height);
+            if (is_diac)
+            {
+                current_vp->drawmode = drawmode;
+            }
         }
 
         if (next_ch)
@@ -255,7 +477,6 @@ static void LCDFN(putsxyofs)(int x, int y, int ofs, const unsigned char *str)
             }
         }
     }
-    font_lock(current_vp->font, false);
 }
 
 /*** pixel oriented text output ***/
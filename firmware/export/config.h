@@ -902,6 +902,13 @@ Lyre prototype 1 */
 #endif
 #endif
 
+/* Hosted targets map the database files instead of loading them to RAM. */
+#if defined(APPLICATION) && defined(HAVE_TAGCACHE) && !defined(__PCTOOL__) \
+    && !defined(WIN32)
+#define HAVE_TC_RAMCACHE
+#define HAVE_TC_RAMCACHE_MMAP
+#endif
+
 #if defined(HAVE_TAGCACHE)
 #define HAVE_PICTUREFLOW_INTEGRATION
 #endif
@@ -1272,6 +1279,15 @@ Lyre prototype 1 */
 #endif /* SIMULATOR */
 #endif /* default SDL SW volume conditions */
 
+/* Hosted targets that play through ALSA (target/hosted/pcm-alsa.c) */
+#if !defined(SIMULATOR) && \
+    (defined(HIBY_LINUX) || defined(FIIO_M3K) || \
+     (defined(SAMSUNG_YPR0) && defined(HAVE_AS3514)) || \
+     (defined(SAMSUNG_YPR1) && defined(HAVE_WM8978)) || \
+     defined(HAVE_NWZ_LINUX_CODEC))
+#define HAVE_PCM_ALSA
+#endif
+
 /* null audiohw setting macro for when codec header is included for reasons
    other than audio support */
 #define AUDIOHW_SETTING(name, us, nd, st, minv, maxv, defv, expr...)
@@ -48,9 +48,24 @@
 #define FAT_MAX_TRANSFER_SIZE 256
 #endif
 
+/* number of runs of contiguous clusters remembered for each open file so
+ * that seeking doesn't have to follow the cluster chain from the start; each
+ * costs 8 bytes per file object; 0 disables it */
+#ifndef FAT_EXTENT_COUNT
+#if MEMORYSIZE >= 8
+#define FAT_EXTENT_COUNT 16
+#else
+#define FAT_EXTENT_COUNT 0
+#endif
+#endif /* FAT_EXTENT_COUNT */
+
 /**
  ****************************************************************************/
 
+#if FAT_EXTENT_COUNT > 0
+#define FAT_EXTENT_CACHE
+#endif
+
 #define INVALID_SECNUM     (0xfffffffeul) /* sequential, not FAT */
 #define FAT_MAX_FILE_SIZE  (0xfffffffful) /* 2^32-1 bytes */
 #define MAX_DIRENTRIES     65536
@@ -110,6 +125,22 @@ struct fat_file
     struct fat_dirscan_info e;  /* entry information */
 };
 
+#ifdef FAT_EXTENT_CACHE
+/* maps the start of a file's cluster chain as runs of contiguous clusters;
+   it is filled as the chain is followed and shared by all of its streams */
+struct fat_extent_map
+{
+    long         firstcluster;  /* first cluster of the file when mapped */
+    long         clustercount;  /* number of clusters mapped */
+    unsigned int count;         /* number of runs in use */
+    struct fat_extent
+    {
+        long clusternum;        /* cluster number within the file */
+        long cluster;           /* first cluster of the run */
+    } run[FAT_EXTENT_COUNT];
+};
+#endif /* FAT_EXTENT_CACHE */
+
 /* this stores what was last accessed when read or writing a file's data */
 struct fat_filestr
 {
@@ -119,6 +150,9 @@ struct fat_filestr
     long          clusternum;   /* cluster number of last access */
     unsigned long sectornum;    /* sector number within current cluster */
     bool          eof;          /* end-of-file reached */
+#ifdef FAT_EXTENT_CACHE
+    struct fat_extent_map *extents; /* file's cluster map (NULL if none) */
+#endif
 };
 
 /** File entity functions **/
@@ -145,6 +179,9 @@ int fat_rename(struct fat_file *parent, struct fat_file *file,
 int fat_closewrite(struct fat_filestr *filestr, uint32_t size,
                    struct fat_direntry *fatentp);
 void fat_filestr_init(struct fat_filestr *filestr, struct fat_file *file);
+#ifdef FAT_EXTENT_CACHE
+void fat_extent_map_init(struct fat_extent_map *map);
+#endif
 unsigned long fat_query_sectornum(const struct fat_filestr *filestr);
 long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
                    void *buf, bool write);
@@ -130,6 +130,21 @@ void font_disable_all(void);
 /* Re-opens the file descriptor of the font file. Should be called as
  * counter-part of font_disable_all(); */
 void font_enable_all(void);
+/* Changes every time a font is loaded, unloaded, disabled or enabled, so
+ * anything caching rendered text knows when to drop it */
+unsigned int font_get_generation(void);
+
+/* Glyph cache usage of a font loaded from disk */
+struct font_cache_stats {
+    int glyphs;              /* glyphs currently cached */
+    int capacity;            /* glyphs the cache can hold */
+    size_t bytes;            /* size of the cache buffer */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+/* false if font_id isn't loaded or is entirely in RAM */
+bool font_get_cache_stats(int font_id, struct font_cache_stats *stats);
 
 struct font* font_get(int font);
 
@@ -109,4 +109,15 @@ extern struct scroll_screen_info lcd_scroll_info;
 extern struct scroll_screen_info lcd_remote_scroll_info;
 #endif
 
+/* Rendered text lines are cached by the bitmap LCD drivers so redrawing an
+ * unchanged string, e.g. on each scroll step, is a single blit. Sizes are
+ * the bytes of glyph masks kept per display. */
+#if !defined(BOOTLOADER) && (MEMORYSIZE >= 8)
+#define HAVE_LCD_LINE_CACHE
+#define LCD_LINE_CACHE_SIZE (LCD_WIDTH*64)
+#ifdef HAVE_REMOTE_LCD
+#define LCD_REMOTE_LINE_CACHE_SIZE (LCD_REMOTE_WIDTH*16)
+#endif
+#endif
+
 #endif /* __SCROLL_ENGINE_H__ */
@@ -58,6 +58,8 @@
 #endif
 #endif
 #define GLYPHS_TO_CACHE 256
+/* a shrunk glyph cache never drops below this */
+#define GLYPHS_MIN_CACHE 32
 
 #if MEMORYSIZE < 4
 #define FONT_HARD_LIMIT
@@ -94,6 +96,8 @@ struct buflib_alloc_data {
     unsigned char buffer[];
 };
 static int buflib_allocations[MAXFONTS];
+/* bumped whenever what a font id draws may have changed */
+static unsigned int font_generation;
 
 static int cache_fd;
 static struct font* cache_pf;
@@ -143,8 +147,6 @@ void font_lock(int font_id, bool lock)
         lock_font_handle(buflib_allocations[font_id], lock);
 }
 
-static struct buflib_callbacks buflibops = {buflibmove_callback, NULL, NULL };
-
 static inline struct font *pf_from_handle(int handle)
 {
     struct buflib_alloc_data *alloc = core_get_data(handle);
@@ -162,6 +164,7 @@ static inline unsigned char *buffer_from_handle(int handle)
 /* Font cache structures */
 static void cache_create(struct font* pf);
 static void glyph_cache_load(const char *font_path, struct font *pf);
+static void font_path_to_glyph_path(const char *font_path, char *glyph_path);
 /* End Font cache structures */
 
 void font_init(void)
@@ -402,6 +405,63 @@ static struct font* font_load_header(int fd, struct font *pheader,
     return pf;
 }
 
+/* Give back the tail of the glyph cache when buflib runs out of memory.
+ * The cache is recreated empty in the smaller buffer and refills on demand,
+ * but it is never made smaller than the glyphs it currently holds. */
+static int buflibshrink_callback(int handle, unsigned hints, void* start,
+                                 size_t old_size)
+{
+    (void)old_size;
+    struct buflib_alloc_data *alloc = (struct buflib_alloc_data*)start;
+    struct font *pf = &alloc->font;
+    size_t size_hint = hints & BUFLIB_SHRINK_SIZE_MASK;
+
+    /* the font struct sits at the front, so only the back can go. Fonts
+     * without an open file can't refill so they must keep their glyphs */
+    if (alloc->handle_locks > 0 || pf->fd < 0 ||
+        !(hints & BUFLIB_SHRINK_POS_BACK))
+        return BUFLIB_CB_CANNOT_SHRINK;
+
+    int keep = pf->cache._size + pf->cache._size / 4;
+    if (keep < GLYPHS_MIN_CACHE)
+        keep = GLYPHS_MIN_CACHE;
+    /* cache_create() reserves a blank glyph and may align by 1 */
+    size_t min_size = font_glyphs_to_bufsize(pf, keep) +
+                      glyph_bytes(pf, pf->maxwidth) + 1;
+    size_t new_size = pf->buffer_size > size_hint ?
+                      pf->buffer_size - size_hint : 0;
+    if (new_size < min_size)
+        new_size = min_size;
+    if (new_size >= pf->buffer_size)
+        return BUFLIB_CB_CANNOT_SHRINK;
+
+    pf->buffer_size = new_size;
+    pf->buffer_end = pf->buffer_start + new_size;
+    cache_create(pf);
+
+    core_shrink(handle, start, sizeof(struct buflib_alloc_data) + new_size);
+    return BUFLIB_CB_OK;
+}
+
+static struct buflib_callbacks buflibops = {
+    .move_callback = buflibmove_callback,
+    .shrink_callback = buflibshrink_callback,
+};
+
+/* number of glyphs listed in the .gc file of a font, 0 if there is none */
+static int glyph_cache_file_glyphs(const char *font_path)
+{
+    char filename[MAX_PATH];
+    font_path_to_glyph_path(font_path, filename);
+
+    int fd = open(filename, O_RDONLY|O_BINARY);
+    if (fd < 0)
+        return 0;
+    int glyphs = filesize(fd) / 2;
+    close(fd);
+    return glyphs;
+}
+
 /* load a font with room for glyphs, limited to bufsize if not zero */
 int font_load_ex( const char *path, size_t buf_size, int glyphs )
 {
@@ -426,6 +486,25 @@ int font_load_ex( const char *path, size_t buf_size, int glyphs )
         return -1;
     }
 
+    /* check already loaded */
+    int font_id = find_font_index(path);
+
+    if (glyphs)
+    {
+        if (font_id > FONT_SYSFIXED)
+        {
+            /* grow a cache that can't hold its working set */
+            struct font *pf = pf_from_handle(buflib_allocations[font_id]);
+            if (pf->fd >= 0 && font_cache_thrashing(&pf->cache))
+                glyphs = MAX(glyphs, 2*pf->cache._capacity);
+        }
+        else
+        {
+            /* keep the size a previous session grew the cache to */
+            glyphs = MAX(glyphs, glyph_cache_file_glyphs(path));
+        }
+    }
+
     /* examine f and calc buffer size */
     bool cached = false;
     size_t bufsize = buf_size;
@@ -448,9 +527,6 @@ int font_load_ex( const char *path, size_t buf_size, int glyphs )
         cached = true;
     else
         bufsize = file_size;
-    
-    /* check already loaded */
-    int font_id = find_font_index(path);
 
     if (font_id > FONT_SYSFIXED)
     {
@@ -575,6 +651,7 @@ int font_load_ex( const char *path, size_t buf_size, int glyphs )
         }
     }
     buflib_allocations[font_id] = handle;
+    font_generation++;
     //printf("%s -> [%d] -> %d\n", path, font_id, *handle);
     lock_font_handle( handle, false );
     return font_id; /* success!*/
@@ -606,6 +683,7 @@ void font_unload(int font_id)
         if (handle > 0)
             core_free(handle);
         buflib_allocations[font_id] = -1;
+        font_generation++;
 
     }
 }
@@ -642,6 +720,7 @@ static void font_disable(int font_id)
         close(pf->fd);
         pf->fd = -1;
         pf->disabled = true;
+        font_generation++;
     }
 }
 
@@ -666,6 +745,7 @@ static void font_enable(int font_id)
         const char *filename = font_filename(font_id);
         pf->fd = open(filename, O_RDONLY);
         pf->disabled = false;
+        font_generation++;
     }
 }
 
@@ -675,6 +755,31 @@ void font_enable_all(void)
         font_enable(i);
 }
 
+unsigned int font_get_generation(void)
+{
+    return font_generation;
+}
+
+bool font_get_cache_stats(int font_id, struct font_cache_stats *stats)
+{
+    if ( font_id < 0 || font_id >= MAXFONTS )
+        return false;
+    int handle = buflib_allocations[font_id];
+    if ( handle < 0 )
+        return false;
+    struct font *pf = pf_from_handle(handle);
+    if (pf->fd < 0 && !pf->disabled)
+        return false; /* entirely in RAM, no cache */
+
+    stats->glyphs = pf->cache._size - 1;
+    stats->capacity = pf->cache._capacity;
+    stats->bytes = pf->buffer_size;
+    stats->hits = pf->cache.hits;
+    stats->misses = pf->cache.misses;
+    stats->evictions = pf->cache.evictions;
+    return true;
+}
+
 
 /*
  * Return a pointer to an incore font structure.
@@ -863,6 +968,17 @@ static void font_path_to_glyph_path( const char *font_path, char *glyph_path)
     strcat(glyph_path, ".gc");
 }
 
+/* log2 of the use count, glyph_cache_save() writes one class per pass */
+static int glyph_use_class(unsigned char uses)
+{
+    int class = 0;
+    while (uses >>= 1)
+        class++;
+    return class;
+}
+#define GLYPH_USE_CLASSES 8
+static int cache_class;
+
 /* call with NULL to flush */
 static void glyph_file_write(void* data)
 {
@@ -873,6 +989,9 @@ static void glyph_file_write(void* data)
 #define WRITE_BUFFER 256
     static unsigned char buffer[WRITE_BUFFER];
 
+    if ( p && glyph_use_class(p->uses) != cache_class )
+        return;
+
     /* flush buffer & reset */
     if ( data == NULL || buffer_pos >= WRITE_BUFFER)
     {
@@ -891,7 +1010,10 @@ static void glyph_file_write(void* data)
     return;
 }
 
-/* save the char codes of the loaded glyphs to a file */
+/* save the char codes of the loaded glyphs to a file, least used first.
+ * glyph_cache_load() keeps the tail of the file if it doesn't all fit and
+ * replays it in order, so the most used glyphs survive and end up as the
+ * most recently used ones */
 static void glyph_cache_save(int font_id)
 {
     int fd;
@@ -913,7 +1035,8 @@ static void glyph_cache_save(int font_id)
 
         cache_pf = pf;
         cache_fd = fd;
-        lru_traverse(&cache_pf->cache._lru, glyph_file_write);
+        for (cache_class = 0; cache_class < GLYPH_USE_CLASSES; cache_class++)
+            lru_traverse(&cache_pf->cache._lru, glyph_file_write);
         glyph_file_write(NULL);
         if (cache_fd >= 0) 
         {
@@ -54,6 +54,9 @@ void font_cache_create(
     fcache->_capacity = cache_size;
     fcache->_prev_result = 0;
     fcache->_prev_char_code = 0;
+    fcache->hits = 0;
+    fcache->misses = 0;
+    fcache->evictions = 0;
 
     /* set up index */
     fcache->_index = buf;
@@ -153,7 +156,10 @@ struct font_cache_entry* font_cache_get(
                 if (p->_char_code == char_code)
                 {
                     lru_touch(&fcache->_lru, lru_handle);
-                    return lru_data(&fcache->_lru, lru_handle);
+                    fcache->hits++;
+                    if (p->uses < 0xff)
+                        p->uses++;
+                    return p;
                 }
             }
             else
@@ -167,6 +173,7 @@ struct font_cache_entry* font_cache_get(
     }
     
     /* not found */
+    fcache->misses++;
     if (cache_only)
         return NULL;
 
@@ -201,7 +208,10 @@ struct font_cache_entry* font_cache_get(
     if (fcache->_size < fcache->_capacity)
         fcache->_size++;
 
+    if (p->_char_code != 0xffff)
+        fcache->evictions++;
     p->_char_code = char_code;
+    p->uses = 1;
     /* fill bitmap */
     callback(p, callback_data);
     return p;
@@ -25,6 +25,7 @@
 #include "mv.h"
 #include <string.h>    /* size_t */
 #include <sys/types.h> /* ssize_t */
+#include "fs_defines.h" /* MAX_PATH */
 
 #ifdef HAVE_DIRCACHE
 
@@ -44,13 +45,17 @@
    the limiting factor is the scanning thread stack size, not the
    implementation -- tune the two together */
 #define DIRCACHE_MAX_DEPTH  15
-#define DIRCACHE_STACK_SIZE (DEFAULT_STACK_SIZE + 0x100)
+#define DIRCACHE_STACK_SIZE (DEFAULT_STACK_SIZE + 0x180)
 
 /* memory buffer constants that control allocation */
 #define DIRCACHE_RESERVE (1024*64)     /* 64 KB - new entry slack */
 #define DIRCACHE_MIN     (1024*1024*1) /* 1 MB - provision min size */
 #define DIRCACHE_LIMIT   (1024*1024*6) /* 6 MB - provision max size */
 
+/* number of file changes remembered for dircache_get_change(); must be a
+   power of 2 */
+#define DIRCACHE_JOURNAL_SIZE 32
+
 /* make it easy to change serialnumber size without modifying anything else;
    32 bits allows 21845 builds before wrapping in a 6MB cache that is filled
    exclusively with entries and nothing else (32 byte entries), making that
@@ -75,6 +80,14 @@ typedef uint32_t dc_serial_t;
 #if CONFIG_PLATFORM & PLATFORM_NATIVE
 /* native dircache is lower-level than on a hosted target */
 #define DIRCACHE_NATIVE
+/* save the cache at shutdown and start from it at boot, comparing it with
+   the storage in the background */
+#define DIRCACHE_SNAPSHOT
+#if MEMORYSIZE > 8
+/* hash names to entries so that opening a path needn't scan each directory;
+   costs roughly 6 to 11 bytes per cached entry */
+#define DIRCACHE_NAME_INDEX
+#endif
 #endif
 
 struct dircache_file
@@ -124,6 +137,12 @@ int dircache_readdir_internal(struct filestr_base *stream,
                               struct file_base_info *infop,
                               struct fat_direntry *fatent);
 void dircache_rewinddir_internal(struct file_base_info *info);
+#ifdef DIRCACHE_NAME_INDEX
+int dircache_find_internal(struct filestr_base *stream,
+                           struct file_base_info *infop,
+                           struct fat_direntry *fatent,
+                           const char *name);
+#endif
 #endif /* DIRCACHE_NATIVE */
 
 
@@ -176,6 +195,26 @@ int dircache_fileref_cmp(const struct dircache_fileref *dcfrefp1,
                          const struct dircache_fileref *dcfrefp2);
 
 
+/** Change journal **/
+
+enum dircache_change_type
+{
+    DCC_ADDED = 0,  /* file was created, written or renamed to path */
+    DCC_REMOVED,    /* file was removed or renamed away from path */
+};
+
+struct dircache_change
+{
+    enum dircache_change_type type;
+    time_t mtime;               /* modification time (DCC_ADDED) */
+    char   path[MAX_PATH];      /* full path of the file */
+};
+
+int dircache_get_change(struct dircache_change *chgp);
+int dircache_changes_pending(long *tickp);
+void dircache_clear_changes(void);
+
+
 /** Debug screen/info stuff **/
 
 struct dircache_info
@@ -190,6 +229,14 @@ struct dircache_info
     size_t       reserve_used;   /* amount of reserve used */
     unsigned int entry_count;    /* number of cache entries */
     long         build_ticks;    /* total time used to build cache */
+#ifdef DIRCACHE_NAME_INDEX
+    size_t       index_size;     /* bytes used by the name index */
+    unsigned int index_count;    /* entries in the name index */
+    bool         index_valid;    /* name index is in use */
+    unsigned long index_hits;    /* lookups found by the index */
+    unsigned long index_absent;  /* lookups found absent by the index */
+    unsigned long index_passed;  /* lookups that needed a scan */
+#endif
 };
 
 void dircache_get_info(struct dircache_info *info);
@@ -201,10 +248,11 @@ void dircache_dump(void);
 /** Misc. stuff **/
 void dircache_dcfile_init(struct dircache_file *dcfilep);
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
 int dircache_load(void);
 int dircache_save(void);
-#endif /* HAVE_EEPROM_SETTINGS */
+void dircache_drop_snapshot(void);
+#endif /* DIRCACHE_SNAPSHOT */
 
 void dircache_init(size_t last_size) INIT_ATTR;
 
@@ -181,6 +181,19 @@ static inline int readdir_internal(struct filestr_base *stream,
 #endif
 }
 
+static inline int find_dirent_internal(struct filestr_base *stream,
+                                       struct file_base_info *infop,
+                                       struct fat_direntry *fatent,
+                                       const char *name)
+{
+#ifdef DIRCACHE_NAME_INDEX
+    return dircache_find_internal(stream, infop, fatent, name);
+#else
+    return -1;
+    (void)stream; (void)infop; (void)fatent; (void)name;
+#endif
+}
+
 static inline void rewinddir_internal(struct file_base_info *infop)
 {
 #ifdef HAVE_DIRCACHE
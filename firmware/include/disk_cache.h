@@ -23,6 +23,7 @@
 
 #include "mutex.h"
 #include "mv.h"
+#include "fs_defines.h"
 
 static inline void dc_lock_cache(void)
 {
@@ -43,6 +44,13 @@ void dc_discard_buf(void *buf);
 void dc_commit_all(IF_MV_NONVOID(int volume));
 void dc_discard_all(IF_MV_NONVOID(int volume));
 
+#ifdef DC_READAHEAD
+void * dc_readahead_begin(IF_MV(int volume,) unsigned long sector,
+                          unsigned int *countp);
+void dc_readahead_finish(IF_MV(int volume,) unsigned long sector,
+                         unsigned int count, void *buf);
+#endif /* DC_READAHEAD */
+
 void dc_init(void) INIT_ATTR;
 
 /* in addition to filling, writeback is implemented by the client */
@@ -57,4 +65,17 @@ void * dc_get_buffer(void);
 /* return buffer to the cache by buffer */
 void dc_release_buffer(void *buf);
 
+struct dc_stats
+{
+    unsigned long hits;             /* probes that found the sector */
+    unsigned long misses;           /* probes that had to evict an entry */
+    unsigned long readaheads;       /* multi-sector fills */
+    unsigned long prefetched;       /* sectors filled ahead of a request */
+    unsigned long prefetch_hits;    /* prefetched sectors later used */
+    unsigned long prefetch_unused;  /* prefetched sectors evicted unused */
+};
+
+/* copy the running statistics */
+void dc_get_stats(struct dc_stats *stats);
+
 #endif /* DISK_CACHE_H */
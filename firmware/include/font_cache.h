@@ -34,15 +34,28 @@ struct font_cache
     int _prev_char_code;
     int _prev_result;
     short *_index; /* index of lru handles in char_code order */
+    /* statistics since the cache was created */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions; /* misses that pushed out a loaded glyph */
 };
 
 struct font_cache_entry
 {
     unsigned short _char_code;
     unsigned char width;
+    unsigned char uses;      /* saturating access count */
     unsigned char bitmap[1]; /* place holder */
 };
 
+/* The cache has cycled through all of its slots and still misses often,
+ * i.e. the working set doesn't fit */
+static inline bool font_cache_thrashing(const struct font_cache *fcache)
+{
+    return fcache->evictions >= (unsigned long)fcache->_capacity &&
+           fcache->misses * 8 > fcache->hits;
+}
+
 /* void (*f) (void*, struct font_cache_entry*); */
 /* Create an auto sized font cache from buf */
 void font_cache_create(
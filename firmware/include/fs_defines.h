@@ -97,11 +97,22 @@
 #elif MEMORYSIZE <= 32
 #define DC_NUM_ENTRIES      48
 #define DC_MAP_NUM_ENTRIES  128
+#define DC_READAHEAD_MAX    4
 #else /* MEMORYSIZE > 32 */
 #define DC_NUM_ENTRIES      64
 #define DC_MAP_NUM_ENTRIES  256
+#define DC_READAHEAD_MAX    8
 #endif /* MEMORYSIZE */
 
+/* Sequential misses of FAT and directory sectors are filled with one storage
+ * command of up to DC_READAHEAD_MAX sectors, staged in a buffer of that many
+ * sectors; it must stay small next to DC_NUM_ENTRIES since the sectors read
+ * ahead evict as many others.
+ */
+#ifdef DC_READAHEAD_MAX
+#define DC_READAHEAD
+#endif
+
 /* this _could_ be larger than a sector if that would ever be useful */
 #define DC_CACHE_BUFSIZE    SECTOR_SIZE
 
@@ -76,7 +76,15 @@
 #define TARGET_EXTRA_THREADS 0
 #endif
 
-#define MAXTHREADS (BASETHREADS+TARGET_EXTRA_THREADS)
+/* Background threads of the playback engine: the MP3 seek index builder
+   and the album art cache */
+#ifdef HAVE_ALBUMART
+#define PLAYBACK_EXTRA_THREADS 2
+#else
+#define PLAYBACK_EXTRA_THREADS 1
+#endif
+
+#define MAXTHREADS (BASETHREADS+PLAYBACK_EXTRA_THREADS+TARGET_EXTRA_THREADS)
 
 BITARRAY_TYPE_DECLARE(threadbit_t, threadbit, MAXTHREADS)
 BITARRAY_TYPE_DECLARE(priobit_t, priobit, NUM_PRIORITIES)
@@ -21,6 +21,7 @@
 #define RB_FILESYSTEM_OS
 #include <sys/statfs.h> /* lowest common denominator */
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
 #include "config.h"
@@ -45,6 +46,24 @@ off_t os_filesize(int osfd)
         return -1;
 }
 
+void * os_mmap_file(int osfd, size_t size)
+{
+    /* Private so that writes by the user never reach the file */
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      osfd, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    /* Files are mostly read front to back; let the kernel read ahead */
+    madvise(addr, size, MADV_SEQUENTIAL);
+    return addr;
+}
+
+void os_munmap_file(void *addr, size_t size)
+{
+    munmap(addr, size);
+}
+
 int os_fsamefile(int osfd1, int osfd2)
 {
     struct stat sb1, sb2;
@@ -57,6 +57,11 @@
 #endif
 #endif /* !OSFUNCTIONS_DECLARED */
 
+/* Copy-on-write mapping of a whole file */
+#define HAVE_OS_MMAP_FILE
+void * os_mmap_file(int osfd, size_t size);
+void os_munmap_file(void *addr, size_t size);
+
 #endif /* _FILESYSTEM_UNIX__FILE_H_ */
 #endif /* _FILE_H_ */
 
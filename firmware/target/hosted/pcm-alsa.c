@@ -24,21 +24,27 @@
  * Based, but heavily modified, on the example given at
  * http://www.alsa-project.org/alsa-doc/alsa-lib/_2test_2pcm_8c-example.html
  *
- * This driver uses the so-called unsafe async callback method and hardcoded device
- * names. It fails when the audio device is busy by other apps.
+ * This driver uses hardcoded device names. It fails when the audio device is
+ * busy by other apps.
  *
- * To make the async callback safer, an alternative stack is installed, since
+ * By default the device is fed from a dedicated thread which sleeps in poll()
+ * on the ALSA descriptors and refills one period at a time. The thread asks
+ * for SCHED_FIFO so it keeps up even with small periods, and falls back to a
+ * normal thread if the process is not allowed realtime scheduling.
+ *
+ * The older so-called unsafe async callback method is still available. To
+ * make the async callback safer, an alternative stack is installed, since
  * it's run from a signal hanlder (which otherwise uses the user stack). If
  * tick tasks are run from a signal handler too, please install
  * an alternative stack for it too.
  *
- * TODO: Rewrite this to do it properly with multithreading
- *
  * Alternatively, a version using polling in a tick task is provided. While
  * supposedly safer, it appears to use more CPU (however I didn't measure it
  * accurately, only looked at htop). At least, in this mode the "default"
  * device works which doesnt break with other apps running.
- * device works which doesnt break with other apps running.
+ *
+ * The period size and period count can be changed at runtime with
+ * pcm_alsa_set_latency() to trade CPU wakeups for latency.
  */
 
 #include "autoconf.h"
@@ -65,8 +71,11 @@
 
 #include <pthread.h>
 #include <signal.h>
+#include <poll.h>
 
-#define USE_ASYNC_CALLBACK
+/* Select how the device is fed: USE_FEEDER_THREAD, USE_ASYNC_CALLBACK or
+ * neither for the tick task */
+#define USE_FEEDER_THREAD
 /* plughw:0,0 works with both, however "default" is recommended.
  * default doesnt seem to work with async callback but doesn't break
  * with multple applications running */
@@ -92,14 +101,34 @@ static sample_t *frames = NULL;
 static const void  *pcm_data = 0;
 static size_t       pcm_size = 0;
 
-#ifdef USE_ASYNC_CALLBACK
-static snd_async_handler_t *ahandler;
+/* Requested latency, 0 = size by sample rate */
+static unsigned int req_period_size = 0;
+static unsigned int req_periods = 0;
+static bool latency_changed = false;
+
+static unsigned int underruns = 0;
+static unsigned int write_errors = 0;
+
+#if defined(USE_FEEDER_THREAD) || defined(USE_ASYNC_CALLBACK)
 static pthread_mutex_t pcm_mtx;
-static char signal_stack[SIGSTKSZ];
 #else
 static int recursion;
 #endif
 
+#ifdef USE_FEEDER_THREAD
+#define FEEDER_PRIORITY   10  /* SCHED_FIFO priority */
+#define FEEDER_MAX_FDS    4
+static pthread_t feeder_thread;
+static pthread_cond_t feeder_cond = PTHREAD_COND_INITIALIZER;
+static bool feeder_active = false;
+static bool feeder_realtime = false;
+static struct pollfd feeder_fds[FEEDER_MAX_FDS];
+static int feeder_nfds = 0;
+#elif defined(USE_ASYNC_CALLBACK)
+static snd_async_handler_t *ahandler;
+static char signal_stack[SIGSTKSZ];
+#endif
+
 static int set_hwparams(snd_pcm_t *handle)
 {
     int err;
@@ -107,8 +136,12 @@ static int set_hwparams(snd_pcm_t *handle)
     snd_pcm_hw_params_t *params;
     snd_pcm_hw_params_malloc(&params);
 
-    /* Size playback buffers based on sample rate */
-    if (pcm_sampr > SAMPR_96) {
+    /* Size playback buffers based on sample rate, unless a specific latency
+     * was asked for */
+    if (req_period_size != 0) {
+        period_size = req_period_size;
+        buffer_size = req_period_size * req_periods;
+    } else if (pcm_sampr > SAMPR_96) {
         buffer_size = MIX_FRAME_SAMPLES * 32 * 4; /* ~64k */
         period_size = MIX_FRAME_SAMPLES * 4 * 4;  /* ~16k */
     } else if (pcm_sampr > SAMPR_48) {
@@ -335,10 +368,130 @@ static bool fill_frames(void)
     return true;
 }
 
+/* refill the device one period at a time, called with the pcm lock held */
+static void pcm_feed(void)
+{
+    while (1)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+        if (avail < 0)
+        {
+            /* -EPIPE is an underrun, -ESTRPIPE a suspend */
+            if (avail == -EPIPE)
+                underruns++;
+            logf("Avail error: %s\n", snd_strerror(avail));
+            if (snd_pcm_recover(handle, avail, 1) < 0)
+                break;
+            continue;
+        }
+
+        if (avail < period_size)
+            break;
+
+        if (!fill_frames())
+        {
+            logf("%s: No Data.\n", __func__);
+            break;
+        }
+
+        int err = snd_pcm_writei(handle, frames, period_size);
+        if (err == -EPIPE)
+        {
+            underruns++;
+            snd_pcm_recover(handle, err, 1);
+        }
+        else if (err < 0 && err != -EAGAIN)
+        {
+            write_errors++;
+            logf("Write error: written %i expected %li\n", err, period_size);
+            break;
+        }
+    }
+}
+
+#ifdef USE_FEEDER_THREAD
+static void * pcm_feeder(void *arg)
+{
+    (void)arg;
+
+    struct pollfd fds[FEEDER_MAX_FDS];
+
+    while (1)
+    {
+        unsigned short revents = 0;
+
+        /* poll a copy: the descriptors change when the device is
+         * reconfigured */
+        pthread_mutex_lock(&pcm_mtx);
+        while (!feeder_active)
+            pthread_cond_wait(&feeder_cond, &pcm_mtx);
+        int nfds = feeder_nfds;
+        memcpy(fds, feeder_fds, nfds * sizeof(*fds));
+        pthread_mutex_unlock(&pcm_mtx);
+
+        /* wake up when a period is free, or recheck from time to time in
+         * case the device was stopped or reconfigured under us */
+        if (poll(fds, nfds, 100) <= 0)
+            continue;
+
+        pthread_mutex_lock(&pcm_mtx);
+        if (feeder_active)
+        {
+            snd_pcm_poll_descriptors_revents(handle, fds, nfds, &revents);
+            if (revents & (POLLOUT | POLLERR))
+                pcm_feed();
+        }
+        pthread_mutex_unlock(&pcm_mtx);
+    }
+
+    return NULL;
+}
+
+/* called with the pcm lock held */
+static void feeder_set_active(bool active)
+{
+    if (active)
+    {
+        feeder_nfds = snd_pcm_poll_descriptors(handle, feeder_fds, FEEDER_MAX_FDS);
+        if (feeder_nfds <= 0)
+        {
+            logf("Unable to get poll descriptors: %d\n", feeder_nfds);
+            feeder_nfds = 0;
+            return;
+        }
+    }
+
+    feeder_active = active;
+    pthread_cond_signal(&feeder_cond);
+}
+
+static void feeder_init(void)
+{
+    pthread_attr_t attr;
+    struct sched_param param = { .sched_priority = FEEDER_PRIORITY };
+
+    /* try realtime first, this fails without CAP_SYS_NICE or RLIMIT_RTPRIO */
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    feeder_realtime =
+        pthread_create(&feeder_thread, &attr, pcm_feeder, NULL) == 0;
+    pthread_attr_destroy(&attr);
+
+    if (!feeder_realtime &&
+        pthread_create(&feeder_thread, NULL, pcm_feeder, NULL) != 0)
+    {
+        panicf("Unable to create pcm feeder thread");
+    }
+}
+#else /* !USE_FEEDER_THREAD */
+#define feeder_set_active(active) do {} while (0)
+
 #ifdef USE_ASYNC_CALLBACK
 static void async_callback(snd_async_handler_t *ahandler)
 {
-    snd_pcm_t *handle = snd_async_handler_get_pcm(ahandler);
+    (void)ahandler;
 
     if (pthread_mutex_trylock(&pcm_mtx) != 0)
         return;
@@ -349,27 +502,13 @@ static void pcm_tick(void)
         return;
 #endif
 
-    while (snd_pcm_avail_update(handle) >= period_size)
-    {
-        if (fill_frames())
-        {
-            int err = snd_pcm_writei(handle, frames, period_size);
-            if (err < 0 && err != period_size && err != -EAGAIN)
-            {
-                logf("Write error: written %i expected %li\n", err, period_size);
-                break;
-            }
-        }
-        else
-        {
-            logf("%s: No Data.\n", __func__);
-            break;
-        }
-    }
+    pcm_feed();
+
 #ifdef USE_ASYNC_CALLBACK
     pthread_mutex_unlock(&pcm_mtx);
 #endif
 }
+#endif /* USE_FEEDER_THREAD */
 
 static int async_rw(snd_pcm_t *handle)
 {
@@ -377,7 +516,7 @@ static int async_rw(snd_pcm_t *handle)
     snd_pcm_sframes_t sample_size;
     sample_t *samples;
 
-#ifdef USE_ASYNC_CALLBACK
+#if defined(USE_ASYNC_CALLBACK) && !defined(USE_FEEDER_THREAD)
     /* assign alternative stack for the signal handlers */
     stack_t ss = {
         .ss_sp = signal_stack,
@@ -479,14 +618,18 @@ void pcm_play_dma_init(void)
         panicf("Setting of swparams failed: %s\n", snd_strerror(err));
     }
 
-    pcm_dma_apply_settings();
-
-#ifdef USE_ASYNC_CALLBACK
+#if defined(USE_FEEDER_THREAD) || defined(USE_ASYNC_CALLBACK)
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
     pthread_mutex_init(&pcm_mtx, &attr);
-#else
+#endif
+
+    pcm_dma_apply_settings();
+
+#ifdef USE_FEEDER_THREAD
+    feeder_init();
+#elif !defined(USE_ASYNC_CALLBACK)
     tick_add_task(pcm_tick);
 #endif
 
@@ -496,7 +639,7 @@ void pcm_play_dma_init(void)
 
 void pcm_play_lock(void)
 {
-#ifdef USE_ASYNC_CALLBACK
+#if defined(USE_FEEDER_THREAD) || defined(USE_ASYNC_CALLBACK)
     pthread_mutex_lock(&pcm_mtx);
 #else
     if (recursion++ == 0)
@@ -506,7 +649,7 @@ void pcm_play_lock(void)
 
 void pcm_play_unlock(void)
 {
-#ifdef USE_ASYNC_CALLBACK
+#if defined(USE_FEEDER_THREAD) || defined(USE_ASYNC_CALLBACK)
     pthread_mutex_unlock(&pcm_mtx);
 #else
     if (--recursion == 0)
@@ -528,6 +671,7 @@ static void pcm_dma_apply_settings_nolock(void)
 #endif
         snd_pcm_drop(handle);
         set_hwparams(handle);
+        set_swparams(handle);
 #if defined(HAVE_NWZ_LINUX_CODEC)
         /* Sony NWZ linux driver uses a nonstandard mecanism to set the sampling rate */
         audiohw_set_frequency(pcm_sampr);
@@ -543,13 +687,47 @@ void pcm_dma_apply_settings(void)
     pcm_play_unlock();
 }
 
+/* restart the stream with the new buffer geometry, keeping pcm_data */
+static void pcm_restart_nolock(void)
+{
+    int err;
+
+    latency_changed = false;
+    feeder_set_active(false);
+    snd_pcm_drop(handle);
+    set_hwparams(handle);
+    set_swparams(handle);
+
+    if ((err = snd_pcm_prepare(handle)) < 0 || (err = async_rw(handle)) < 0)
+    {
+        logf("Restart error: %s\n", snd_strerror(err));
+        return;
+    }
+
+    feeder_set_active(true);
+}
+
 void pcm_play_dma_pause(bool pause)
 {
     logf("PCM DMA pause %d", pause);
 #ifdef AUDIOHW_MUTE_ON_PAUSE
     if (pause) audiohw_mute(true);
 #endif
-    snd_pcm_pause(handle, pause);
+    if (pause)
+    {
+        feeder_set_active(false);
+        snd_pcm_pause(handle, 1);
+    }
+    else if (latency_changed)
+    {
+        /* the geometry changed while paused, start over */
+        pcm_restart_nolock();
+    }
+    else
+    {
+        snd_pcm_pause(handle, 0);
+        feeder_set_active(true);
+    }
 #ifdef AUDIOHW_MUTE_ON_PAUSE
     if (!pause) audiohw_mute(false);
 #endif
@@ -557,6 +735,7 @@ void pcm_play_dma_pause(bool pause)
 
 void pcm_play_dma_stop(void)
 {
+    feeder_set_active(false);
     snd_pcm_nonblock(handle, 0);
     snd_pcm_drain(handle);
     snd_pcm_nonblock(handle, 1);
@@ -587,6 +766,7 @@ void pcm_play_dma_start(const void *addr, size_t size)
         switch (state)
         {
             case SND_PCM_STATE_RUNNING:
+                feeder_set_active(true);
                 return;
             case SND_PCM_STATE_XRUN:
             {
@@ -615,7 +795,10 @@ void pcm_play_dma_start(const void *addr, size_t size)
                 audiohw_mute(false);
 #endif
                 if (err == 0)
+                {
+                    feeder_set_active(true);
                     return;
+                }
                 break;
             }
             case SND_PCM_STATE_PAUSED:
@@ -664,6 +847,54 @@ int pcm_alsa_get_rate(void)
     return real_sample_rate;
 }
 
+void pcm_alsa_set_latency(unsigned int period_frames, unsigned int periods)
+{
+    if (periods < 2)
+        periods = 2;
+
+    if (handle == NULL)
+    {
+        /* not opened yet, picked up by pcm_play_dma_init() */
+        req_period_size = period_frames;
+        req_periods = periods;
+        return;
+    }
+
+    pcm_play_lock();
+
+    req_period_size = period_frames;
+    req_periods = periods;
+
+    if (!pcm_is_playing())
+    {
+        snd_pcm_drop(handle);
+        set_hwparams(handle);
+        set_swparams(handle);
+    }
+    else if (pcm_is_paused())
+        latency_changed = true;
+    else
+        pcm_restart_nolock();
+
+    pcm_play_unlock();
+}
+
+void pcm_alsa_get_debug(struct pcm_alsa_debug *dbg)
+{
+    pcm_play_lock();
+    dbg->period_size = period_size;
+    dbg->buffer_size = buffer_size;
+    dbg->latency_ms = real_sample_rate ? buffer_size * 1000 / real_sample_rate : 0;
+    dbg->underruns = underruns;
+    dbg->write_errors = write_errors;
+#ifdef USE_FEEDER_THREAD
+    dbg->realtime = feeder_realtime;
+#else
+    dbg->realtime = false;
+#endif
+    pcm_play_unlock();
+}
+
 #ifdef HAVE_RECORDING
 void pcm_rec_lock(void)
 {
@@ -21,6 +21,7 @@
 #define __PCM_ALSA_RB_H__
 
 #include <config.h>
+#include <stdbool.h>
 
 #if defined(SONY_NWZ_LINUX) || defined(HAVE_FIIO_LINUX_CODEC)
 /* Set the PCM volume in dB: each sample with have this volume applied digitally
@@ -30,4 +31,20 @@ void pcm_alsa_set_digital_volume(int vol_db_l, int vol_db_r);
 
 int pcm_alsa_get_rate(void);
 
+/* Set the ALSA period size in frames and the number of periods in the
+ * buffer. A period size of 0 restores the default sizing, which depends on
+ * the sample rate. Takes effect immediately, also during playback. */
+void pcm_alsa_set_latency(unsigned int period_frames, unsigned int periods);
+
+struct pcm_alsa_debug
+{
+    long period_size;   /* frames */
+    long buffer_size;   /* frames */
+    long latency_ms;    /* buffer length at the current rate */
+    unsigned int underruns;
+    unsigned int write_errors;
+    bool realtime;      /* feeder thread got realtime scheduling */
+};
+void pcm_alsa_get_debug(struct pcm_alsa_debug *dbg);
+
 #endif /* __PCM_ALSA_RB_H__ */
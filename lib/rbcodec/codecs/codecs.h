@@ -72,12 +72,12 @@
 #define CODEC_ENC_MAGIC 0x52454E43 /* RENC */
 
 /* increase this every time the api struct changes */
-#define CODEC_API_VERSION 48
+#define CODEC_API_VERSION 49
 
 /* update this to latest version if a change to the api struct breaks
    backwards compatibility (and please take the opportunity to sort in any
    new function which are "waiting" at the end of the function table) */
-#define CODEC_MIN_API_VERSION 48
+#define CODEC_MIN_API_VERSION 49
 
 /* reasons for calling codec main entrypoint */
 enum codec_entry_call_reason {
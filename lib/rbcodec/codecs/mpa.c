@@ -21,6 +21,7 @@
 
 #include "codeclib.h"
 #include <codecs/libmad/mad.h>
+#include "metadata/mp3data.h"
 #include <inttypes.h>
 
 CODEC_HEADER
@@ -56,6 +57,10 @@ static unsigned char mad_main_data[MAD_BUFFER_MDLEN] IBSS_ATTR;
 static int mpeg_latency[3] = { 0, 481, 529 };
 static int mpeg_framesize[3] = {384, 1152, 1152};
 
+/* Samples to decode and drop after landing on an indexed frame, or -1 if
+   the last position was only estimated */
+static long seek_skip = -1;
+
 static void init_mad(void)
 {
     ci->memset(&stream, 0, sizeof(struct mad_stream));
@@ -84,12 +89,51 @@ static void init_mad(void)
     mad_synth_init(&synth);
 }
 
+/* Seek index from playback, if the stream has one */
+static const struct mp3_seekidx *get_seekidx(void)
+{
+    const struct mp3_seekidx *idx = ci->id3->seekidx;
+    return (idx && idx->count) ? idx : NULL;
+}
+
+/* Time of the last indexed frame at or before a file offset */
+static unsigned long seekidx_elapsed(const struct mp3_seekidx *idx,
+                                     unsigned long offset)
+{
+    unsigned long lo = 0, hi = idx->count;
+
+    while (hi - lo > 1) {
+        unsigned long mid = (lo + hi) / 2;
+        if (idx->offset[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return (uint64_t)lo * idx->frame_step * idx->frame_samples * 1000
+                / idx->frequency;
+}
+
 static int get_file_pos(int newtime)
 {
     int pos = -1;
     struct mp3entry *id3 = ci->id3;
+    const struct mp3_seekidx *idx = get_seekidx();
 
-    if (id3->vbr) {
+    seek_skip = -1;
+
+    if (idx) {
+        /* Go to the indexed frame before the time and note how far to
+           decode from there */
+        uint64_t sample = (uint64_t)newtime * idx->frequency / 1000;
+        unsigned long i = sample / idx->frame_samples / idx->frame_step;
+
+        if (i >= idx->count)
+            i = idx->count - 1;
+
+        seek_skip = sample - (uint64_t)i * idx->frame_step * idx->frame_samples;
+        return idx->offset[i];
+    } else if (id3->vbr) {
         /* Convert newtime and id3->length to seconds to
          * avoid overflow */
         unsigned int newtime_s = newtime/1000;
@@ -346,14 +390,24 @@ enum codec_status codec_run(void)
     current_frequency = ci->id3->frequency;
     codec_set_replaygain(ci->id3);
     
-    if (!ci->id3->offset && ci->id3->elapsed) {
-        /* Have elapsed time but not offset */
+    seek_skip = -1;
+
+    if (get_seekidx() && ci->id3->offset && !ci->id3->elapsed) {
+        /* Have offset only; resume from the indexed frame before it */
+        ci->id3->elapsed = seekidx_elapsed(get_seekidx(), ci->id3->offset);
+    }
+
+    if (ci->id3->elapsed && (!ci->id3->offset || get_seekidx())) {
+        /* Have elapsed time but not offset, or an index to find it exactly */
         ci->id3->offset = get_file_pos(ci->id3->elapsed);
     }
 
     if (ci->id3->offset) {
         ci->seek_buffer(ci->id3->offset);
-        set_elapsed(ci->id3);
+        if (seek_skip >= 0)
+            ci->set_elapsed(ci->id3->elapsed);
+        else
+            set_elapsed(ci->id3);
     }
     else
         ci->seek_buffer(ci->id3->first_frame_offset);
@@ -382,11 +436,14 @@ enum codec_status codec_run(void)
 
     samplesdone = ((int64_t)ci->id3->elapsed) * current_frequency / 1000;
 
-    /* Don't skip any samples unless we start at the beginning. */
-    if (samplesdone > 0)
-        samples_to_skip = 0;
-    else
+    /* Don't skip any samples unless we start at the beginning or on an
+       indexed frame. */
+    if (samplesdone <= 0)
         samples_to_skip = start_skip;
+    else if (seek_skip >= 0)
+        samples_to_skip = seek_skip + start_skip;
+    else
+        samples_to_skip = 0;
 
     framelength = 0;
 
@@ -409,9 +466,10 @@ enum codec_status codec_run(void)
             if (param == 0) {
                 newpos = ci->id3->first_frame_offset;
                 samples_to_skip = start_skip;
+                seek_skip = -1;
             } else {
                 newpos = get_file_pos(param);
-                samples_to_skip = 0;
+                samples_to_skip = seek_skip >= 0 ? seek_skip + start_skip : 0;
             }
 
             if (!ci->seek_buffer(newpos))
@@ -450,7 +508,15 @@ enum codec_status codec_run(void)
                 file_end++;
                 continue;
             } else if (MAD_RECOVERABLE(stream.error)) {
-                /* Probably syncing after a seek */
+                /* Probably syncing after a seek. A frame whose bit reservoir
+                   starts before the seek point gives no samples, so take it
+                   off what is left to skip. */
+                if (stream.error == MAD_ERROR_BADDATAPTR && seek_skip >= 0
+                    && samples_to_skip > 0) {
+                    samples_to_skip -= 32 * MAD_NSBSAMPLES(&frame.header);
+                    if (samples_to_skip < 0)
+                        samples_to_skip = 0;
+                }
                 continue;
             } else {
                 /* Some other unrecoverable error */
@@ -23,6 +23,7 @@
 #include "platform.h"
 #include "dsp_core.h"
 #include "dsp_sample_io.h"
+#include <string.h>
 
 /* Define LOGF_ENABLE to enable logf output in this file */
 /*#define LOGF_ENABLE*/
@@ -39,6 +40,10 @@
 #define DSP_PROCESS_END()
 #endif /* !DSP_PROCESS_START */
 
+/* Per-stage profiling is available if the platform defines
+ * DSP_PROFILE_TIMER() to return a free-running counter that ticks
+ * DSP_PROFILE_TIMER_HZ times per second */
+
 /* Linked lists give fewer loads in processing loop compared to some index
  * list, which is more important than keeping occasionally executed code
  * simple */
@@ -50,6 +55,9 @@ struct dsp_config
     uint32_t slot_free_mask;        /* Mask of free slots for this DSP */
     uint32_t proc_mask_enabled;     /* Mask of enabled stages */
     uint32_t proc_mask_active;      /* Mask of active stages */
+#ifdef DSP_PROFILE_TIMER
+    bool profile;                   /* Stages are being profiled */
+#endif
     struct dsp_proc_slot
     {
         struct dsp_proc_entry proc_entry; /* This enabled stage */
@@ -70,6 +78,24 @@ dsp_proc_slot_arr[DSP_NUM_PROC_STAGES+DSP_VOICE_NUM_PROC_STAGES] IBSS_ATTR;
 /* General DSP config */
 static struct dsp_config dsp_conf[DSP_COUNT] IBSS_ATTR;
 
+#ifdef DSP_PROFILE_TIMER
+/* Kept out of IRAM; only touched when profiling */
+static struct
+{
+    unsigned long start;            /* Timer value when enabled */
+    struct dsp_proc_stats stats[DSP_NUM_PROC_STAGES]; /* By db index */
+} dsp_profile[DSP_COUNT];
+
+#define DSP_PROC_DB_START \
+    static const char * const dsp_proc_names[] = {
+#define DSP_PROC_DB_ITEM(name) \
+    #name,
+#define DSP_PROC_DB_STOP };
+
+/* Create stage names in database order */
+#include "dsp_proc_database.h"
+#endif /* DSP_PROFILE_TIMER */
+
 /** Processing stages support functions **/
 static const struct dsp_proc_db_entry *
 proc_db_entry(const struct dsp_proc_slot *s)
@@ -350,6 +376,24 @@ static NO_INLINE bool dsp_proc_new_format(struct dsp_proc_slot *s,
     }
 }
 
+#ifdef DSP_PROFILE_TIMER
+static NO_INLINE void dsp_proc_call_profiled(struct dsp_proc_slot *s,
+                                             struct dsp_config *dsp,
+                                             struct dsp_buffer **buf_p)
+{
+    struct dsp_proc_stats *stats =
+        &dsp_profile[dsp_get_id(dsp)].stats[s->db_index];
+    int32_t count = (*buf_p)->remcount;
+    unsigned long start = DSP_PROFILE_TIMER();
+
+    s->proc_entry.process(&s->proc_entry, buf_p);
+
+    stats->time += DSP_PROFILE_TIMER() - start;
+    stats->samples += count;
+    stats->calls++;
+}
+#endif /* DSP_PROFILE_TIMER */
+
 static FORCE_INLINE void dsp_proc_call(struct dsp_proc_slot *s,
                                        struct dsp_config *dsp,
                                        struct dsp_buffer **buf_p)
@@ -370,6 +414,14 @@ static FORCE_INLINE void dsp_proc_call(struct dsp_proc_slot *s,
         buf->proc_mask |= s->mask;
     }
 
+#ifdef DSP_PROFILE_TIMER
+    if (UNLIKELY(dsp->profile))
+    {
+        dsp_proc_call_profiled(s, dsp, buf_p);
+        return;
+    }
+#endif
+
     s->proc_entry.process(&s->proc_entry, buf_p);
 }
 
@@ -476,6 +528,35 @@ intptr_t dsp_configure(struct dsp_config *dsp, unsigned int setting,
     return proc_broadcast(dsp, setting, value);
 }
 
+#ifdef DSP_PROFILE_TIMER
+void dsp_profile_enable(struct dsp_config *dsp, bool enable)
+{
+    if (enable)
+    {
+        enum dsp_ids id = dsp_get_id(dsp);
+        memset(dsp_profile[id].stats, 0, sizeof (dsp_profile[id].stats));
+        dsp_profile[id].start = DSP_PROFILE_TIMER();
+    }
+
+    dsp->profile = enable;
+}
+
+unsigned long dsp_profile_elapsed(struct dsp_config *dsp)
+{
+    return DSP_PROFILE_TIMER() - dsp_profile[dsp_get_id(dsp)].start;
+}
+
+const char * dsp_profile_get_stats(struct dsp_config *dsp, unsigned int index,
+                                   struct dsp_proc_stats *stats)
+{
+    if (index >= DSP_NUM_PROC_STAGES)
+        return NULL;
+
+    *stats = dsp_profile[dsp_get_id(dsp)].stats[index];
+    return dsp_proc_names[index];
+}
+#endif /* DSP_PROFILE_TIMER */
+
 struct dsp_config * dsp_get_config(enum dsp_ids id)
 {
     if (id >= DSP_COUNT)
@@ -146,4 +146,26 @@ intptr_t dsp_configure(struct dsp_config *dsp, unsigned int setting,
 /* One-time startup init that must come before settings reset/apply */
 void dsp_init(void);
 
+#ifdef DSP_PROFILE_TIMER
+/* Per-stage statistics, times are in DSP_PROFILE_TIMER units */
+struct dsp_proc_stats
+{
+    unsigned long calls;    /* Number of calls to process() */
+    unsigned long samples;  /* Input samples passed to process() */
+    unsigned long time;     /* Time spent inside process() */
+};
+
+/* Start or stop profiling the stages; starting resets all counters */
+void dsp_profile_enable(struct dsp_config *dsp, bool enable);
+
+/* Time since profiling was started */
+unsigned long dsp_profile_elapsed(struct dsp_config *dsp);
+
+/* Get the statistics of the stage at index in the order stages are listed
+   in dsp_proc_database.h. That is not necessarily the order they run in.
+   Returns the name of the stage, or NULL if index is past the last stage. */
+const char * dsp_profile_get_stats(struct dsp_config *dsp, unsigned int index,
+                                   struct dsp_proc_stats *stats);
+#endif /* DSP_PROFILE_TIMER */
+
 #endif /* _DSP_H */
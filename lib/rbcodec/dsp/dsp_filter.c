@@ -304,6 +304,60 @@ void filter_process(struct dsp_filter *f, int32_t * const buf[], int count,
 }
 #endif /* CPU */
 
+/**
+ * Run buf through a chain of filters, in order. Equivalent to calling
+ * filter_process() for each of them in turn but, where there is no
+ * assembly filter_process(), the buffer is processed in blocks that stay
+ * in the cache while all filters are applied with their state in
+ * registers.
+ */
+#if (!defined(CPU_COLDFIRE) && !defined(CPU_ARM))
+#define FILTER_CHAIN_BLOCK 64 /* Samples per channel per block */
+
+void filter_process_chain(struct dsp_filter * const f[], unsigned int num,
+                          int32_t * const buf[], int count,
+                          unsigned int channels)
+{
+    for (unsigned int c = 0; c < channels; c++) {
+        for (int pos = 0; pos < count; pos += FILTER_CHAIN_BLOCK) {
+            int32_t *x = &buf[c][pos];
+            int n = MIN(count - pos, FILTER_CHAIN_BLOCK);
+
+            for (unsigned int k = 0; k < num; k++) {
+                struct dsp_filter *fk = f[k];
+                const long long b0 = fk->coefs[0], b1 = fk->coefs[1],
+                                b2 = fk->coefs[2], a1 = fk->coefs[3],
+                                a2 = fk->coefs[4];
+                const unsigned int shift = fk->shift;
+                int32_t x1 = fk->history[c][0], x2 = fk->history[c][1];
+                int32_t y1 = fk->history[c][2], y2 = fk->history[c][3];
+
+                for (int i = 0; i < n; i++) {
+                    long long acc = x[i]*b0 + x1*b1 + x2*b2 + y1*a1 + y2*a2;
+                    x2 = x1;
+                    x1 = x[i];
+                    y2 = y1;
+                    y1 = x[i] = (acc << shift) >> 32;
+                }
+
+                fk->history[c][0] = x1;
+                fk->history[c][1] = x2;
+                fk->history[c][2] = y1;
+                fk->history[c][3] = y2;
+            }
+        }
+    }
+}
+#else /* CPU */
+void filter_process_chain(struct dsp_filter * const f[], unsigned int num,
+                          int32_t * const buf[], int count,
+                          unsigned int channels)
+{
+    for (unsigned int k = 0; k < num; k++)
+        filter_process(f[k], buf, count, channels);
+}
+#endif /* CPU */
+
 /* ring buffer */
 int32_t dequeue(int32_t* buffer, int *head, int boundary)
 {
@@ -59,6 +59,15 @@ void dsp_set_pitch(int32_t pitch);
 int32_t dsp_get_pitch(void);
 #endif /* HAVE_PITCHCONTROL */
 
+/* Resampler quality, sent with RESAMPLE_SET_QUALITY */
+enum resample_quality
+{
+    RESAMPLE_QUALITY_LOW = 0, /* 4-point Hermite interpolation (default) */
+    RESAMPLE_QUALITY_HIGH,    /* Polyphase windowed-sinc FIR (audio DSP) */
+};
+
+#define RESAMPLE_SET_QUALITY (DSP_PROC_SETTING+DSP_PROC_RESAMPLE)
+
 /* Set output samplerate for all DSPs */
 void dsp_set_all_output_frequency(unsigned int samplerate);
 
@@ -168,9 +168,13 @@ static void eq_process(struct dsp_proc_entry *this,
     struct dsp_buffer *buf = *buf_p;
     int count = buf->remcount;
     unsigned int channels = buf->format.num_channels;
+    struct dsp_filter *chain[EQ_NUM_BANDS];
+    unsigned int num = 0;
 
     FOR_EACH_ENB_BAND(b)
-        filter_process(&eq_data.filters[*b], buf->p32, count, channels);
+        chain[num++] = &eq_data.filters[*b];
+
+    filter_process_chain(chain, num, buf->p32, count, channels);
 
     (void)this;
 }
@@ -43,6 +43,25 @@
 /* CODEC_IDX_AUDIO = left and right, CODEC_IDX_VOICE = mono */
 static int32_t resample_out_bufs[3][RESAMPLE_BUF_COUNT] IBSS_ATTR;
 
+/**
+ * Polyphase windowed-sinc FIR resampling for RESAMPLE_QUALITY_HIGH, audio
+ * DSP only. Ratios whose reduced upsampling factor fits in the table
+ * (44100 <-> 48000, 2x, 4x, ...) step through exact phases. Any other ratio,
+ * e.g. with pitch control, interpolates between the outputs of two adjacent
+ * phases of a 128-phase table.
+ */
+#define RESAMPLE_FIR_TAPS        32  /* Taps per phase */
+#define RESAMPLE_FIR_MAX_PHASES  160 /* 44100 <-> 48000 reduce to 160:147 */
+#define RESAMPLE_FIR_INTERP_BITS 7   /* 128 phases (+1) for other ratios */
+#define RESAMPLE_FIR_CHUNK       128 /* Max input samples per call */
+#define RESAMPLE_FIR_CUTOFF      0x3ae147ae /* 0.46 * min(fin, fout), s0.31 */
+
+/* Coefficients, s0.15, each phase normalized to unity DC gain */
+static int16_t resample_fir_coefs[RESAMPLE_FIR_MAX_PHASES*RESAMPLE_FIR_TAPS];
+
+/* History followed by the current input chunk, per channel */
+static int32_t resample_fir_window[2][RESAMPLE_FIR_TAPS-1+RESAMPLE_FIR_CHUNK];
+
 /* Data for each resampler on each DSP */
 static struct resample_data
 {
@@ -55,6 +74,12 @@ static struct resample_data
     unsigned int frequency_out;     /* Resampler output samplerate */
     struct dsp_buffer resample_buf; /* Buffer descriptor for resampled data */
     int32_t *resample_out_p[2];     /* Actual output buffer pointers */
+    unsigned int quality;           /* enum resample_quality */
+    bool fir;                       /* FIR is used for the current ratio */
+    unsigned int fir_phases;        /* Exact ratio phase count (0=interp) */
+    unsigned int fir_step_int;      /* Exact ratio: input samples per step */
+    unsigned int fir_step_frac;     /* Exact ratio: phases per step */
+    unsigned int fir_phase;         /* Exact ratio: current phase */
 } resample_data[DSP_COUNT] IBSS_ATTR;
 
 /* Actual worker function. Implemented here or in target assembly code. */
@@ -65,6 +90,12 @@ static void resample_flush_data(struct resample_data *data)
 {
     data->phase = 0;
     memset(&data->history, 0, sizeof (data->history));
+
+    if (data->fir)
+    {
+        data->fir_phase = 0;
+        memset(resample_fir_window, 0, sizeof (resample_fir_window));
+    }
 }
 
 static void resample_flush(struct dsp_proc_entry *this)
@@ -74,6 +105,98 @@ static void resample_flush(struct dsp_proc_entry *this)
     resample_flush_data(data);
 }
 
+/* Compute 'rows' phases of the filter, row r being delayed by r/phases of
+ * an input sample. cutoff is the -6 dB point relative to the input rate. */
+static void resample_fir_design(unsigned int rows, unsigned int phases,
+                                int32_t cutoff)
+{
+    for (unsigned int r = 0; r < rows; r++)
+    {
+        int16_t *h = &resample_fir_coefs[r*RESAMPLE_FIR_TAPS];
+        int32_t hq[RESAMPLE_FIR_TAPS];
+        int64_t sum = 0;
+
+        for (int j = 0; j < RESAMPLE_FIR_TAPS; j++)
+        {
+            /* Time of tap relative to the output sample, s15.16 */
+            int32_t t = ((int64_t)(j - (RESAMPLE_FIR_TAPS/2 - 1))*phases - r)
+                            * 65536 / (int)phases;
+
+            /* sinc(2*fc*t), s1.30 */
+            int32_t x = ((int64_t)cutoff * 2 * t) >> 31;
+            int32_t sinc = 1 << 30;
+
+            if (x != 0)
+            {
+                long sn = fp_sincos((uint32_t)x << 15, NULL); /* sin(pi*x) */
+                int64_t pix = ((int64_t)x * 205887) >> 16;     /* pi*x */
+                sinc = ((int64_t)sn << 15) / pix;
+            }
+
+            /* Blackman window spanning all taps, s0.31:
+             * 0.42 + 0.5*cos(2*pi*t/N) + 0.08*cos(4*pi*t/N) */
+            long c1, c2;
+            fp_sincos((uint32_t)(((int64_t)t << 16) / RESAMPLE_FIR_TAPS), &c1);
+            fp_sincos((uint32_t)(((int64_t)t << 17) / RESAMPLE_FIR_TAPS), &c2);
+            int64_t w = 901943132LL + (c1 >> 1) +
+                        (((int64_t)c2 * 171798692) >> 31);
+
+            hq[j] = (sinc * w) >> 31;
+            sum += hq[j];
+        }
+
+        for (int j = 0; j < RESAMPLE_FIR_TAPS; j++)
+            h[j] = ((int64_t)hq[j] << 15) / sum;
+    }
+}
+
+static unsigned int resample_gcd(unsigned int a, unsigned int b)
+{
+    while (b)
+    {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* Select and set up the FIR for the current ratio if it should be used */
+static void resample_fir_setup(struct resample_data *data)
+{
+    unsigned int fin = data->frequency;
+    unsigned int fout = data->frequency_out;
+
+    data->fir = data->quality == RESAMPLE_QUALITY_HIGH &&
+                data == &resample_data[CODEC_IDX_AUDIO];
+
+    if (!data->fir)
+        return;
+
+    int32_t cutoff = fin > fout ?
+        (int32_t)(((int64_t)RESAMPLE_FIR_CUTOFF * fout) / fin) :
+        RESAMPLE_FIR_CUTOFF;
+
+    unsigned int gcd = resample_gcd(fin, fout);
+    unsigned int phases = fout / gcd;
+    unsigned int step = fin / gcd;
+
+    if (phases <= RESAMPLE_FIR_MAX_PHASES)
+    {
+        data->fir_phases = phases;
+        data->fir_step_int = step / phases;
+        data->fir_step_frac = step % phases;
+        resample_fir_design(phases, phases, cutoff);
+    }
+    else
+    {
+        data->fir_phases = 0;
+        resample_fir_design((1 << RESAMPLE_FIR_INTERP_BITS) + 1,
+                            1 << RESAMPLE_FIR_INTERP_BITS, cutoff);
+    }
+}
+
 static bool resample_new_delta(struct resample_data *data,
                                struct sample_format *format,
                                unsigned int fout)
@@ -93,6 +216,21 @@ static bool resample_new_delta(struct resample_data *data,
         return false;
     }
 
+    /* Input history stays valid when only the ratio changes */
+    bool fir = data->fir;
+    resample_fir_setup(data);
+
+    if (data->fir != fir)
+    {
+        resample_flush_data(data);
+    }
+    else if (data->fir)
+    {
+        data->fir_phase = 0;
+        if (data->fir_phases)
+            data->phase &= ~0xffff;
+    }
+
     return true;
 }
 
@@ -188,6 +326,100 @@ int resample_hermite(struct resample_data *data, struct dsp_buffer *src,
 }
 #endif /* CPU */
 
+static inline int32_t resample_fir_dot(const int32_t *x, const int16_t *h)
+{
+    int64_t acc0 = 0, acc1 = 0;
+
+    /* Two accumulators and a fixed count let hosts vectorize this */
+    for (unsigned int i = 0; i < RESAMPLE_FIR_TAPS; i += 2)
+    {
+        acc0 += (int64_t)x[i+0] * h[i+0];
+        acc1 += (int64_t)x[i+1] * h[i+1];
+    }
+
+    return (acc0 + acc1) >> 15;
+}
+
+static int resample_fir(struct resample_data *data, struct dsp_buffer *src,
+                        struct dsp_buffer *dst)
+{
+    int ch = src->format.num_channels - 1;
+    uint32_t count = MIN(src->remcount, RESAMPLE_FIR_CHUNK);
+    const unsigned int phases = data->fir_phases;
+    const uint32_t delta = data->delta;
+    uint32_t phase, pos;
+    unsigned int fir_phase;
+    int32_t *d;
+
+    do
+    {
+        int32_t *w = resample_fir_window[ch];
+
+        /* Window is the history followed by the new samples; output at pos
+         * uses w[pos] ... w[pos+TAPS-1], the latter being s[pos] */
+        memcpy(&w[RESAMPLE_FIR_TAPS-1], src->p32[ch], count*sizeof (int32_t));
+
+        d = dst->p32[ch];
+        int32_t *dmax = d + dst->bufcount;
+
+        /* Restore state */
+        phase = data->phase;
+        fir_phase = data->fir_phase;
+        pos = phase >> 16;
+
+        if (phases)
+        {
+            /* Exact ratio */
+            while (pos < count && d < dmax)
+            {
+                *d++ = resample_fir_dot(&w[pos],
+                            &resample_fir_coefs[fir_phase*RESAMPLE_FIR_TAPS]);
+
+                pos += data->fir_step_int;
+                fir_phase += data->fir_step_frac;
+                if (fir_phase >= phases)
+                {
+                    fir_phase -= phases;
+                    pos++;
+                }
+            }
+
+            phase = pos << 16;
+        }
+        else
+        {
+            /* Any ratio: interpolate between two adjacent phases */
+            while (pos < count && d < dmax)
+            {
+                const unsigned int shift = 16 - RESAMPLE_FIR_INTERP_BITS;
+                const int16_t *h = &resample_fir_coefs[
+                    ((phase & 0xffff) >> shift)*RESAMPLE_FIR_TAPS];
+                int32_t y0 = resample_fir_dot(&w[pos], h);
+                int32_t y1 = resample_fir_dot(&w[pos], h + RESAMPLE_FIR_TAPS);
+                int32_t mu = phase & ((1 << shift) - 1);
+
+                *d++ = y0 + (((int64_t)(y1 - y0) * mu) >> shift);
+
+                phase += delta;
+                pos = phase >> 16;
+            }
+        }
+
+        pos = MIN(pos, count);
+
+        /* Keep the samples before pos as history for next time */
+        memmove(w, &w[pos], (RESAMPLE_FIR_TAPS-1)*sizeof (int32_t));
+    }
+    while (--ch >= 0);
+
+    /* Wrap phase accumulator back to start of next frame. */
+    data->phase = phase - (pos << 16);
+    data->fir_phase = fir_phase;
+
+    dst->remcount = d - dst->p32[0];
+    return pos;
+}
+
 /* Resample count stereo samples or stop when the destination is full.
  * Updates the src buffer and changes to its own output buffer to refer to
  * the resampled data. */
@@ -211,7 +443,8 @@ static void resample_process(struct dsp_proc_entry *this,
     {
         dst->bufcount = RESAMPLE_BUF_COUNT;
 
-        int consumed = resample_hermite(data, src, dst);
+        int consumed = data->fir ? resample_fir(data, src, dst) :
+                                   resample_hermite(data, src, dst);
 
         /* Advance src by consumed amount */
         if (consumed > 0)
@@ -301,6 +534,20 @@ static void INIT_ATTR resample_proc_init(struct dsp_proc_entry *this,
     this->process = resample_process;
 }
 
+static void resample_set_quality(struct dsp_proc_entry *this,
+                                 struct dsp_config *dsp,
+                                 unsigned int quality)
+{
+    struct resample_data *data = (void *)this->data;
+
+    if (data->quality == quality)
+        return;
+
+    data->quality = quality;
+    data->frequency = 0; /* Force a new setup on the next buffer */
+    dsp_proc_want_format_update(dsp, DSP_PROC_RESAMPLE);
+}
+
 /* DSP message hook */
 static intptr_t resample_configure(struct dsp_proc_entry *this,
                                    struct dsp_config *dsp,
@@ -335,6 +582,10 @@ static intptr_t resample_configure(struct dsp_proc_entry *this,
     case DSP_SET_OUT_FREQUENCY:
         dsp_proc_want_format_update(dsp, DSP_PROC_RESAMPLE);
         break;
+
+    case RESAMPLE_SET_QUALITY:
+        resample_set_quality(this, dsp, value);
+        break;
     }
 
     return retval;
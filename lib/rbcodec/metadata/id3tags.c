@@ -159,8 +159,6 @@ struct tag_resolver {
     bool binary;
 };
 
-static bool global_ff_found;
-
 static int unsynchronize(char* tag, int len, bool *ff_found)
 {
     int i;
@@ -196,7 +194,7 @@ static int unsynchronize_frame(char* tag, int len)
     return unsynchronize(tag, len, &ff_found);
 }
 
-static int read_unsynched(int fd, void *buf, int len)
+static int read_unsynched(int fd, void *buf, int len, bool *ff_found)
 {
     int i;
     int rc;
@@ -212,7 +210,7 @@ static int read_unsynched(int fd, void *buf, int len)
         if(rc <= 0)
             return rc;
 
-        i = unsynchronize(wp, remaining, &global_ff_found);
+        i = unsynchronize(wp, remaining, ff_found);
         remaining -= i;
         wp += i;
     }
@@ -220,7 +218,7 @@ static int read_unsynched(int fd, void *buf, int len)
     return len;
 }
 
-static int skip_unsynched(int fd, int len)
+static int skip_unsynched(int fd, int len, bool *ff_found)
 {
     int rc;
     int remaining = len;
@@ -233,7 +231,7 @@ static int skip_unsynched(int fd, int len)
         if(rc <= 0)
             return rc;
 
-        remaining -= unsynchronize(buf, rlen, &global_ff_found);
+        remaining -= unsynchronize(buf, rlen, ff_found);
     }
 
     return len;
@@ -725,6 +723,7 @@ void setid3v2title(int fd, struct mp3entry *entry)
     int flags;
     bool global_unsynch = false;
     bool unsynch = false;
+    bool global_ff_found = false;
     int i, j;
     int rc;
     bool itunes_gapless = false;
@@ -733,8 +732,6 @@ void setid3v2title(int fd, struct mp3entry *entry)
     entry->has_embedded_albumart = false;
 #endif
 
-    global_ff_found = false;
-
     /* Bail out if the tag is shorter than 10 bytes */
     if(entry->id3v2len < 10)
         return;
@@ -817,7 +814,7 @@ void setid3v2title(int fd, struct mp3entry *entry)
         /* Read frame header and check length */
         if(version >= ID3_VER_2_3) {
             if(global_unsynch && version <= ID3_VER_2_3)
-                rc = read_unsynched(fd, header, 10);
+                rc = read_unsynched(fd, header, 10, &global_ff_found);
             else
                 rc = read(fd, header, 10);
             if(rc != 10)
@@ -950,7 +947,7 @@ void setid3v2title(int fd, struct mp3entry *entry)
                 tag = buffer + bufferpos;
 
                 if(global_unsynch && version <= ID3_VER_2_3)
-                    bytesread = read_unsynched(fd, tag, framelen);
+                    bytesread = read_unsynched(fd, tag, framelen, &global_ff_found);
                 else
                     bytesread = read(fd, tag, framelen);
 
@@ -1099,7 +1096,7 @@ void setid3v2title(int fd, struct mp3entry *entry)
                skip it using the total size */
 
             if(global_unsynch && version <= ID3_VER_2_3) {
-                size -= skip_unsynched(fd, totframelen);
+                size -= skip_unsynched(fd, totframelen, &global_ff_found);
             } else {
                 size -= totframelen;
                 if( lseek(fd, totframelen, SEEK_CUR) == -1 )
@@ -1109,7 +1106,7 @@ void setid3v2title(int fd, struct mp3entry *entry)
             /* Seek to the next frame */
             if(framelen < totframelen) {
                 if(global_unsynch && version <= ID3_VER_2_3) {
-                    size -= skip_unsynched(fd, totframelen - framelen);
+                    size -= skip_unsynched(fd, totframelen - framelen, &global_ff_found);
                 }
                 else {
                     lseek(fd, totframelen - framelen, SEEK_CUR);
@@ -446,7 +446,15 @@ bool get_metadata(struct mp3entry* id3, int fd, const char* trackname)
         return false;
     }
 
-    if (!entry->parse_func(fd, id3))
+#ifdef HAVE_METADATA_PROBE
+    metadata_probe_begin(fd);
+    bool parsed = entry->parse_func(fd, id3);
+    metadata_probe_end(fd);
+#else
+    bool parsed = entry->parse_func(fd, id3);
+#endif
+
+    if (!parsed)
     {
         DEBUGF("parsing %s failed (format: %s)\n", trackname, entry->label);
         return false;
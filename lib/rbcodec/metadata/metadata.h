@@ -314,6 +314,9 @@ struct mp3entry {
     struct embedded_cuesheet embedded_cuesheet;
     struct cuesheet *cuesheet;
 
+    /* Seek index for MPEG audio without a VBR header (codec only) */
+    struct mp3_seekidx *seekidx;
+
     /* Musicbrainz Track ID */
     char* mb_track_id;
 };
@@ -331,4 +334,26 @@ void strip_tags(int handle_id);
 bool rbcodec_format_is_atomic(int afmt);
 bool format_buffers_with_offset(int afmt);
 
+/* Where every read is a system call, get_metadata() loads the head and
+   tail of the file with one read each and parses from there */
+#if ((CONFIG_PLATFORM & PLATFORM_HOSTED) || defined(__PCTOOL__)) && \
+    !defined(CODEC) && !defined(PLUGIN)
+#define HAVE_METADATA_PROBE
+
+struct metadata_probe_stat
+{
+    unsigned long probes;       /* Files parsed */
+    unsigned long calls;        /* read/lseek calls by the parsers */
+    unsigned long syscalls;     /* Calls that reached the file system */
+    unsigned long fallbacks;    /* Reads outside the head and tail */
+    unsigned long long bytes;   /* Read from the file system */
+    unsigned long last_calls;   /* The same for the last file */
+    unsigned long last_syscalls;
+};
+
+void metadata_probe_begin(int fd);
+void metadata_probe_end(int fd);
+void metadata_probe_get_stat(struct metadata_probe_stat *stat);
+#endif /* HAVE_METADATA_PROBE */
+
 #endif
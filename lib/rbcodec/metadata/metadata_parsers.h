@@ -58,3 +58,15 @@ bool get_sgc_metadata(int fd, struct mp3entry* id3);
 bool get_vgm_metadata(int fd, struct mp3entry* id3);
 bool get_kss_metadata(int fd, struct mp3entry* id3);
 bool get_aac_metadata(int fd, struct mp3entry* id3);
+
+#ifdef HAVE_METADATA_PROBE
+/* Have the parsers read through the window of get_metadata(). filesize()
+   is left alone; file.h may have it renaming the mp3entry member too. */
+ssize_t metadata_probe_read(int fd, void *buf, size_t count);
+off_t metadata_probe_lseek(int fd, off_t offset, int whence);
+
+#undef read
+#undef lseek
+#define read(fd, buf, count)        metadata_probe_read(fd, buf, count)
+#define lseek(fd, offset, whence)   metadata_probe_lseek(fd, offset, whence)
+#endif /* HAVE_METADATA_PROBE */
@@ -0,0 +1,342 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2026 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+/*
+ * The parsers walk tags, atoms and blocks with lots of small reads and
+ * seeks. On hosted targets each of those is a system call, which adds up
+ * on SD cards behind USB and on network mounts. While get_metadata() runs,
+ * the parsers' read() and lseek() on its descriptor go through here
+ * instead: the first PROBE_HEAD_SIZE bytes and the last PROBE_TAIL_SIZE
+ * bytes of the file are loaded with one read each. A small read outside
+ * of those moves the head window there, only large ones go to the file.
+ *
+ * This file must not include metadata_parsers.h, it does the real reads.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "platform.h"
+#include "logf.h"
+#include "metadata.h"
+
+#ifdef HAVE_METADATA_PROBE
+
+#define PROBE_HEAD_SIZE (32*1024)
+#define PROBE_TAIL_SIZE (8*1024)
+#define PROBE_SLOTS     16
+
+#if (defined(APPLICATION) || defined(__PCTOOL__)) && !defined(WIN32)
+/* The database scan parses files on several threads at once */
+#include <pthread.h>
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define probe_lock()    pthread_mutex_lock(&probe_mutex)
+#define probe_unlock()  pthread_mutex_unlock(&probe_mutex)
+#else
+#define probe_lock()
+#define probe_unlock()
+#endif
+
+/* A part of the file held in memory */
+struct probe_window
+{
+    off_t start;
+    size_t len;
+    bool loaded;
+};
+
+struct probe
+{
+    bool busy;
+    int fd;
+    off_t pos;              /* Position as seen by the parser */
+    off_t realpos;          /* Position of the descriptor */
+    off_t size;             /* File size, -1 until needed */
+    unsigned char *buf;     /* Head window followed by the tail window */
+    struct probe_window head;
+    struct probe_window tail;
+    unsigned long calls;
+    unsigned long syscalls;
+    unsigned long fallbacks;
+    unsigned long long bytes;
+};
+
+static struct probe probes[PROBE_SLOTS];
+static struct metadata_probe_stat probe_stat;
+
+static struct probe * find_probe(int fd)
+{
+    struct probe *p = NULL;
+
+    probe_lock();
+
+    for (int i = 0; i < PROBE_SLOTS; i++)
+    {
+        if (probes[i].busy && probes[i].fd == fd)
+        {
+            p = &probes[i];
+            break;
+        }
+    }
+
+    probe_unlock();
+    return p;
+}
+
+/* Position the descriptor and read from it */
+static ssize_t probe_file_read(struct probe *p, off_t pos, void *buf,
+                               size_t count)
+{
+    if (p->realpos != pos)
+    {
+        p->syscalls++;
+        p->realpos = lseek(p->fd, pos, SEEK_SET);
+        if (p->realpos != pos)
+            return -1;
+    }
+
+    p->syscalls++;
+    ssize_t n = read(p->fd, buf, count);
+    if (n > 0)
+    {
+        p->realpos += n;
+        p->bytes += n;
+    }
+
+    return n;
+}
+
+static off_t probe_size(struct probe *p)
+{
+    if (p->size < 0)
+    {
+        p->syscalls++;
+        p->size = filesize(p->fd);
+    }
+
+    return p->size;
+}
+
+static void load_window(struct probe *p, struct probe_window *w,
+                        unsigned char *buf, off_t start, size_t size)
+{
+    ssize_t n = probe_file_read(p, start, buf, size);
+
+    w->start = start;
+    w->len = MAX(n, 0);
+    w->loaded = true;
+
+    /* A short read found the end of the file */
+    if (n > 0 && (size_t)n < size)
+        p->size = start + n;
+}
+
+/* Copy from a window if it holds the whole read, or all of it up to the
+   end of the file */
+static bool window_read(struct probe *p, const struct probe_window *w,
+                        const unsigned char *buf, void *dest, size_t *count)
+{
+    off_t end = w->start + w->len;
+
+    if (!w->loaded || p->pos < w->start || p->pos > end)
+        return false;
+
+    if (p->pos + (off_t)*count > end)
+    {
+        if (end != p->size)
+            return false;
+
+        *count = end - p->pos;
+    }
+
+    memcpy(dest, buf + (p->pos - w->start), *count);
+    p->pos += *count;
+    return true;
+}
+
+ssize_t metadata_probe_read(int fd, void *buf, size_t count)
+{
+    struct probe *p = find_probe(fd);
+    if (!p)
+        return read(fd, buf, count);
+
+    p->calls++;
+
+    unsigned char *headbuf = p->buf;
+    unsigned char *tailbuf = p->buf + PROBE_HEAD_SIZE;
+
+    if (!p->head.loaded && p->pos < PROBE_HEAD_SIZE)
+        load_window(p, &p->head, headbuf, 0, PROBE_HEAD_SIZE);
+
+    if (window_read(p, &p->head, headbuf, buf, &count) ||
+        window_read(p, &p->tail, tailbuf, buf, &count))
+        return count;
+
+    /* Tags at the end of the file: ID3v1, APE, Lyrics3. Without the file
+       size there is no telling where they are, so read from the file. */
+    if (probe_size(p) < 0)
+    {
+        p->fallbacks++;
+    }
+    else if (!p->tail.loaded && p->pos >= p->size - PROBE_TAIL_SIZE)
+    {
+        off_t start = MAX(p->size - PROBE_TAIL_SIZE, 0);
+        load_window(p, &p->tail, tailbuf, start, p->size - start);
+
+        if (window_read(p, &p->tail, tailbuf, buf, &count))
+            return count;
+    }
+
+    if (p->size >= 0)
+    {
+        /* Past the head, e.g. after a skipped picture: move the head window
+           here unless the read alone would fill most of it */
+        p->fallbacks++;
+
+        if (count < PROBE_HEAD_SIZE / 2)
+        {
+            load_window(p, &p->head, headbuf, p->pos, PROBE_HEAD_SIZE);
+
+            if (window_read(p, &p->head, headbuf, buf, &count))
+                return count;
+        }
+    }
+
+    ssize_t n = probe_file_read(p, p->pos, buf, count);
+    if (n > 0)
+        p->pos += n;
+
+    return n;
+}
+
+off_t metadata_probe_lseek(int fd, off_t offset, int whence)
+{
+    struct probe *p = find_probe(fd);
+    if (!p)
+        return lseek(fd, offset, whence);
+
+    p->calls++;
+
+    switch (whence)
+    {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += p->pos;
+        break;
+    case SEEK_END:
+        offset += probe_size(p);
+        break;
+    default:
+        offset = -1;
+        break;
+    }
+
+    if (offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    p->pos = offset;
+    return offset;
+}
+
+void metadata_probe_begin(int fd)
+{
+    struct probe *p = NULL;
+
+    probe_lock();
+
+    for (int i = 0; i < PROBE_SLOTS; i++)
+    {
+        if (!probes[i].busy)
+        {
+            p = &probes[i];
+            p->busy = true;
+            p->fd = fd;
+            break;
+        }
+    }
+
+    probe_unlock();
+
+    /* With all slots in use, this file is parsed without one */
+    if (!p)
+        return;
+
+    if (!p->buf)
+        p->buf = malloc(PROBE_HEAD_SIZE + PROBE_TAIL_SIZE);
+
+    if (!p->buf)
+    {
+        probe_lock();
+        p->busy = false;
+        probe_unlock();
+        return;
+    }
+
+    p->size = -1;
+    p->head.loaded = false;
+    p->tail.loaded = false;
+    p->calls = 0;
+    p->syscalls = 1;
+    p->fallbacks = 0;
+    p->bytes = 0;
+    p->realpos = p->pos = lseek(fd, 0, SEEK_CUR);
+}
+
+void metadata_probe_end(int fd)
+{
+    struct probe *p = find_probe(fd);
+    if (!p)
+        return;
+
+    /* Leave the descriptor where the parser thinks it is */
+    if (p->realpos != p->pos)
+    {
+        p->syscalls++;
+        lseek(fd, p->pos, SEEK_SET);
+    }
+
+    logf("probe: %lu calls, %lu syscalls, %lu fallbacks",
+         p->calls, p->syscalls, p->fallbacks);
+
+    probe_lock();
+    probe_stat.probes++;
+    probe_stat.calls += p->calls;
+    probe_stat.syscalls += p->syscalls;
+    probe_stat.fallbacks += p->fallbacks;
+    probe_stat.bytes += p->bytes;
+    probe_stat.last_calls = p->calls;
+    probe_stat.last_syscalls = p->syscalls;
+    p->busy = false;
+    probe_unlock();
+}
+
+void metadata_probe_get_stat(struct metadata_probe_stat *stat)
+{
+    probe_lock();
+    *stat = probe_stat;
+    probe_unlock();
+}
+
+#endif /* HAVE_METADATA_PROBE */
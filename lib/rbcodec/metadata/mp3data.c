@@ -611,6 +611,112 @@ int get_mp3file_info(int fd, struct mp3info *info)
     return bytecount;
 }
 
+/* Walk every frame of the stream from idx->first_frame_offset up to endpos
+   and record the offset of every frame_step'th frame. When the table fills
+   up every other entry is dropped and the step doubled, so any length fits.
+   The table is left empty for streams with a constant bitrate, where the
+   offset is a simple function of time. Returns the number of frames, or a
+   negative value on error or when progressfunc returns false. */
+int build_mp3_seekidx(int fd, struct mp3_seekidx *idx, long endpos,
+                      bool (*progressfunc)(int),
+                      unsigned char *buf, size_t buflen)
+{
+    struct mp3info info;
+    unsigned long header, reference = 0;
+    long startpos = idx->first_frame_offset;
+    long pos = startpos;
+    long bufpos = pos;  /* File offset of buf[0] */
+    long buffill = 0;
+    long garbage = 0;
+    int last_bitrate = 0;
+    bool is_vbr = false;
+    unsigned long frames = 0;
+
+    idx->frame_count = 0;
+    idx->frame_step = 0;
+    idx->count = 0;
+
+    while (pos + 4 <= endpos)
+    {
+        long rel = pos - bufpos;
+
+        if (rel + 4 > buffill)
+        {
+            if (progressfunc &&
+                !progressfunc((pos - startpos) * 100LL / (endpos - startpos)))
+                return -2;
+
+            if (lseek(fd, pos, SEEK_SET) < 0)
+                return -1;
+
+            buffill = read(fd, buf, MIN((long)buflen, endpos - pos));
+            if (buffill < 4)
+                break;
+
+            bufpos = pos;
+            rel = 0;
+        }
+
+        header = bytes2int(buf[rel], buf[rel+1], buf[rel+2], buf[rel+3]);
+
+        if (!is_mp3frameheader(header) ||
+            !headers_have_same_type(reference, header) ||
+            !mp3headerinfo(&info, header) || info.frame_size <= 4)
+        {
+            /* Lost sync, search forward like the decoder would */
+            if (++garbage > 0x20000)
+                break;
+            pos++;
+            continue;
+        }
+
+        /* Only count frames the decoder can get completely */
+        if (pos + info.frame_size > endpos)
+            break;
+
+        garbage = 0;
+
+        if (!reference)
+        {
+            reference = header;
+            idx->frequency = info.frequency;
+            idx->frame_samples = info.frame_samples;
+            idx->frame_step = MAX(1, MP3_SEEKIDX_INTERVAL * info.frequency /
+                                     (1000 * info.frame_samples));
+        }
+
+        if (last_bitrate && info.bitrate != last_bitrate)
+            is_vbr = true;
+        last_bitrate = info.bitrate;
+
+        if (frames % idx->frame_step == 0)
+        {
+            if (idx->count >= MP3_SEEKIDX_ENTRIES)
+            {
+                for (int i = 0; i < MP3_SEEKIDX_ENTRIES/2; i++)
+                    idx->offset[i] = idx->offset[i*2];
+
+                idx->count = MP3_SEEKIDX_ENTRIES/2;
+                idx->frame_step *= 2;
+            }
+
+            if (frames % idx->frame_step == 0)
+                idx->offset[idx->count++] = pos;
+        }
+
+        frames++;
+        pos += info.frame_size;
+    }
+
+    VDEBUGF("Seek index: %lu frames, %s\n", frames, is_vbr ? "VBR" : "CBR");
+
+    idx->frame_count = frames;
+    if (!is_vbr)
+        idx->count = 0;
+
+    return frames;
+}
+
 #ifndef __PCTOOL__
 static void long2bytes(unsigned char *buf, long val)
 {
@@ -27,6 +27,7 @@
 #define MPEG_VERSION2_5 2
 
 #include <string.h> /* size_t */
+#include <stdint.h>
 
 struct mp3info {
     /* Standard MP3 frame header fields */
@@ -51,6 +52,25 @@ struct mp3info {
     int enc_padding;  /* Padded samples added to last frame. LAME header */
 };
 
+/* Seek index for streams without a VBR header. Entry i holds the file
+   offset of frame i*frame_step; a seek lands on that frame and decodes
+   forward to the exact sample. */
+#define MP3_SEEKIDX_MAGIC    0x52425331 /* "RBS1" */
+#define MP3_SEEKIDX_ENTRIES  1024
+#define MP3_SEEKIDX_INTERVAL 500   /* Initial spacing of entries in ms */
+
+struct mp3_seekidx {
+    uint32_t magic;
+    uint32_t filesize;          /* Stream size, as in mp3entry */
+    uint32_t first_frame_offset;
+    uint32_t frequency;
+    uint32_t frame_samples;     /* Samples per frame */
+    uint32_t frame_count;       /* Number of frames in the stream */
+    uint32_t frame_step;        /* Frames between two entries */
+    uint32_t count;             /* Used entries, 0 for a CBR stream */
+    uint32_t offset[MP3_SEEKIDX_ENTRIES];
+};
+
 /* Xing header information */
 #define VBR_FRAMES_FLAG  0x01
 #define VBR_BYTES_FLAG   0x02
@@ -71,6 +91,10 @@ unsigned long mem_find_next_frame(int startpos,
 int get_mp3file_info(int fd, 
                      struct mp3info *info);
 
+int build_mp3_seekidx(int fd, struct mp3_seekidx *idx, long endpos,
+                      bool (*progressfunc)(int),
+                      unsigned char *buf, size_t buflen);
+
 int count_mp3_frames(int fd,  int startpos,  int filesize,
                      void (*progressfunc)(int),
                      unsigned char* buf, size_t buflen);
@@ -1,2 +1,8 @@
 #include "../rbcodecconfig-example.h"
 
+#ifndef __ASSEMBLER__
+/* DSP stage profiling (-p) */
+unsigned long warble_profile_timer(void);
+#define DSP_PROFILE_TIMER()     warble_profile_timer()
+#define DSP_PROFILE_TIMER_HZ    1000000
+#endif
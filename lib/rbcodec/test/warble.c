@@ -21,21 +21,30 @@
 #define _DEFAULT_SOURCE /* htole64 from endian.h */
 #include <sys/types.h>
 #include <SDL.h>
+#include <dirent.h>
 #include <dlfcn.h>
 #include <endian.h>
 #include <fcntl.h>
+#include <linux/perf_event.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include "buffering.h" /* TYPE_PACKET_AUDIO */
 #include "kernel.h"
 #include "core_alloc.h"
 #include "codecs.h"
 #include "dsp_core.h"
+#include "dsp_proc_entry.h"
+#include "eq.h"
 #include "metadata.h"
 #include "settings.h"
 #include "sound.h"
@@ -95,10 +104,18 @@ off_t filesize(int fd)
     return st.st_size;
 }
 
+unsigned long warble_profile_timer(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
 /***************** INTERNAL *****************/
 
-static enum { MODE_PLAY, MODE_WRITE } mode;
+static enum { MODE_PLAY, MODE_WRITE, MODE_BENCH } mode;
 static bool use_dsp = true;
+static bool profile_dsp = false;
 static bool enable_loop = false;
 static const char *config = "";
 
@@ -379,11 +396,115 @@ static void playback_pcm(int16_t *pcm, int count)
     }
 }
 
+/***** MODE_BENCH *****/
+
+/* MODE_BENCH decodes every input file in its own worker process, since both
+ * warble and the codecs keep their state in globals. Output samples are only
+ * counted. Each worker measures the codec's run_proc() and sends a
+ * bench_result back to the parent through a pipe; the parent adds the peak
+ * RSS reported by wait4() and prints everything as JSON. */
+
+struct bench_result {
+    int status;             /* 0 when the codec finished without error */
+    int codectype;          /* AFMT_* of the file, AFMT_UNKNOWN if unparsed */
+    unsigned long freq;     /* codec output frequency */
+    unsigned long samples;  /* codec output samples (per channel) */
+    double cpu_time;        /* seconds of process CPU time in run_proc() */
+    double wall_time;       /* seconds of wall time in run_proc() */
+    uint64_t cycles;        /* user CPU cycles in run_proc() */
+    bool have_cycles;       /* false if no cycle counter is available */
+};
+
+static struct bench_result bench_res;
+static int bench_cycles_fd = -1;
+static struct timespec bench_cpu_start, bench_wall_start;
+
+static double timespec_diff(const struct timespec *start,
+                            const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Hardware cycle counters are often unavailable (VMs, perf_event_paranoid);
+ * the benchmark then reports cycles as null. */
+static void bench_cycles_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    bench_cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bench_start(void)
+{
+    bench_cycles_open();
+    if (bench_cycles_fd >= 0) {
+        ioctl(bench_cycles_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(bench_cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &bench_wall_start);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &bench_cpu_start);
+}
+
+static void bench_stop(void)
+{
+    struct timespec cpu_end, wall_end;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    if (bench_cycles_fd >= 0) {
+        ioctl(bench_cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+        bench_res.have_cycles = read(bench_cycles_fd, &bench_res.cycles,
+                                     sizeof(bench_res.cycles))
+                                == sizeof(bench_res.cycles);
+        close(bench_cycles_fd);
+        bench_cycles_fd = -1;
+    }
+
+    bench_res.cpu_time = timespec_diff(&bench_cpu_start, &cpu_end);
+    bench_res.wall_time = timespec_diff(&bench_wall_start, &wall_end);
+    bench_res.samples = num_output_samples;
+    bench_res.freq = format.freq;
+}
+
 /***** ALL MODES *****/
 
+/* Set EQ gains from a comma-separated list of dB values, one per band */
+static void set_eq(const char *val, const char *end)
+{
+    static const int cutoffs[EQ_NUM_BANDS] = {
+        32, 64, 125, 250, 500, 1000, 2000, 4000, 8000, 16000,
+    };
+
+    for (int band = 0; band < EQ_NUM_BANDS; band++) {
+        struct eq_band_setting setting = {
+            .cutoff = cutoffs[band],
+            .q = 7,
+            .gain = 0,
+        };
+
+        if (val < end) {
+            setting.gain = lrint(atof(val) * 10);
+            val += strcspn(val, ",: \t\n");
+            if (*val == ',')
+                val++;
+        }
+
+        dsp_set_eq_coefs(band, &setting);
+    }
+
+    dsp_eq_enable(true);
+}
+
 static void perform_config(void)
 {
-    /* TODO: equalizer, etc. */
+    /* TODO: tone controls, etc. */
     while (config) {
         const char *name = config;
         const char *eq = strchr(config, '=');
@@ -397,6 +518,8 @@ static void perform_config(void)
                 return;
         } else if (!strncmp(name, "dither=", 7)) {
             dsp_dither_enable(atoi(val) ? true : false);
+        } else if (!strncmp(name, "eq=", 3)) {
+            set_eq(val, end);
         } else if (!strncmp(name, "halt=", 5)) {
             if (atoi(val))
                 codec_action = CODEC_ACTION_HALT;
@@ -406,6 +529,8 @@ static void perform_config(void)
             ci.id3->offset = atoi(val);
         } else if (!strncmp(name, "rate=", 5)) {
             dsp_set_pitch(atof(val) * PITCH_SPEED_100);
+        } else if (!strncmp(name, "resample=", 9)) {
+            dsp_configure(ci.dsp, RESAMPLE_SET_QUALITY, atoi(val));
         } else if (!strncmp(name, "seek=", 5)) {
             codec_action = CODEC_ACTION_SEEK_TIME;
             codec_action_param = atoi(val);
@@ -440,7 +565,9 @@ static void ci_pcmbuf_insert(const void *ch1, const void *ch2, int count)
 {
     num_output_samples += count;
 
-    if (use_dsp) {
+    if (mode == MODE_BENCH) {
+        /* Only the codec is measured; its output is discarded */
+    } else if (use_dsp) {
         struct dsp_buffer src;
         src.remcount = count;
         src.pin[0] = ch1;
@@ -783,7 +910,10 @@ static void decode_file(const char *input_fn)
         fprintf(stderr, "error: metadata parsing failed\n");
         exit(1);
     }
-    print_mp3entry(&id3, stderr);
+    if (mode == MODE_BENCH)
+        bench_res.codectype = id3.codectype;
+    else
+        print_mp3entry(&id3, stderr);
     ci.filesize = filesize(input_fd);
     ci.id3 = &id3;
     if (use_dsp) {
@@ -791,13 +921,16 @@ static void decode_file(const char *input_fn)
         dsp_configure(ci.dsp, DSP_SET_OUT_FREQUENCY, DSP_OUT_DEFAULT_HZ);
         dsp_configure(ci.dsp, DSP_RESET, 0);
         dsp_dither_enable(false);
+        if (profile_dsp)
+            dsp_profile_enable(ci.dsp, true);
     }
     perform_config();
 
     /* Load codec */
     char str[MAX_PATH];
     snprintf(str, sizeof(str), CODECDIR"/%s.codec", audio_formats[id3.codectype].codec_root_fn);
-    debugf("Loading %s\n", str);
+    if (mode != MODE_BENCH)
+        debugf("Loading %s\n", str);
     void *dlcodec = dlopen(str, RTLD_NOW);
     if (!dlcodec) {
         fprintf(stderr, "error: dlopen failed: %s\n", dlerror());
@@ -824,7 +957,14 @@ static void decode_file(const char *input_fn)
         fprintf(stderr, "error: codec returned error from codec_main\n");
         exit(1);
     }
-    if (c_hdr->run_proc() != CODEC_OK) {
+    if (mode == MODE_BENCH)
+        bench_start();
+    int codec_status = c_hdr->run_proc();
+    if (mode == MODE_BENCH) {
+        bench_stop();
+        bench_res.status = codec_status;
+    }
+    if (codec_status != CODEC_OK) {
         fprintf(stderr, "error: codec error\n");
     }
     c_hdr->entry_point(CODEC_UNLOAD);
@@ -835,26 +975,355 @@ static void decode_file(const char *input_fn)
         close(input_fd);
 }
 
+static void print_dsp_profile(FILE *f)
+{
+    unsigned long elapsed = dsp_profile_elapsed(ci.dsp);
+    struct dsp_proc_stats stats;
+    const char *name;
+
+    fprintf(f, "%-14s %10s %12s %12s %8s %6s\n",
+            "DSP stage", "calls", "samples", "usec", "ns/smp", "%time");
+    for (unsigned int i = 0;
+         (name = dsp_profile_get_stats(ci.dsp, i, &stats)); i++) {
+        if (!stats.calls)
+            continue;
+        fprintf(f, "%-14s %10lu %12lu %12lu %8.1f %6.2f\n",
+                name, stats.calls, stats.samples, stats.time,
+                stats.samples ? 1000.0 * stats.time / stats.samples : 0.0,
+                elapsed ? 100.0 * stats.time / elapsed : 0.0);
+    }
+}
+
+/***** MODE_BENCH runner *****/
+
+static const char **bench_files;
+static size_t bench_num_files, bench_max_files;
+
+static void bench_add_file(const char *fn)
+{
+    if (bench_num_files == bench_max_files) {
+        bench_max_files = bench_max_files ? 2 * bench_max_files : 256;
+        bench_files = realloc(bench_files,
+                              bench_max_files * sizeof(*bench_files));
+        if (!bench_files) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    bench_files[bench_num_files++] = strdup(fn);
+}
+
+static int bench_cmp_files(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Recursively add all files with a known audio extension */
+static void bench_add_dir(const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if (!dir) {
+        perror(dirname);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+        if (stat(path, &st))
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            bench_add_dir(path);
+        else if (S_ISREG(st.st_mode) && probe_file_format(path) != AFMT_UNKNOWN)
+            bench_add_file(path);
+    }
+
+    closedir(dir);
+}
+
+static void bench_add_path(const char *fn)
+{
+    struct stat st;
+    if (!stat(fn, &st) && S_ISDIR(st.st_mode)) {
+        size_t first = bench_num_files;
+        bench_add_dir(fn);
+        qsort(bench_files + first, bench_num_files - first,
+              sizeof(*bench_files), bench_cmp_files);
+    } else {
+        bench_add_file(fn);
+    }
+}
+
+/* One path per line; "-" reads the list from stdin */
+static void bench_add_list(const char *list_fn)
+{
+    FILE *f = strcmp(list_fn, "-") ? fopen(list_fn, "r") : stdin;
+    if (!f) {
+        perror(list_fn);
+        exit(1);
+    }
+
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0])
+            bench_add_path(line);
+    }
+
+    if (f != stdin)
+        fclose(f);
+}
+
+static void json_print_string(FILE *f, const char *str)
+{
+    putc('"', f);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            putc(c, f);
+    }
+    putc('"', f);
+}
+
+static void json_print_ratio(FILE *f, double num, double den)
+{
+    if (den > 0)
+        fprintf(f, "%.6f", num / den);
+    else
+        fputs("null", f);
+}
+
+struct bench_file {
+    struct bench_result res;
+    bool ok;                /* worker exited cleanly and codec succeeded */
+    long peak_rss;          /* KiB */
+};
+
+struct bench_codec {
+    const char *name;
+    int files, failed;
+    unsigned long long samples;
+    double audio_time, cpu_time, wall_time;
+    uint64_t cycles;
+    bool have_cycles;
+    long peak_rss;
+};
+
+static void bench_print_stats(FILE *f, unsigned long long samples,
+                              double audio_time, double cpu_time,
+                              double wall_time, uint64_t cycles,
+                              bool have_cycles, long peak_rss)
+{
+    fprintf(f, "\"samples\": %llu, \"audio_seconds\": %.6f, "
+               "\"cpu_seconds\": %.6f, \"wall_seconds\": %.6f, "
+               "\"realtime\": ", samples, audio_time, cpu_time, wall_time);
+    json_print_ratio(f, audio_time, cpu_time);
+    fputs(", \"samples_per_sec\": ", f);
+    json_print_ratio(f, samples, cpu_time);
+    fputs(", \"cycles_per_sample\": ", f);
+    json_print_ratio(f, cycles, have_cycles ? (double)samples : 0);
+    fprintf(f, ", \"peak_rss_kb\": %ld", peak_rss);
+}
+
+static void bench_child(const char *fn, int result_fd)
+{
+    mode = MODE_BENCH;
+    use_dsp = false;
+    bench_res.codectype = AFMT_UNKNOWN;
+    decode_file(fn);
+    if (write(result_fd, &bench_res, sizeof(bench_res)) != sizeof(bench_res)) {
+        perror("write");
+        exit(1);
+    }
+    close(result_fd);
+    exit(0);
+}
+
+static int bench_run(int jobs)
+{
+    struct bench_file *results = calloc(bench_num_files, sizeof(*results));
+    if (!results) {
+        perror("calloc");
+        exit(1);
+    }
+    struct {
+        pid_t pid;
+        int fd;
+        size_t index;
+    } workers[jobs];
+    int running = 0;
+    size_t next = 0;
+
+    while (next < bench_num_files || running > 0) {
+        while (running < jobs && next < bench_num_files) {
+            int fds[2];
+            if (pipe(fds)) {
+                perror("pipe");
+                exit(1);
+            }
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == -1) {
+                perror("fork");
+                exit(1);
+            }
+            if (pid == 0) {
+                /* Don't hold the other workers' pipes open: the parent
+                   would not see their EOF if they die */
+                for (int i = 0; i < running; i++)
+                    close(workers[i].fd);
+                close(fds[0]);
+                bench_child(bench_files[next], fds[1]);
+            }
+            close(fds[1]);
+            workers[running].pid = pid;
+            workers[running].fd = fds[0];
+            workers[running].index = next++;
+            running++;
+        }
+
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &status, 0, &ru);
+        if (pid == -1) {
+            perror("wait4");
+            exit(1);
+        }
+
+        int i;
+        for (i = 0; i < running && workers[i].pid != pid; i++);
+        if (i == running)
+            continue;
+
+        struct bench_file *bf = &results[workers[i].index];
+        bf->res.codectype = AFMT_UNKNOWN;
+        bool got = read(workers[i].fd, &bf->res, sizeof(bf->res))
+                   == sizeof(bf->res);
+        bf->ok = got && WIFEXITED(status) && WEXITSTATUS(status) == 0
+                 && bf->res.status == CODEC_OK;
+        bf->peak_rss = ru.ru_maxrss;
+        close(workers[i].fd);
+        workers[i] = workers[--running];
+    }
+
+    /* Aggregate per codec; several formats can share one codec */
+    struct bench_codec codecs[AFMT_NUM_CODECS];
+    int num_codecs = 0, failed = 0;
+    for (size_t i = 0; i < bench_num_files; i++) {
+        struct bench_file *bf = &results[i];
+        if (!bf->ok)
+            failed++;
+        if (bf->res.codectype <= AFMT_UNKNOWN
+                || bf->res.codectype >= AFMT_NUM_CODECS)
+            continue;
+
+        const char *name = audio_formats[bf->res.codectype].codec_root_fn;
+        int c;
+        for (c = 0; c < num_codecs && strcmp(codecs[c].name, name); c++);
+        if (c == num_codecs) {
+            memset(&codecs[c], 0, sizeof(codecs[c]));
+            codecs[c].name = name;
+            codecs[c].have_cycles = true;
+            num_codecs++;
+        }
+
+        struct bench_codec *bc = &codecs[c];
+        bc->files++;
+        if (!bf->ok) {
+            bc->failed++;
+            continue;
+        }
+        bc->samples += bf->res.samples;
+        if (bf->res.freq)
+            bc->audio_time += (double)bf->res.samples / bf->res.freq;
+        bc->cpu_time += bf->res.cpu_time;
+        bc->wall_time += bf->res.wall_time;
+        bc->cycles += bf->res.cycles;
+        bc->have_cycles = bc->have_cycles && bf->res.have_cycles;
+        if (bf->peak_rss > bc->peak_rss)
+            bc->peak_rss = bf->peak_rss;
+    }
+
+    printf("{\n  \"jobs\": %d,\n  \"num_files\": %zu,\n  \"failed\": %d,\n"
+           "  \"files\": [", jobs, bench_num_files, failed);
+    for (size_t i = 0; i < bench_num_files; i++) {
+        struct bench_file *bf = &results[i];
+        int type = bf->res.codectype;
+        printf("%s\n    {\"path\": ", i ? "," : "");
+        json_print_string(stdout, bench_files[i]);
+        fputs(", \"codec\": ", stdout);
+        if (type > AFMT_UNKNOWN && type < AFMT_NUM_CODECS)
+            json_print_string(stdout, audio_formats[type].codec_root_fn);
+        else
+            fputs("null", stdout);
+        printf(", \"ok\": %s, ", bf->ok ? "true" : "false");
+        bench_print_stats(stdout, bf->res.samples,
+                          bf->res.freq ?
+                            (double)bf->res.samples / bf->res.freq : 0,
+                          bf->res.cpu_time, bf->res.wall_time,
+                          bf->res.cycles, bf->res.have_cycles, bf->peak_rss);
+        putchar('}');
+    }
+    fputs("\n  ],\n  \"codecs\": {", stdout);
+    for (int c = 0; c < num_codecs; c++) {
+        struct bench_codec *bc = &codecs[c];
+        printf("%s\n    ", c ? "," : "");
+        json_print_string(stdout, bc->name);
+        printf(": {\"files\": %d, \"failed\": %d, ", bc->files, bc->failed);
+        bench_print_stats(stdout, bc->samples, bc->audio_time, bc->cpu_time,
+                          bc->wall_time, bc->cycles, bc->have_cycles,
+                          bc->peak_rss);
+        putchar('}');
+    }
+    fputs("\n  }\n}\n", stdout);
+
+    free(results);
+    return failed ? 1 : 0;
+}
+
 static void print_help(const char *progname)
 {
     fprintf(stderr, "Usage:\n"
                     "        Play: %s [options] INPUTFILE\n"
                     "Write to WAV: %s [options] INPUTFILE OUTPUTFILE\n"
+                    "   Benchmark: %s -b [options] [-l LISTFILE] [INPUT...]\n"
                     "\n"
                     "general options:\n"
                     "  -c a=1:b=2    Configuration (see below)\n"
                     "  -h            Show this help\n"
+                    "  -p            Print time spent in each DSP stage when done\n"
                     "\n"
                     "write to WAV options:\n"
                     "  -f            Write raw codec output converted to 64-bit float\n"
                     "  -r            Write raw 32-bit codec output without WAV header\n"
                     "\n"
+                    "benchmark options:\n"
+                    "  -b            Decode all inputs without output and print\n"
+                    "                per-file and per-codec statistics as JSON;\n"
+                    "                directories are searched recursively\n"
+                    "  -j <n>        Run <n> decoders in parallel [number of CPUs]\n"
+                    "  -l <file>     Also decode the files listed in <file>, one\n"
+                    "                per line (- for stdin)\n"
+                    "\n"
                     "configuration:\n"
                     "  dither=<0|1>  Enable/disable dithering [0]\n"
+                    "  eq=<n>,...    Enable EQ with the given band gains in dB\n"
+                    "                (32 Hz to 16 kHz, 10 bands)\n"
                     "  halt=<0|1>    Stop decoding if 1 [0]\n"
                     "  loop=<0|1>    Enable/disable looping [0]\n"
                     "  offset=<n>    Start at byte offset within the file [0]\n"
                     "  rate=<n>      Multiply rate by <n> [1.0]\n"
+                    "  resample=<n>  Resampler quality, 0=low, 1=high [0]\n"
                     "  seek=<n>      Seek <n> ms into the file\n"
                     "  tempo=<n>     Timestretch by <n> [1.0]\n"
                     "  vol=<n>       Set volume attenuation to <n> dB [-0]\n"
@@ -866,17 +1335,35 @@ static void print_help(const char *progname)
                     "  %s in.adx -c loop=1:wait=44100:halt=1\n"
                     "  # Lower pitch 1 octave and write to out.wav\n"
                     "  %s in.ogg -c rate=0.5:tempo=2 out.wav\n"
-                    , progname, progname, progname, progname);
+                    "  # Benchmark all codecs on a music library using 4 cores\n"
+                    "  %s -b -j 4 ~/Music > bench.json\n"
+                    , progname, progname, progname, progname, progname,
+                    progname);
 }
 
 int main(int argc, char **argv)
 {
     int opt;
-    while ((opt = getopt(argc, argv, "c:fhr")) != -1) {
+    bool bench = false;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *list_fn = NULL;
+    while ((opt = getopt(argc, argv, "bc:fhj:l:pr")) != -1) {
         switch (opt) {
+        case 'b':
+            bench = true;
+            break;
         case 'c':
             config = optarg;
             break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'l':
+            list_fn = optarg;
+            break;
+        case 'p':
+            profile_dsp = true;
+            break;
         case 'f':
             use_dsp = false;
             break;
@@ -891,6 +1378,21 @@ int main(int argc, char **argv)
         }
     }
 
+    if (bench) {
+        if (jobs < 1)
+            jobs = 1;
+        if (list_fn)
+            bench_add_list(list_fn);
+        for (int i = optind; i < argc; i++)
+            bench_add_path(argv[i]);
+        if (bench_num_files == 0) {
+            fprintf(stderr, "error: no input files\n");
+            print_help(argv[0]);
+            exit(1);
+        }
+        return bench_run(jobs);
+    }
+
     if (argc == optind + 2) {
         write_init(argv[optind + 1]);
     } else if (argc == optind + 1) {
@@ -910,6 +1412,9 @@ int main(int argc, char **argv)
 
     decode_file(argv[optind]);
 
+    if (profile_dsp && use_dsp)
+        print_dsp_profile(stderr);
+
     if (mode == MODE_WRITE)
         write_quit();
     else if (mode == MODE_PLAY)
@@ -7,11 +7,56 @@
 
 #include "config.h"
 #include "tagcache.h"
+#include "metadata.h"
 #include "dir.h"
 
 /* This is meant to be run on the root of the dap. it'll put the db files into
  * a .rockbox subdir */
 
+#ifdef TAGCACHE_PARALLEL_SCAN
+static long rate(long count, uint64_t us)
+{
+    return us ? (long)(count * 1000000LL / us) : 0;
+}
+
+static void print_scan_stat(void)
+{
+    const struct tagcache_scan_stat *s = &tagcache_get_stat()->scan;
+    uint64_t walk_us = s->total_us - s->write_us - s->stall_us;
+
+    if (s->threads == 0)
+        return;
+
+    printf("Scanned in %ld ms, %d reader threads\n",
+           (long)(s->total_us / 1000), s->threads);
+    printf("  walk:  %6ld entries %8ld entries/s\n",
+           s->walked, rate(s->walked, walk_us));
+    printf("  read:  %6ld files   %8ld files/s\n",
+           s->read, rate(s->read, s->read_us / s->threads));
+    printf("  write: %6ld entries %8ld entries/s %6ld KB/s\n",
+           s->written, rate(s->written, s->write_us),
+           rate(s->written_bytes, s->write_us) / 1024);
+    printf("  stall: %6ld ms waiting for the readers\n",
+           (long)(s->stall_us / 1000));
+}
+#endif /* TAGCACHE_PARALLEL_SCAN */
+
+#ifdef HAVE_METADATA_PROBE
+static void print_probe_stat(void)
+{
+    struct metadata_probe_stat s;
+    metadata_probe_get_stat(&s);
+
+    if (s.probes == 0)
+        return;
+
+    printf("Metadata: %lu files, %lu reads/seeks, %lu syscalls "
+           "(%lu.%02lu per file), %lu outside the window, %llu KB read\n",
+           s.probes, s.calls, s.syscalls, s.syscalls / s.probes,
+           s.syscalls * 100 / s.probes % 100, s.fallbacks, s.bytes / 1024);
+}
+#endif /* HAVE_METADATA_PROBE */
+
 int main(int argc, char **argv)
 {
     (void)argc;
@@ -26,6 +71,12 @@ int main(int argc, char **argv)
     const char *paths[] = { "/", NULL };
     tagcache_init();
     do_tagcache_build(paths);
+#ifdef TAGCACHE_PARALLEL_SCAN
+    print_scan_stat();
+#endif
+#ifdef HAVE_METADATA_PROBE
+    print_probe_stat();
+#endif
     tagcache_reverse_scan();
     
     return 0;